@@ -0,0 +1,332 @@
+// bench: time system calls, process creation, pipes and the
+// file system, to compare one kernel build with another.
+//
+//   bench            run every benchmark
+//   bench name...    run only the named ones
+//
+// Each benchmark prints one tab-separated line:
+//   name  ops  usecs  ops/sec  cycles/op
+// after a header line starting with '#', so the output can
+// be saved and compared with a script.  "create" also reports
+// unlink.  Files are made in the current directory and
+// removed afterwards.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define FILESIZE (256*1024)  // bytes in the read and write file
+#define CHUNK    4096        // bytes per sequential read or write
+#define RCHUNK   512         // bytes per random read or write, a block
+
+char buf[CHUNK];
+uint seed = 1;
+
+int _getpid(void);  // the system call behind ulib's getpid()
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static inline uint64
+rdtsc(void)
+{
+  uint64 t;
+
+  asm volatile("rdtsc" : "=A" (t));
+  return t;
+}
+
+// n / d, without the 64-bit division user programs lack.
+static uint64
+div64(uint64 n, uint d)
+{
+  uint64 q, r;
+  int i;
+
+  q = r = 0;
+  for(i = 63; i >= 0; i--){
+    r = r << 1 | ((n >> i) & 1);
+    q <<= 1;
+    if(r >= d){
+      r -= d;
+      q |= 1;
+    }
+  }
+  return q;
+}
+
+static uint64 ns0, tsc0;
+
+static void
+start(void)
+{
+  nanotime(&ns0);
+  tsc0 = rdtsc();
+}
+
+// Report ops operations since start().
+static void
+stop(char *name, uint ops)
+{
+  uint64 ns, tsc;
+
+  tsc = rdtsc() - tsc0;
+  nanotime(&ns);
+  ns -= ns0;
+  if(ns == 0)
+    ns = 1;
+  printf(1, "%s\t%d\t%d\t%d\t%d\n", name, ops, (uint)div64(ns, 1000),
+         (uint)div64((uint64)ops * 1000000000, ns), (uint)div64(tsc, ops));
+}
+
+static void
+fail(char *what)
+{
+  printf(2, "bench: %s failed\n", what);
+  exit();
+}
+
+void
+nullcall(void)
+{
+  int i, n;
+
+  n = 20000;
+  start();
+  for(i = 0; i < n; i++)
+    _getpid();
+  stop("null", n);
+}
+
+void
+forkexit(void)
+{
+  int i, n, pid;
+
+  n = 200;
+  start();
+  for(i = 0; i < n; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0)
+      exit();
+    waitpid(pid, 0);
+  }
+  stop("fork", n);
+}
+
+void
+forkexec(void)
+{
+  char *argv[] = { "/bench", "-x", 0 };
+  int i, n, pid;
+
+  n = 50;
+  start();
+  for(i = 0; i < n; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec(argv[0], argv);
+      fail("exec");
+    }
+    waitpid(pid, 0);
+  }
+  stop("exec", n);
+}
+
+// A byte each way between parent and child.
+void
+pingpong(void)
+{
+  int i, n, pid, to[2], from[2];
+  char c;
+
+  n = 2000;
+  if(pipe(to) < 0 || pipe(from) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(to[1]);
+    close(from[0]);
+    while(read(to[0], &c, 1) == 1)
+      write(from[1], &c, 1);
+    exit();
+  }
+  close(to[0]);
+  close(from[1]);
+  start();
+  for(i = 0; i < n; i++){
+    if(write(to[1], "x", 1) != 1 || read(from[0], &c, 1) != 1)
+      fail("pipe ping-pong");
+  }
+  stop("pipe", n);
+  close(to[1]);
+  close(from[0]);
+  waitpid(pid, 0);
+}
+
+// Write bench.tmp from scratch, timed as name unless name is 0.
+static void
+writefile(char *name)
+{
+  int fd, i, n;
+
+  n = FILESIZE / CHUNK;
+  unlink("bench.tmp");
+  memset(buf, 'b', sizeof(buf));
+  if((fd = open("bench.tmp", O_CREATE|O_RDWR)) < 0)
+    fail("create bench.tmp");
+  if(name)
+    start();
+  for(i = 0; i < n; i++)
+    if(write(fd, buf, CHUNK) != CHUNK)
+      fail("write");
+  close(fd);
+  if(name)
+    stop(name, n);
+}
+
+// Open bench.tmp, writing it first if an earlier
+// benchmark has not.
+static int
+openfile(int mode)
+{
+  int fd;
+
+  if((fd = open("bench.tmp", mode)) < 0){
+    writefile(0);
+    if((fd = open("bench.tmp", mode)) < 0)
+      fail("open bench.tmp");
+  }
+  return fd;
+}
+
+void
+seqwrite(void)
+{
+  writefile("seqwrite");
+}
+
+void
+seqread(void)
+{
+  int fd, i, n;
+
+  n = FILESIZE / CHUNK;
+  fd = openfile(O_RDONLY);
+  start();
+  for(i = 0; i < n; i++)
+    if(read(fd, buf, CHUNK) != CHUNK)
+      fail("read");
+  stop("seqread", n);
+  close(fd);
+}
+
+void
+randwrite(void)
+{
+  int fd, i, n;
+
+  n = 500;
+  fd = openfile(O_RDWR);
+  start();
+  for(i = 0; i < n; i++)
+    if(pwrite(fd, buf, RCHUNK, rand() % (FILESIZE/RCHUNK) * RCHUNK) != RCHUNK)
+      fail("pwrite");
+  stop("randwrite", n);
+  close(fd);
+}
+
+void
+randread(void)
+{
+  int fd, i, n;
+
+  n = 2000;
+  fd = openfile(O_RDONLY);
+  start();
+  for(i = 0; i < n; i++)
+    if(pread(fd, buf, RCHUNK, rand() % (FILESIZE/RCHUNK) * RCHUNK) != RCHUNK)
+      fail("pread");
+  stop("randread", n);
+  close(fd);
+}
+
+// Create and then unlink files in a fresh directory.
+void
+createunlink(void)
+{
+  char name[16];
+  int fd, i, n;
+
+  n = 100;
+  if(mkdir("bench.dir") < 0)
+    fail("mkdir bench.dir");
+  strcpy(name, "bench.dir/f00");
+  start();
+  for(i = 0; i < n; i++){
+    name[11] = '0' + i / 10;
+    name[12] = '0' + i % 10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    close(fd);
+  }
+  stop("create", n);
+  start();
+  for(i = 0; i < n; i++){
+    name[11] = '0' + i / 10;
+    name[12] = '0' + i % 10;
+    if(unlink(name) < 0)
+      fail("unlink");
+  }
+  stop("unlink", n);
+  unlink("bench.dir");
+}
+
+struct bench {
+  char *name;
+  void (*fn)(void);
+} benches[] = {
+  { "null", nullcall },
+  { "fork", forkexit },
+  { "exec", forkexec },
+  { "pipe", pingpong },
+  { "seqwrite", seqwrite },
+  { "seqread", seqread },
+  { "randwrite", randwrite },
+  { "randread", randread },
+  { "create", createunlink },
+};
+
+#define NBENCH (sizeof(benches) / sizeof(benches[0]))
+
+int
+main(int argc, char *argv[])
+{
+  int i, j;
+
+  // The process that forkexec() runs.
+  if(argc == 2 && strcmp(argv[1], "-x") == 0)
+    exit();
+
+  printf(1, "# name\tops\tusecs\tops/sec\tcycles/op\n");
+  for(i = 0; i < NBENCH; i++){
+    if(argc > 1){
+      for(j = 1; j < argc; j++)
+        if(strcmp(argv[j], benches[i].name) == 0)
+          break;
+      if(j == argc)
+        continue;
+    }
+    benches[i].fn();
+  }
+  unlink("bench.tmp");
+  exit();
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,6 +17,12 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed on (dev, blockno) into NBUCKET chains,
+// each with its own lock, so lookups of different blocks
+// rarely contend.  A miss recycles the least recently
+// released unused buffer; bcache.lock serializes misses,
+// which is what lets a miss hold more than one bucket lock.
 
 #include "types.h"
 #include "defs.h"
@@ -25,71 +31,147 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stats.h"
+
+#define NBUCKET 61
+#define BHASH(dev, blockno) (((dev)*7 + (blockno)) % NBUCKET)
+
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;  // chain through buf->next
+};
 
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  struct bucket bucket[NBUCKET];
+  uint nhit;         // bget()s that found the block
+  uint nmiss;        // bget()s that recycled a buffer
 } bcache;
 
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head = 0;
+  }
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  // Spread the (unused) buffers over the buckets.
+  for(i = 0, b = bcache.buf; b < bcache.buf+NBUF; i++, b++){
+    b->dev = -1;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bk = &bcache.bucket[i % NBUCKET];
+    b->next = bk->head;
+    bk->head = b;
   }
 }
 
+// Find the buffer for dev, blockno in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Unlink b from bucket bk.  Caller must hold bk->lock.
+static void
+bunlink(struct bucket *bk, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bk->head; *pp != b; pp = &(*pp)->next)
+    if(*pp == 0)
+      panic("bunlink");
+  *pp = b->next;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  struct bucket *bk, *vbk, *obk;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(dev, blockno)];
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    __sync_fetch_and_add(&bcache.nhit, 1);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bk->lock);
+
+  // Not cached; recycle the least recently used unused buffer.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+
+  // Someone else may have cached it while we had no lock.
+  if((b = bfind(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    __sync_fetch_and_add(&bcache.nhit, 1);
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached; recycle an unused buffer.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // because log.c has logged it but not yet written it home.
+  // Keep the lock of the bucket holding the best candidate.
+  victim = 0;
+  vbk = 0;
+  for(obk = bcache.bucket; obk < bcache.bucket+NBUCKET; obk++){
+    if(obk != bk)
+      acquire(&obk->lock);
+    for(b = obk->head; b; b = b->next){
+      if(b->refcnt != 0 || (b->flags & B_DIRTY) != 0)
+        continue;
+      if(victim == 0 || b->lastuse < victim->lastuse){
+        if(vbk && vbk != bk && vbk != obk)
+          release(&vbk->lock);
+        victim = b;
+        vbk = obk;
+      }
     }
+    if(obk != bk && obk != vbk)
+      release(&obk->lock);
   }
-  panic("bget: no buffers");
+  if(victim == 0)
+    panic("bget: no buffers");
+
+  bunlink(vbk, victim);
+  if(vbk != bk)
+    release(&vbk->lock);
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->flags = 0;
+  victim->refcnt = 1;
+  victim->next = bk->head;
+  bk->head = victim;
+  release(&bk->lock);
+  bcache.nmiss++;
+  release(&bcache.lock);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +187,46 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block, zeroed
+// instead of read from the disk, for a block whose old
+// contents don't matter: one just allocated, or one that
+// is about to be overwritten in full.
+struct buf*
+bclear(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Start reading the indicated block into the cache unless
+// it is already there, without waiting for the disk.
+// The disk driver calls bdone() when the read completes.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = &bcache.bucket[BHASH(dev, blockno)];
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  iderw(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,8 +237,26 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Drop a reference to an unlocked buffer.
+// Stamp it so that bget() recycles the least recently
+// released buffers first.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    b->lastuse = ticks;
+  }
+  
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
@@ -124,21 +264,29 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// Release a buffer whose read-ahead has completed.
+// Called by the disk driver, possibly from an interrupt,
+// on behalf of the process that called breadahead().
+void
+bdone(struct buf *b)
+{
+  if((b->flags & B_ASYNC) == 0)
+    panic("bdone");
+  b->flags &= ~B_ASYNC;
+  releasesleep(&b->lock);
+  bput(b);
+}
+
+// Fill in st's buffer cache counters.
+void
+bstat(struct sysstat *st)
+{
+  st->nbuf = NBUF;
+  st->bhit = bcache.nhit;
+  st->bmiss = bcache.nmiss;
 }
 //PAGEBREAK!
 // Blank page.
-
@@ -22,6 +22,8 @@ bootmain(void)
   void (*entry)(void);
   uchar* pa;
 
+  *(uint*)BOOTTSC = rdtsc();  // for the kernel's boot timing
+
   elf = (struct elfhdr*)0x10000;  // scratch space
 
   // Read 1st page off disk
@@ -55,22 +57,25 @@ waitdisk(void)
     ;
 }
 
-// Read a single sector at offset into dst.
+// Read n sectors, 1 to 256, at offset into dst
+// with a single command.
 void
-readsect(void *dst, uint offset)
+readsects(uchar *dst, uint offset, uint n)
 {
   // Issue command.
   waitdisk();
-  outb(0x1F2, 1);   // count = 1
+  outb(0x1F2, n);   // count; 0 means 256
   outb(0x1F3, offset);
   outb(0x1F4, offset >> 8);
   outb(0x1F5, offset >> 16);
   outb(0x1F6, (offset >> 24) | 0xE0);
   outb(0x1F7, 0x20);  // cmd 0x20 - read sectors
 
-  // Read data.
-  waitdisk();
-  insl(0x1F0, dst, SECTSIZE/4);
+  // Read data, a sector each time the disk is ready.
+  for(; n > 0; n--, dst += SECTSIZE){
+    waitdisk();
+    insl(0x1F0, dst, SECTSIZE/4);
+  }
 }
 
 // Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
@@ -79,6 +84,7 @@ void
 readseg(uchar* pa, uint count, uint offset)
 {
   uchar* epa;
+  uint n;
 
   epa = pa + count;
 
@@ -88,9 +94,13 @@ readseg(uchar* pa, uint count, uint offset)
   // Translate from bytes to sectors; kernel starts at sector 1.
   offset = (offset / SECTSIZE) + 1;
 
-  // If this is too slow, we could read lots of sectors at a time.
+  // Read as many sectors at a time as one command allows.
   // We'd write more to memory than asked, but it doesn't matter --
   // we load in increasing order.
-  for(; pa < epa; pa += SECTSIZE, offset++)
-    readsect(pa, offset);
+  for(; pa < epa; pa += n*SECTSIZE, offset += n){
+    n = (epa - pa + SECTSIZE - 1) / SECTSIZE;
+    if(n > 256)
+      n = 256;
+    readsects(pa, offset, n);
+  }
 }
@@ -11,6 +11,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "kbd.h"
+#include "ioctl.h"
 
 static void consputc(int);
 
@@ -20,9 +21,16 @@ static struct
 {
     struct spinlock lock;
     int locking;
+    int raw; // keys go straight to readers, unedited; see ioctl.h
 } cons;
 
-#define UNDO_BUF 128
+// Undo log for the line being edited.  Each record covers a
+// whole run of text: a word typed, a paste, a run of backspaces
+// or a deleted selection.  The text a deletion removed is kept
+// in undo.text, in record order, so that C('Z') can put it back.
+// When the log is full the oldest records are forgotten.
+#define UNDO_OPS 32
+#define UNDO_TEXT 256
 enum
 {
     OP_INSERT,
@@ -31,13 +39,16 @@ enum
 struct op
 {
     char type;
-    char c;
-    uint pos;
+    int pos;  // line offset of the run
+    int len;
+    int text; // OP_DELETE: offset of the removed text in undo.text
 };
 struct
 {
-    struct op buf[UNDO_BUF];
+    struct op buf[UNDO_OPS];
     uint n;
+    char text[UNDO_TEXT];
+    int ntext;
 } undo;
 
 static void
@@ -126,6 +137,7 @@ void panic(char *s)
 
     cli();
     cons.locking = 0;
+    uartpanic();
     cprintf("lapicid %d: panic: ", lapicid());
     cprintf(s);
     cprintf("\n");
@@ -139,43 +151,133 @@ void panic(char *s)
 
 #define BACKSPACE 0x100
 #define CRTPORT 0x3d4
-static ushort *crt = (ushort *)P2V(0xb8000);
+
+// The CGA's memory holds many screens' worth of text.  crt is
+// the part of it on the screen, and the screen scrolls by moving
+// the controller's start address down a line, so output costs no
+// copying until the text reaches VIEW; then the screen is copied
+// back to the start of the memory once.  Lines that leave the top
+// are saved in the scrollback ring, which PgUp and PgDn page through
+// by drawing it at VIEW and showing that instead, leaving the live
+// screen untouched behind it.
+#define CGAMEM ((ushort *)P2V(0xb8000))
+#define CGACELLS (16 * 1024 / 2)
+#define VIEW (CGACELLS - 25 * 80)
+static ushort *crt = CGAMEM;
+
+static struct
+{
+    ushort buf[NSCROLLBACK][80];
+    uint n;   // lines ever saved; buf holds the last NSCROLLBACK
+    int view; // lines the screen is scrolled back, 0 if live
+} scrollback;
 
 static void clear_selection(void);
 
+// The cursor's cell in the CGA's memory, as last set, so that
+// finding it needs no port I/O.  -1 until first read.
+static int cursor = -1;
+
 static int
 cga_get_cursor_pos(void)
 {
-    int pos;
-    outb(CRTPORT, 14);
-    pos = inb(CRTPORT + 1) << 8;
-    outb(CRTPORT, 15);
-    pos |= inb(CRTPORT + 1);
-    return pos;
+    if (cursor < 0)
+    {
+        outb(CRTPORT, 14);
+        cursor = inb(CRTPORT + 1) << 8;
+        outb(CRTPORT, 15);
+        cursor |= inb(CRTPORT + 1);
+    }
+    return cursor - (crt - CGAMEM);
 }
 
 static void
 cga_set_cursor_pos(int pos)
 {
+    pos += crt - CGAMEM;
+    if (pos == cursor)
+        return;
+    cursor = pos;
     outb(CRTPORT, 14);
     outb(CRTPORT + 1, pos >> 8);
     outb(CRTPORT, 15);
     outb(CRTPORT + 1, pos);
 }
 
+// Show the screen that starts at cell off of the CGA's memory.
 static void
-cgaputc(int c)
+cga_set_start(int off)
 {
-    int pos;
+    outb(CRTPORT, 12);
+    outb(CRTPORT + 1, off >> 8);
+    outb(CRTPORT, 13);
+    outb(CRTPORT + 1, off);
+}
 
-    pos = cga_get_cursor_pos();
+// Move the screen up a line, blanking the new bottom line.
+static void
+cga_scroll(void)
+{
+    memmove(scrollback.buf[scrollback.n++ % NSCROLLBACK], crt,
+            sizeof(crt[0]) * 80);
+    if (crt - CGAMEM + 26 * 80 > VIEW)
+    {
+        memmove(CGAMEM, crt + 80, sizeof(crt[0]) * 23 * 80);
+        crt = CGAMEM;
+    }
+    else
+        crt += 80;
+    memset(crt + 23 * 80, 0, sizeof(crt[0]) * 2 * 80);
+    if (scrollback.view == 0)
+        cga_set_start(crt - CGAMEM);
+}
 
+// Scroll the screen back to show the n lines before the live
+// screen, or the live screen itself if n is 0.  Later output is
+// held back from the scrolled screen until it returns to live.
+static void
+cga_view(int n)
+{
+    ushort *v = CGAMEM + VIEW;
+    int saved, r;
+
+    saved = scrollback.n < NSCROLLBACK ? scrollback.n : NSCROLLBACK;
+    if (n > saved)
+        n = saved;
+    if (n < 0)
+        n = 0;
+    scrollback.view = n;
+    if (n == 0)
+    {
+        cga_set_start(crt - CGAMEM);
+        return;
+    }
+    for (r = 0; r < 24; r++)
+    {
+        if (r < n)
+            memmove(v + r * 80,
+                    scrollback.buf[(scrollback.n - n + r) % NSCROLLBACK],
+                    sizeof(v[0]) * 80);
+        else
+            memmove(v + r * 80, crt + (r - n) * 80, sizeof(v[0]) * 80);
+    }
+    memset(v + 24 * 80, 0, sizeof(v[0]) * 80);
+    cga_set_start(VIEW);
+}
+
+// Draw c with the cursor at pos, scrolling if need be, and
+// return where the cursor goes next.  The caller moves it there,
+// so a run of characters costs one cursor update.
+static int
+cga_putc(int pos, int c)
+{
     if (c == '\n')
         pos += 80 - pos % 80;
     else if (c == BACKSPACE)
     {
         if (pos > 0)
             --pos;
+        crt[pos] = ' ' | 0x0700;
     }
     else
         crt[pos++] = (c & 0xff) | 0x0700;
@@ -185,14 +287,17 @@ cgaputc(int c)
 
     if ((pos / 80) >= 24)
     {
-        memmove(crt, crt + 80, sizeof(crt[0]) * 23 * 80);
+        cga_scroll();
         pos -= 80;
         memset(crt + pos, 0, sizeof(crt[0]) * (24 * 80 - pos));
     }
+    return pos;
+}
 
-    cga_set_cursor_pos(pos);
-    if (c == BACKSPACE)
-        crt[pos] = ' ' | 0x0700;
+static void
+cgaputc(int c)
+{
+    cga_set_cursor_pos(cga_putc(cga_get_cursor_pos(), c));
 }
 
 void consputc(int c)
@@ -219,14 +324,27 @@ void consputc(int c)
 struct
 {
     char buf[INPUT_BUF];
-    uint r;
-    uint w;
-    uint e;
-    uint c;
+    uint r; // Read index
+    uint w; // Write index: end of the lines handed to readers
+} input;
+
+// The line being edited, kept as a gap buffer: the text before
+// the cursor is line.buf[0..gs) and the text after it is
+// line.buf[ge..INPUT_BUF).  Typing or deleting at the cursor just
+// moves an edge of the gap, and moving the cursor carries only
+// the characters it passes over across the gap.  Offsets in the
+// line (the cursor, the selection, undo positions) count
+// characters of text from its start.
+static struct
+{
+    char buf[INPUT_BUF];
+    int gs;  // gap start: the cursor
+    int ge;  // gap end
+    int scr; // crt position of the line's first character
     int selecting;
     int sel_start;
     int sel_end;
-} input;
+} line;
 
 #define CLIPBOARD_BUF 128
 static struct
@@ -235,11 +353,9 @@ static struct
     uint n;
 } clipboard = {.n = 0};
 
-static const char *commands[] = {
-    "cat", "echo", "find_sum", "forktest", "grep", "init",
-    "kill", "ln", "ls", "mkdir", "rm", "sh",
-    "stressfs", "usertests", "wc", "zombie", "console"};
-static int num_commands = sizeof(commands) / sizeof(commands[0]);
+// Names shown when a second tab finds several completions.
+#define MAX_MATCHES 32
+static char matches[MAX_MATCHES][DIRSIZ + 1];
 
 static struct
 {
@@ -248,47 +364,233 @@ static struct
 
 #define C(x) ((x) - '@')
 
+static int
+line_len(void)
+{
+    return line.gs + (INPUT_BUF - line.ge);
+}
+
+static char
+line_at(int i)
+{
+    if (i < line.gs)
+        return line.buf[i];
+    return line.buf[line.ge + (i - line.gs)];
+}
+
+// How many more characters the line can take: it must fit
+// in input.buf, with its newline, behind the unread lines.
+static int
+line_room(void)
+{
+    return INPUT_BUF - 1 - (int)(input.w - input.r) - line_len();
+}
+
+// Move the cursor to offset pos.
 static void
-reset_tab_state(void)
+line_move(int pos)
 {
-    tab_state.last_key_was_tab = 0;
+    int n;
+
+    if (pos < line.gs)
+    {
+        n = line.gs - pos;
+        memmove(line.buf + line.ge - n, line.buf + pos, n);
+        line.gs -= n;
+        line.ge -= n;
+    }
+    else if (pos > line.gs)
+    {
+        n = pos - line.gs;
+        memmove(line.buf + line.gs, line.buf + line.ge, n);
+        line.gs += n;
+        line.ge += n;
+    }
 }
 
+// Insert as many of the n characters at s as fit, at the
+// cursor.  Returns how many were inserted.
 static int
-find_lcp_len(const char *matches[], int count)
+line_insert(const char *s, int n)
 {
-    if (count <= 0)
+    if (n > line_room())
+        n = line_room();
+    if (n <= 0)
         return 0;
-    if (count == 1)
-        return strlen(matches[0]);
+    memmove(line.buf + line.gs, s, n);
+    line.gs += n;
+    return n;
+}
 
-    int lcp_len = 0;
-    const char *first = matches[0];
+// Delete the n characters at offset pos, leaving the cursor there.
+static void
+line_delete(int pos, int n)
+{
+    line_move(pos);
+    line.ge += n;
+}
 
-    while (1)
+// Show the line from offset from on, after an edit that changed
+// it from oldlen characters, blanking any cells the old text used
+// past the new end, and put the cursor at the gap.  What comes
+// before from is still right on the screen, so the cost is in
+// proportion to the change.  The serial line can only follow
+// edits at the end of the line.
+static void
+line_repaint(int from, int oldlen)
+{
+    int i, len, end;
+
+    len = line_len();
+    end = len > oldlen ? len : oldlen;
+    while (line.scr + end >= 24 * 80 && line.scr >= 80)
     {
-        char c = first[lcp_len];
-        if (c == '\0')
-            break;
+        cga_scroll();
+        line.scr -= 80;
+    }
+    for (i = from; i < len; i++)
+        crt[line.scr + i] = (line_at(i) & 0xff) | 0x0700;
+    for (; i < oldlen; i++)
+        crt[line.scr + i] = ' ' | 0x0700;
+    cga_set_cursor_pos(line.scr + line.gs);
 
-        for (int i = 1; i < count; i++)
+    if (line.gs != len)
+        return;
+    if (from == oldlen)
+        for (i = from; i < len; i++)
+            uartputc(line_at(i));
+    else if (from == len)
+        for (i = len; i < oldlen; i++)
         {
-            if (matches[i][lcp_len] != c)
-            {
-                return lcp_len;
-            }
+            uartputc('\b');
+            uartputc(' ');
+            uartputc('\b');
         }
-        lcp_len++;
+}
+
+// Lines typed earlier, newest last, for KEY_UP and KEY_DN to
+// recall.  history.n counts every line added; the ring holds the
+// last NHISTORY of them, so entry i is at buf[i % NHISTORY].
+// sh saves its commands in HISTFILE, and historyload() reads them
+// back at boot.
+#define NHISTORY 32
+#define HISTFILE "/.history"
+static struct
+{
+    char buf[NHISTORY][INPUT_BUF];
+    int len[NHISTORY];
+    uint n;
+    uint cur;    // entry on the line; n while typing a new one
+    char draft[INPUT_BUF]; // the new line, while an entry is shown
+    int draftlen;
+    int search;  // prefix length for C('R'), -1 if not searching
+} history;
+
+static uint
+history_first(void)
+{
+    return history.n > NHISTORY ? history.n - NHISTORY : 0;
+}
+
+static void
+history_add(const char *s, int n)
+{
+    int e;
+
+    if (n == 0)
+        return;
+    if (history.n > 0)
+    {
+        e = (history.n - 1) % NHISTORY;
+        if (history.len[e] == n && memcmp(history.buf[e], s, n) == 0)
+            return;
     }
-    return lcp_len;
+    e = history.n % NHISTORY;
+    memmove(history.buf[e], s, n);
+    history.len[e] = n;
+    history.n++;
+}
+
+// Hand the line, ended by c, to readers, and start a new one.
+static void
+line_commit(int c)
+{
+    int i, len;
+
+    len = line_len();
+    line_move(len);
+    history_add(line.buf, len);
+    history.cur = history.n;
+    for (i = 0; i < len; i++)
+        input.buf[(input.w + i) % INPUT_BUF] = line_at(i);
+    input.buf[(input.w + len) % INPUT_BUF] = c;
+    input.w += len + 1;
+    line.gs = 0;
+    line.ge = INPUT_BUF;
+    undo.n = 0;
+    undo.ntext = 0;
+    wakeup(&input.r);
 }
 
+// Replace the line with history entry i, or with the line being
+// typed before recall began if i is history.n.
 static void
-print_matches_and_redraw(const char *matches[], int count)
+history_show(uint i)
+{
+    int oldlen = line_len();
+
+    if (history.cur == history.n)
+    {
+        line_move(oldlen);
+        memmove(history.draft, line.buf, oldlen);
+        history.draftlen = oldlen;
+    }
+    line.gs = 0;
+    line.ge = INPUT_BUF;
+    if (i == history.n)
+        line_insert(history.draft, history.draftlen);
+    else
+        line_insert(history.buf[i % NHISTORY], history.len[i % NHISTORY]);
+    history.cur = i;
+    undo.n = 0;
+    undo.ntext = 0;
+    line_repaint(0, oldlen);
+}
+
+// Recall the newest entry older than the one shown that starts
+// with the first history.search characters of the line.
+static void
+history_search(void)
+{
+    char prefix[INPUT_BUF];
+    int n = history.search;
+
+    for (int i = 0; i < n; i++)
+        prefix[i] = line_at(i);
+    for (uint i = history.cur; i-- > history_first();)
+    {
+        int e = i % NHISTORY;
+        if (history.len[e] >= n && memcmp(history.buf[e], prefix, n) == 0)
+        {
+            history_show(i);
+            return;
+        }
+    }
+}
+
+static void
+reset_tab_state(void)
+{
+    tab_state.last_key_was_tab = 0;
+}
+
+static void
+print_matches_and_redraw(int count)
 {
     int original_locking = cons.locking;
     cons.locking = 0;
 
+    cga_set_cursor_pos(line.scr + line_len());
     cprintf("\n");
 
     for (int i = 0; i < count; i++)
@@ -300,103 +602,59 @@ print_matches_and_redraw(const char *matches[], int count)
 
     cprintf("$ ");
 
-    if (input.e != input.w)
-    {
-        int curpos = cga_get_cursor_pos();
-        int move_right = (input.e - input.c);
-        cga_set_cursor_pos(curpos + move_right);
-        input.c = input.e;
-
-        while (input.e != input.w)
-        {
-            input.e--;
-            input.c--;
-            consputc(BACKSPACE);
-        }
-    }
-    cprintf(" ");
-    input.c = input.w;
-    undo.n = 0;
+    line.scr = cga_get_cursor_pos();
+    line_repaint(0, 0);
 
     cons.locking = original_locking;
 }
 
+// Complete the line as a name in the root directory.  The names
+// come from the kernel's trie of them (trie.c), so the first tab
+// extends the line as far as all matches agree, and a second
+// lists them.
 static void
 handle_tab_completion(void)
 {
     char prefix[INPUT_BUF];
-    int len = input.e - input.w;
+    char ext[DIRSIZ + 1];
+    int len = line_len();
 
-    int is_first_word = 1;
-    for (int i = input.w; i < input.e; i++)
+    for (int i = 0; i < len; i++)
     {
-        if (input.buf[i % INPUT_BUF] == ' ')
+        if (line_at(i) == ' ')
         {
-            is_first_word = 0;
-            break;
+            reset_tab_state();
+            return;
         }
+        prefix[i] = line_at(i);
     }
-    if (!is_first_word || len < 0 || len >= INPUT_BUF)
+
+    int match_count = triefind(prefix, len, ext);
+    if (match_count == 0)
     {
         reset_tab_state();
         return;
     }
 
-    memmove(prefix, input.buf + (input.w % INPUT_BUF), len);
-    prefix[len] = '\0';
-
-    const char *matches[sizeof(commands) / sizeof(commands[0])];
-    int match_count = 0;
-    for (int i = 0; i < num_commands; i++)
-    {
-        if (strncmp(prefix, commands[i], len) == 0)
-        {
-            matches[match_count++] = commands[i];
-        }
-    }
-
-    if (match_count == 0)
+    int n = strlen(ext);
+    if (n > 0)
     {
-        reset_tab_state();
-        return;
+        line_move(len);
+        line_insert(ext, n);
+        line_repaint(len, len);
     }
 
     if (match_count == 1)
     {
-        const char *completion = matches[0];
-        int comp_len = strlen(completion);
-
-        for (int i = len; i < comp_len; i++)
-        {
-            if (input.e >= input.r + INPUT_BUF)
-                break;
-            input.buf[input.e++ % INPUT_BUF] = completion[i];
-            consputc(completion[i]);
-        }
-        input.c = input.e;
         reset_tab_state();
-        return;
     }
-
-    if (tab_state.last_key_was_tab)
+    else if (n == 0 && tab_state.last_key_was_tab)
     {
-        print_matches_and_redraw(matches, match_count);
+        print_matches_and_redraw(trielist(prefix, len, matches[0], MAX_MATCHES));
         reset_tab_state();
     }
     else
     {
-        int lcp_len = find_lcp_len(matches, match_count);
-        if (lcp_len > len)
-        {
-            for (int i = len; i < lcp_len; i++)
-            {
-                if (input.e >= input.r + INPUT_BUF)
-                    break;
-                input.buf[input.e++ % INPUT_BUF] = matches[0][i];
-                consputc(matches[0][i]);
-            }
-            input.c = input.e;
-        }
         tab_state.last_key_was_tab = 1;
     }
 }
@@ -407,28 +665,148 @@ is_whitespace(char c)
     return c == ' ' || c == '\t' || c == '\n' || c == '\v';
 }
 
+// Forget the oldest undo record.
+static void
+undo_drop(void)
+{
+    int t;
+
+    t = undo.buf[0].type == OP_DELETE ? undo.buf[0].len : 0;
+    memmove(undo.buf, undo.buf + 1, (undo.n - 1) * sizeof(undo.buf[0]));
+    undo.n--;
+    if (t == 0)
+        return;
+    memmove(undo.text, undo.text + t, undo.ntext - t);
+    undo.ntext -= t;
+    for (uint i = 0; i < undo.n; i++)
+        if (undo.buf[i].type == OP_DELETE)
+            undo.buf[i].text -= t;
+}
+
+static struct op *
+undo_top(int type)
+{
+    if (undo.n == 0 || undo.buf[undo.n - 1].type != type)
+        return 0;
+    return &undo.buf[undo.n - 1];
+}
+
+// Record that n characters were inserted at offset pos.  If
+// coalesce is set and they follow the last insertion, they join
+// its record.
+static void
+undo_insert(int pos, int n, int coalesce)
+{
+    struct op *op;
+
+    if (n <= 0)
+        return;
+    op = undo_top(OP_INSERT);
+    if (coalesce && op && op->pos + op->len == pos)
+    {
+        op->len += n;
+        return;
+    }
+    if (undo.n == UNDO_OPS)
+        undo_drop();
+    op = &undo.buf[undo.n++];
+    op->type = OP_INSERT;
+    op->pos = pos;
+    op->len = n;
+    op->text = 0;
+}
+
+// Record that the n characters at offset pos are about to be
+// deleted, saving them.  If coalesce is set and they end where
+// the last deletion began, as with repeated backspaces, they
+// join its record.
+static void
+undo_delete(int pos, int n, int coalesce)
+{
+    struct op *op;
+
+    if (n <= 0)
+        return;
+    if (n > UNDO_TEXT)
+    {
+        undo.n = 0;
+        undo.ntext = 0;
+        return;
+    }
+    op = undo_top(OP_DELETE);
+    if (coalesce && op && pos + n == op->pos)
+    {
+        // The last record's text is at the end of undo.text.
+        while (undo.ntext + n > UNDO_TEXT && undo.n > 1)
+            undo_drop();
+        op = &undo.buf[undo.n - 1];
+        if (undo.ntext + n <= UNDO_TEXT)
+        {
+            memmove(undo.text + op->text + n, undo.text + op->text, op->len);
+            for (int i = 0; i < n; i++)
+                undo.text[op->text + i] = line_at(pos + i);
+            op->pos = pos;
+            op->len += n;
+            undo.ntext += n;
+            return;
+        }
+    }
+    while (undo.n > 0 && (undo.n == UNDO_OPS || undo.ntext + n > UNDO_TEXT))
+        undo_drop();
+    op = &undo.buf[undo.n++];
+    op->type = OP_DELETE;
+    op->pos = pos;
+    op->len = n;
+    op->text = undo.ntext;
+    for (int i = 0; i < n; i++)
+        undo.text[undo.ntext++] = line_at(pos + i);
+}
+
+// Undo the last recorded edit, whatever its size.
+static void
+undo_last(void)
+{
+    struct op *op;
+    int oldlen;
+
+    if (undo.n == 0)
+        return;
+    op = &undo.buf[--undo.n];
+    oldlen = line_len();
+    if (op->type == OP_INSERT)
+    {
+        if (op->pos + op->len > oldlen)
+            return;
+        line_delete(op->pos, op->len);
+    }
+    else
+    {
+        undo.ntext -= op->len;
+        if (op->pos > oldlen)
+            return;
+        line_move(op->pos);
+        line_insert(undo.text + op->text, op->len);
+    }
+    line_repaint(op->pos, oldlen);
+}
+
 static void
 update_highlight(int start, int end, int on)
 {
     if (start < 0 || end <= start)
         return;
 
-    if (start < (int)input.w)
-        start = input.w;
-    if (end > (int)input.e)
-        end = input.e;
+    if (end > line_len())
+        end = line_len();
     if (start >= end)
         return;
 
-    int cursor_pos = cga_get_cursor_pos();
-    int screen_pos_of_w = cursor_pos - (int)(input.c - input.w);
-
     ushort normal_attr = 0x0700;
     ushort highlight_attr = 0x7000;
 
     for (int i = start; i < end; i++)
     {
-        int screen_pos = screen_pos_of_w + (i - (int)input.w);
+        int screen_pos = line.scr + i;
         if (screen_pos >= 0 && screen_pos < 25 * 80)
         {
             ushort ch = crt[screen_pos] & 0x00ff;
@@ -440,11 +818,11 @@ update_highlight(int start, int end, int on)
 static void
 delete_selection(void)
 {
-    if (input.sel_start == -1 || input.sel_end == -1)
+    if (line.sel_start == -1 || line.sel_end == -1)
         return;
 
-    int s = input.sel_start;
-    int e = input.sel_end;
+    int s = line.sel_start;
+    int e = line.sel_end;
     if (s > e)
     {
         int t = s;
@@ -452,10 +830,10 @@ delete_selection(void)
         e = t;
     }
 
-    if (s < (int)input.w)
-        s = input.w;
-    if (e > (int)input.e)
-        e = input.e;
+    if (s < 0)
+        s = 0;
+    if (e > line_len())
+        e = line_len();
     if (s >= e)
     {
         clear_selection();
@@ -463,40 +841,11 @@ delete_selection(void)
     }
 
     int len = e - s;
-    int old_e = input.e;
-    int old_c = input.c;
+    int oldlen = line_len();
 
-    for (int k = 0; k < len && undo.n < UNDO_BUF; k++)
-    {
-        undo.buf[undo.n].type = OP_DELETE;
-        undo.buf[undo.n].c = input.buf[(s + k) % INPUT_BUF];
-        undo.buf[undo.n].pos = s + k;
-        undo.n++;
-    }
-
-    int hw_cursor = cga_get_cursor_pos();
-    int screen_pos_of_w = hw_cursor - (old_c - (int)input.w);
-
-    if (screen_pos_of_w < 0)
-        screen_pos_of_w = 0;
-    if (screen_pos_of_w >= 25 * 80)
-        screen_pos_of_w = 25 * 80 - 1;
-
-    for (int i = e; i < old_e; i++)
-        input.buf[(i - len) % INPUT_BUF] = input.buf[i % INPUT_BUF];
-
-    input.e -= len;
-    input.c = s;
-
-    cga_set_cursor_pos(screen_pos_of_w);
-    for (int i = input.w; i < input.e; i++)
-        consputc(input.buf[i % INPUT_BUF]);
-
-    int leftover = old_e - input.e;
-    for (int i = 0; i < leftover; i++)
-        consputc(' ');
-
-    cga_set_cursor_pos(screen_pos_of_w + (input.c - input.w));
+    undo_delete(s, len, 0);
+    line_delete(s, len);
+    line_repaint(s, oldlen);
 
     clear_selection();
 }
@@ -504,30 +853,104 @@ delete_selection(void)
 static void
 clear_selection(void)
 {
-    if (input.sel_start != -1)
+    if (line.sel_start != -1)
     {
-        update_highlight(input.sel_start, input.sel_end, 0);
-        input.sel_start = -1;
-        input.sel_end = -1;
+        update_highlight(line.sel_start, line.sel_end, 0);
+        line.sel_start = -1;
+        line.sel_end = -1;
     }
-    input.selecting = 0;
+    line.selecting = 0;
 }
 
 static void deselect_if_any(void)
 {
-    if (input.sel_start != -1 && input.sel_end != -1)
+    if (line.sel_start != -1 && line.sel_end != -1)
     {
         clear_selection();
     }
 }
 
+// Bottom half of console input.  The keyboard and uart interrupt
+// handlers only queue what they read, in rings of their own, and
+// kick consd, which runs the line discipline below on it with
+// interrupts on, so a pasted burst costs the handlers little.
+static struct
+{
+    struct spinlock lock;
+    int pending; // input queued since consd last looked
+} kick;
+
+// Called by the interrupt handlers after queueing input.
+void consolekick(void)
+{
+    acquire(&kick.lock);
+    if (!kick.pending)
+    {
+        kick.pending = 1;
+        wakeup(&kick.pending);
+    }
+    release(&kick.lock);
+}
+
+static void
+consd(void)
+{
+    for (;;)
+    {
+        acquire(&kick.lock);
+        while (!kick.pending)
+            sleep(&kick.pending, &kick.lock);
+        kick.pending = 0;
+        release(&kick.lock);
+        kbdrecv();
+        uartrecv();
+    }
+}
+
+// Start consd.  Called by the first process once it has set up
+// the file system, as initlog() starts logflush, so that consd
+// is not the process that takes forkret()'s one-time setup.
+// Input that arrives before then waits in the rings, with
+// kick.pending set.
+void consolestart(void)
+{
+    kthread("consd", consd);
+}
+
+// Edit the characters getc returns into the input line.
+// Runs in consd, never in an interrupt handler.
 void consoleintr(int (*getc)(void))
 {
-    int c, doprocdump = 0;
+    int c, doprocdump = 0, rawinput = 0;
+    int oldlen;
 
     acquire(&cons.lock);
     while ((c = getc()) >= 0)
     {
+        if (cons.raw)
+        {
+            if (input.w - input.r < INPUT_BUF)
+                input.buf[input.w++ % INPUT_BUF] = c;
+            rawinput = 1;
+            continue;
+        }
+        // Output may have moved the line since the last key.
+        line.scr = cga_get_cursor_pos() - line.gs;
+        oldlen = line_len();
+        if (c == KEY_PGUP)
+        {
+            cga_view(scrollback.view + 12);
+            continue;
+        }
+        if (c == KEY_PGDN)
+        {
+            cga_view(scrollback.view - 12);
+            continue;
+        }
+        if (scrollback.view)
+            cga_view(0);
+        if (c != C('R'))
+            history.search = -1;
         switch (c)
         {
         case '\t':
@@ -535,54 +958,54 @@ void consoleintr(int (*getc)(void))
             handle_tab_completion();
             break;
         case C('S'):
-            if (input.selecting == 0)
+            if (line.selecting == 0)
             {
                 clear_selection();
-                input.selecting = 1;
-                input.sel_start = input.c;
-                input.sel_end = -1;
+                line.selecting = 1;
+                line.sel_start = line.gs;
+                line.sel_end = -1;
             }
             else
             {
-                input.selecting = 0;
-                input.sel_end = input.c;
+                line.selecting = 0;
+                line.sel_end = line.gs;
 
-                if (input.sel_start > input.sel_end)
+                if (line.sel_start > line.sel_end)
                 {
-                    int tmp = input.sel_start;
-                    input.sel_start = input.sel_end;
-                    input.sel_end = tmp;
+                    int tmp = line.sel_start;
+                    line.sel_start = line.sel_end;
+                    line.sel_end = tmp;
                 }
-                if (input.sel_start == input.sel_end)
+                if (line.sel_start == line.sel_end)
                 {
-                    input.sel_start = -1;
-                    input.sel_end = -1;
+                    line.sel_start = -1;
+                    line.sel_end = -1;
                 }
                 else
                 {
-                    update_highlight(input.sel_start, input.sel_end, 1);
+                    update_highlight(line.sel_start, line.sel_end, 1);
                 }
             }
             break;
         case C('C'):
-            if (input.sel_start != -1 && input.sel_end != -1)
+            if (line.sel_start != -1 && line.sel_end != -1)
             {
-                int s = input.sel_start, e = input.sel_end;
+                int s = line.sel_start, e = line.sel_end;
                 if (s > e)
                 {
                     int t = s;
                     s = e;
                     e = t;
                 }
-                if (s < (int)input.w)
-                    s = input.w;
-                if (e > (int)input.e)
-                    e = input.e;
+                if (s < 0)
+                    s = 0;
+                if (e > line_len())
+                    e = line_len();
                 int len = e - s;
                 if (len > CLIPBOARD_BUF)
                     len = CLIPBOARD_BUF;
                 for (int i = 0; i < len; i++)
-                    clipboard.buf[i] = input.buf[(s + i) % INPUT_BUF];
+                    clipboard.buf[i] = line_at(s + i);
                 clipboard.n = len;
             }
             else
@@ -595,35 +1018,15 @@ void consoleintr(int (*getc)(void))
         case C('V'):
             if (clipboard.n > 0)
             {
-                if (input.sel_start != -1 && input.sel_end != -1)
+                if (line.sel_start != -1 && line.sel_end != -1)
                 {
                     delete_selection();
                 }
-                for (uint i = 0; i < clipboard.n; i++)
-                {
-                    int ch = clipboard.buf[i];
-
-                    if (input.e < input.r + INPUT_BUF)
-                    {
-                        if (undo.n < UNDO_BUF)
-                        {
-                            undo.buf[undo.n].type = OP_INSERT;
-                            undo.buf[undo.n].pos = input.c;
-                            undo.buf[undo.n].c = ch;
-                            undo.n++;
-                        }
-
-                        for (int j = input.e; j > input.c; j--)
-                            input.buf[j % INPUT_BUF] = input.buf[(j - 1) % INPUT_BUF];
-                        input.buf[input.c % INPUT_BUF] = ch;
-                        input.e++;
-                        input.c++;
-
-                        for (int j = input.c - 1; j < input.e; j++)
-                            consputc(input.buf[j % INPUT_BUF]);
-                        cga_set_cursor_pos(cga_get_cursor_pos() - (input.e - input.c));
-                    }
-                }
+                int from = line.gs;
+                oldlen = line_len();
+                int n = line_insert(clipboard.buf, clipboard.n);
+                undo_insert(from, n, 0);
+                line_repaint(from, oldlen);
             }
 
             deselect_if_any();
@@ -632,40 +1035,35 @@ void consoleintr(int (*getc)(void))
 
         case C('A'):
             deselect_if_any();
-            if (input.c > input.w)
+            if (line.gs > 0)
             {
-                int old_c = input.c;
-                int temp_c = input.c;
+                int temp_c = line.gs;
                 temp_c--;
-                while (temp_c > input.w && is_whitespace(input.buf[temp_c % INPUT_BUF]))
+                while (temp_c > 0 && is_whitespace(line_at(temp_c)))
                     temp_c--;
-                while (temp_c > input.w && !is_whitespace(input.buf[(temp_c - 1) % INPUT_BUF]))
+                while (temp_c > 0 && !is_whitespace(line_at(temp_c - 1)))
                     temp_c--;
-                input.c = temp_c;
-                cga_set_cursor_pos(cga_get_cursor_pos() - (old_c - input.c));
+                line_move(temp_c);
+                cga_set_cursor_pos(line.scr + line.gs);
             }
             break;
         case C('D'):
             deselect_if_any();
-            if (input.e == input.w)
+            if (oldlen == 0)
             {
-                input.buf[input.e++ % INPUT_BUF] = C('D');
-                input.w = input.e;
-                input.c = input.w;
-                wakeup(&input.r);
+                line_commit(C('D'));
             }
-            else if (input.c < input.e)
+            else if (line.gs < oldlen)
             {
-                int old_c = input.c;
-                int temp_c = input.c;
-                while (temp_c < input.e && !is_whitespace(input.buf[temp_c % INPUT_BUF]))
+                int temp_c = line.gs;
+                while (temp_c < oldlen && !is_whitespace(line_at(temp_c)))
                     temp_c++;
-                while (temp_c < input.e && is_whitespace(input.buf[temp_c % INPUT_BUF]))
+                while (temp_c < oldlen && is_whitespace(line_at(temp_c)))
                     temp_c++;
-                if (temp_c < input.e)
+                if (temp_c < oldlen)
                 {
-                    cga_set_cursor_pos(cga_get_cursor_pos() + (temp_c - old_c));
-                    input.c = temp_c;
+                    line_move(temp_c);
+                    cga_set_cursor_pos(line.scr + line.gs);
                 }
             }
             break;
@@ -675,105 +1073,65 @@ void consoleintr(int (*getc)(void))
             break;
         case C('U'):
             deselect_if_any();
-            if (input.e != input.w)
-            {
-                int curpos = cga_get_cursor_pos();
-                int move_right = (input.e - input.c);
-                cga_set_cursor_pos(curpos + move_right);
-                input.c = input.e;
-
-                while (input.e != input.w)
-                {
-                    input.e--;
-                    input.c--;
-                    consputc(BACKSPACE);
-                }
-
-                input.c = input.w;
-                undo.n = 0;
-            }
-            input.c = input.w;
+            line.gs = 0;
+            line.ge = INPUT_BUF;
+            line_repaint(0, oldlen);
             undo.n = 0;
+            undo.ntext = 0;
             break;
         case C('H'):
         case '\x7f':
-            if (input.sel_start != -1 && input.sel_end != -1)
+            if (line.sel_start != -1 && line.sel_end != -1)
             {
                 delete_selection();
                 break;
             }
 
-            if (input.c > input.w)
+            if (line.gs > 0)
             {
-                if (undo.n < UNDO_BUF)
-                {
-                    undo.buf[undo.n].type = OP_DELETE;
-                    undo.buf[undo.n].c = input.buf[(input.c - 1) % INPUT_BUF];
-                    undo.buf[undo.n].pos = input.c - 1;
-                    undo.n++;
-                }
-
-                int cursor_pos = cga_get_cursor_pos();
-                int line_start_pos = cursor_pos - (int)(input.c - input.w);
-
-                for (int i = input.c; i < (int)input.e; i++)
-                    input.buf[(i - 1) % INPUT_BUF] = input.buf[i % INPUT_BUF];
-
-                input.c--;
-                input.e--;
-
-                cga_set_cursor_pos(line_start_pos);
-                for (int i = input.w; i < (int)input.e; i++)
-                    consputc(input.buf[i % INPUT_BUF]);
-
-                consputc(' ');
-
-                cga_set_cursor_pos(line_start_pos + (input.c - input.w));
+                undo_delete(line.gs - 1, 1, 1);
+                line_delete(line.gs - 1, 1);
+                line_repaint(line.gs, oldlen);
             }
             break;
         case C('Z'):
             deselect_if_any();
-            if (undo.n > 0)
-            {
-                struct op last = undo.buf[--undo.n];
-                int pos = last.pos;
+            undo_last();
+            break;
 
-                if (last.type == OP_INSERT)
-                {
-                    if (pos < input.w || pos >= input.e)
-                        break;
-
-                    for (int i = pos + 1; i < input.e; i++)
-                        input.buf[(i - 1) % INPUT_BUF] = input.buf[i % INPUT_BUF];
-                    input.e--;
-
-                    int cursor_before = cga_get_cursor_pos();
-                    int delta = input.c - pos;
-                    cga_set_cursor_pos(cursor_before - delta);
-                    for (int i = pos; i < input.e; i++)
-                        consputc(input.buf[i % INPUT_BUF]);
-                    consputc(' ');
-                    cga_set_cursor_pos(cga_get_cursor_pos() - (input.e - pos + 1));
-
-                    input.c = pos;
-                }
-            }
+        case KEY_UP:
+            deselect_if_any();
+            if (history.cur > history_first())
+                history_show(history.cur - 1);
+            break;
+        case KEY_DN:
+            deselect_if_any();
+            if (history.cur < history.n)
+                history_show(history.cur + 1);
+            break;
+        case C('R'):
+            // Search back through history for lines that start
+            // with what is before the cursor; again to go further.
+            deselect_if_any();
+            if (history.search < 0)
+                history.search = line.gs;
+            history_search();
             break;
 
         case KEY_LF:
             deselect_if_any();
-            if (input.c > input.w)
+            if (line.gs > 0)
             {
-                input.c--;
-                cga_set_cursor_pos(cga_get_cursor_pos() - 1);
+                line_move(line.gs - 1);
+                cga_set_cursor_pos(line.scr + line.gs);
             }
             break;
         case KEY_RT:
             deselect_if_any();
-            if (input.c < input.e)
+            if (line.gs < oldlen)
             {
-                input.c++;
-                cga_set_cursor_pos(cga_get_cursor_pos() + 1);
+                line_move(line.gs + 1);
+                cga_set_cursor_pos(line.scr + line.gs);
             }
             break;
         default:
@@ -782,56 +1140,72 @@ void consoleintr(int (*getc)(void))
                 if (c == '\r')
                     c = '\n';
 
-                if (input.sel_start != -1 && input.sel_end != -1)
+                if (line.sel_start != -1 && line.sel_end != -1)
                 {
                     delete_selection();
                 }
 
-                if (c == '\n' || input.e == input.r + INPUT_BUF)
+                if (c == '\n' || line_room() <= 0)
                 {
                     if (c == '\n')
-                        cgaputc('\n');
-                    input.buf[input.e++ % INPUT_BUF] = '\n';
-                    input.w = input.e;
-                    input.c = input.w;
-                    undo.n = 0;
-                    wakeup(&input.r);
+                    {
+                        cga_set_cursor_pos(line.scr + line_len());
+                        consputc('\n');
+                    }
+                    line_commit('\n');
                 }
                 else
                 {
-                    if (input.e < input.r + INPUT_BUF)
-                    {
-                        if (undo.n < UNDO_BUF)
-                        {
-                            undo.buf[undo.n].type = OP_INSERT;
-                            undo.buf[undo.n].pos = input.c;
-                            undo.buf[undo.n].c = c;
-                            undo.n++;
-                        }
-
-                        for (int i = input.e; i > (int)input.c; i--)
-                            input.buf[i % INPUT_BUF] = input.buf[(i - 1) % INPUT_BUF];
-
-                        input.buf[input.c % INPUT_BUF] = c;
-                        input.e++;
-                        input.c++;
-
-                        for (int i = input.c - 1; i < (int)input.e; i++)
-                            consputc(input.buf[i % INPUT_BUF]);
-
-                        cga_set_cursor_pos(cga_get_cursor_pos() - (input.e - input.c));
-                    }
+                    char ch = c;
+                    int from = line.gs;
+                    oldlen = line_len();
+
+                    // A word and the blanks before it undo together.
+                    if (line_insert(&ch, 1))
+                        undo_insert(from, 1, !is_whitespace(ch) ||
+                                    (from > 0 && is_whitespace(line_at(from - 1))));
+                    line_repaint(from, oldlen);
                 }
                 clear_selection();
             }
             break;
         }
     }
+    if (rawinput)
+        wakeup(&input.r);
     release(&cons.lock);
     if (doprocdump)
     {
         procdump();
+        kallocdump();
+        kmdump();
+        lockdump();
+        idedump();
+    }
+}
+
+// In raw mode, wait for input and take all that has come, up to
+// n bytes, in at most two copies out of the ring.  Caller must
+// hold cons.lock.
+static int
+rawread(char *dst, int n)
+{
+    uint i, m;
+
+    while (input.r == input.w)
+    {
+        if (myproc()->killed)
+            return -1;
+        sleep(&input.r, &cons.lock);
     }
+    if (n > input.w - input.r)
+        n = input.w - input.r;
+    i = input.r % INPUT_BUF;
+    m = INPUT_BUF - i < n ? INPUT_BUF - i : n;
+    memmove(dst, input.buf + i, m);
+    memmove(dst + m, input.buf, n - m);
+    input.r += n;
+    return n;
 }
 
 int consoleread(struct inode *ip, char *dst, int n)
@@ -842,6 +1216,13 @@ int consoleread(struct inode *ip, char *dst, int n)
     iunlock(ip);
     target = n;
     acquire(&cons.lock);
+    if (cons.raw)
+    {
+        n = rawread(dst, n);
+        release(&cons.lock);
+        ilock(ip);
+        return n;
+    }
     while (n > 0)
     {
         while (input.r == input.w)
@@ -874,31 +1255,97 @@ int consoleread(struct inode *ip, char *dst, int n)
     return target - n;
 }
 
+// Write the whole buffer under one acquisition of the lock,
+// queueing it for the serial port in one go and moving the
+// cursor once at the end.
 int consolewrite(struct inode *ip, char *buf, int n)
 {
-    int i;
+    int i, pos;
 
     iunlock(ip);
     acquire(&cons.lock);
+    if (panicked)
+    {
+        cli();
+        for (;;)
+            ;
+    }
+    uartwrite(buf, n);
+    pos = cga_get_cursor_pos();
     for (i = 0; i < n; i++)
-        consputc(buf[i] & 0xff);
+        pos = cga_putc(pos, buf[i] & 0xff);
+    cga_set_cursor_pos(pos);
     release(&cons.lock);
     ilock(ip);
 
     return n;
 }
 
+// Load the commands sh saved in HISTFILE into the history.
+// Called once at boot, in the first process, since it reads the
+// disk.
+void historyload(void)
+{
+    static char buf[BSIZE], s[INPUT_BUF];
+    struct inode *ip;
+    uint off;
+    int i, n, len;
+
+    begin_op();
+    if ((ip = namei(HISTFILE)) == 0)
+    {
+        end_op();
+        return;
+    }
+    ilock(ip);
+    len = 0;
+    for (off = 0; (n = readi(ip, buf, off, sizeof(buf))) > 0; off += n)
+    {
+        acquire(&cons.lock);
+        for (i = 0; i < n; i++)
+        {
+            if (buf[i] == '\n')
+            {
+                history_add(s, len);
+                len = 0;
+            }
+            else if (len < INPUT_BUF - 1)
+                s[len++] = buf[i];
+        }
+        history.cur = history.n;
+        release(&cons.lock);
+    }
+    iunlockput(ip);
+    end_op();
+}
+
+int consoleioctl(struct inode *ip, int req, int arg)
+{
+    if (req != CONSRAW)
+        return -1;
+    acquire(&cons.lock);
+    cons.raw = arg != 0;
+    release(&cons.lock);
+    return 0;
+}
+
 void consoleinit(void)
 {
     initlock(&cons.lock, "console");
+    initlock(&kick.lock, "conskick");
 
     devsw[CONSOLE].write = consolewrite;
     devsw[CONSOLE].read = consoleread;
+    devsw[CONSOLE].ioctl = consoleioctl;
     cons.locking = 1;
 
-    input.r = input.w = input.e = input.c = 0;
+    input.r = input.w = 0;
+    line.gs = 0;
+    line.ge = INPUT_BUF;
+    line.sel_start = line.sel_end = -1;
     undo.n = 0;
+    history.search = -1;
     reset_tab_state();
 
-    ioapicenable(IRQ_KBD, 0);
+    ioapicenable(IRQ_KBD, 1);
 }
\ No newline at end of file
@@ -1,29 +1,45 @@
 struct buf;
 struct context;
+struct dirstat;
 struct file;
 struct inode;
+struct kmcache;
+struct lockstat;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct shm;
+struct spawnact;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct sysstat;
+struct procstat;
+struct trapframe;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bclear(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
+void            bstat(struct sysstat*);
 
 // console.c
 void            consoleinit(void);
 void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
+void            consolekick(void);
+void            consolestart(void);
+void            historyload(void);
 void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             loadimage(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -31,21 +47,31 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filepread(struct file*, char*, int n, uint off);
+int             filepwrite(struct file*, char*, int n, uint off);
 int             filestat(struct file*, struct stat*);
+int             fileioctl(struct file*, int, int);
+int             filegetdents(struct file*, char*, int n);
 int             filewrite(struct file*, char*, int n);
+int             filesplice(struct file*, struct file*, int n);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
+void            dcremove(struct inode*, char*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+int             dirread(struct inode*, uint*, struct dirstat*, int);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            istat(struct sysstat*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+int             ismount(struct inode*);
+int             mount(struct inode*, uint);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -53,31 +79,53 @@ int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+
 // ide.c
 void            ideinit(void);
-void            ideintr(void);
+void            ideintr(int);
+int             idepresent(int);
 void            iderw(struct buf*);
+void            iderwv(struct buf**, int);
+void            idedump(void);
 
 // ioapic.c
-void            ioapicenable(int irq, int cpu);
+int             ioapicenable(int irq, uint mask);
 extern uchar    ioapicid;
 void            ioapicinit(void);
+void            intrinit(void);
 
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+void            kincref(char*);
+int             krefcnt(char*);
+void            kallocstat(struct sysstat*);
+int             kreserve(int);
+void            kunreserve(int);
+int             kfreepages(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kallocdump(void);
 
 // kbd.c
 void            kbdintr(void);
+void            kbdrecv(void);
 
 // lapic.c
 void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
+extern uint     tsckhz;
+extern uint64   tsc0;
+extern uint     nspercycle;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicidle(void);
+void            lapicbusy(void);
+void            lapicwake(uchar);
+uint64          nanotime(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -86,6 +134,24 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+int             begin_opmax(int);
+void            end_opmax(int);
+void            logstat(struct sysstat*);
+
+// mmap.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint);
+void            pcwrite(struct inode*, uint, char*, uint);
+void            pcpurge(struct inode*);
+int             mmap(struct file*, uint, int, int, uint);
+int             munmap(uint, uint);
+int             mmapfault(struct proc*, uint, int);
+int             mmapcovers(struct proc*, uint, uint, int);
+int             mmapoverlaps(struct proc*, uint, uint);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapclose(struct proc*);
+int             mmapshm(struct shm*);
+int             munmapshm(uint);
 
 // mp.c
 extern int      ismp;
@@ -96,49 +162,85 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipewbegin(struct pipe*, char**);
+void            pipewend(struct pipe*, int);
+int             piperbegin(struct pipe*, char**, int);
+void            piperend(struct pipe*, int);
 
 //PAGEBREAK: 16
 // proc.c
+int             clone(uint, uint, char*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             join(char**);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+int             procstat(struct procstat*, int);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
+void            schedboost(void);
+void            schedtick(void);
 void            setproc(struct proc*);
+int             spawn(char*, char**, struct spawnact*, int);
+int             setaffinity(uint);
+char*           swapvictim(struct proc*, uint);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
+int             waitpid(int, int);
 void            wakeup(void*);
 void            yield(void);
 
+// profile.c
+void            profinit(void);
+void            profsample(struct trapframe*);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
 // spinlock.c
 void            acquire(struct spinlock*);
+struct lockstat* findstat(char*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockdump(void);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// shm.c
+void            shminit(void);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// slab.c
+void            kminit(void);
+struct kmcache* kmcreate(char*, uint);
+void*           kmalloc(struct kmcache*);
+void            kmfree(struct kmcache*, void*);
+void            kmdump(void);
+
+// stats.c
+void            statsinit(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -148,9 +250,23 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapinit(void);
+int             swapout(struct proc*);
+int             swapin(uint*, uint);
+char*           swapkalloc(void);
+void            swapdup(uint);
+void            swapput(uint);
+int             swapfree(void);
+
+// sysfile.c
+struct file*    fileopen(char*, int);
+
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
+int             checkuser(uint, int, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -159,16 +275,48 @@ void            syscall(void);
 // timer.c
 void            timerinit(void);
 
+// tmpfs.c
+void            tmpinit(void);
+uint            tmpialloc(short);
+void            tmpiload(struct inode*);
+void            tmpiupdate(struct inode*);
+int             tmpread(struct inode*, char*, uint, uint);
+void            tmpstat(uint, short*, uint*);
+void            tmptrunc(struct inode*);
+int             tmpwrite(struct inode*, char*, uint, uint);
+
+// trace.c
+void            traceinit(void);
+void            tracesyscall(struct proc*, int, int*, int, uint64, uint);
+
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+int             tsleep(int);
 void            tvinit(void);
 extern struct spinlock tickslock;
 
+// trie.c
+void            trieinit(void);
+void            trieload(void);
+void            trieadd(char*);
+void            triedel(char*);
+int             triefind(char*, int, char*);
+int             trielist(char*, int, char*, int);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
+void            uartpanic(void);
 void            uartputc(int);
+void            uartrecv(void);
+void            uartwrite(char*, int);
+
+// uinfo.c
+void            uinfoinit(void);
+int             uinfomap(pde_t*, int);
+void            uinfoshare(pde_t*);
+void            uinfotick(void);
 
 // vm.c
 void            seginit(void);
@@ -181,10 +329,21 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+int             copyuvmrange(pde_t*, pde_t*, uint, uint);
+int             shareuvm(pde_t*, uint);
+int             uvmmap(pde_t*, uint, char*, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+void            releaseuvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             cowfault(pde_t*, uint);
+int             lazyuvm(pde_t*, uint, uint);
+int             pagein(struct proc*, uint, int);
+int             textoverlaps(struct proc*, uint, uint);
+int             wantpage(pde_t*, uint, int);
+char*           clockuvm(pde_t*, uint*, uint, uint);
+int             prefault(uint, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,18 +6,28 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
+// Load the program at path, with arguments argv, into a new
+// page table and make it process p's memory, with p->tf set
+// to start the program.  p is the current process, whose old
+// memory the caller frees, or a new one made by spawn().
+// The strings of argv may lie in the current process's memory.
 int
-exec(char *path, char **argv)
+loadimage(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  struct seg seg[NSEG];
+  int nseg;
+  pde_t *pgdir;
 
   begin_op();
 
@@ -28,6 +38,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +49,10 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map the program; pagein() reads each page from ip when it
+  // is first touched.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,15 +62,25 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(nseg == NSEG)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if((sz = lazyuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
+    if(ph.vaddr % PGSIZE != 0)
+      goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].text = !(ph.flags & ELF_PROG_FLAG_WRITE) &&
+      ph.off % PGSIZE == 0 && ph.memsz == ph.filesz;
+    nseg++;
   }
-  iunlockput(ip);
+  // Keep the reference to ip for pagein().
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   // Allocate two pages at the next page boundary.
@@ -67,6 +90,8 @@ exec(char *path, char **argv)
     goto bad;
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
+  if(uinfomap(pgdir, p->pid) < 0)
+    goto bad;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
@@ -91,16 +116,17 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  p->pgdir = pgdir;
+  p->exe = exe;
+  p->nseg = nseg;
+  for(i = 0; i < nseg; i++)
+    p->seg[i] = seg[i];
+  p->sz = sz;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
   return 0;
 
  bad:
@@ -110,5 +136,32 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
+
+int
+exec(char *path, char **argv)
+{
+  struct proc *curproc = myproc();
+  struct inode *oldexe;
+  pde_t *oldpgdir;
+
+  oldpgdir = curproc->pgdir;
+  oldexe = curproc->exe;
+  if(loadimage(curproc, path, argv) < 0)
+    return -1;
+  switchuvm(curproc);
+  freevm(oldpgdir);
+  mmapclose(curproc);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
+  return 0;
+}
@@ -5,21 +5,25 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
 
 struct devsw devsw[NDEV];
+// Files come from a slab cache; ftable.lock protects their
+// reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmcache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmcreate("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +32,10 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmalloc(ftable.cache)) == 0)
+    return 0;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -66,9 +64,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmfree(ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -92,6 +89,61 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Pass request req, with argument arg, to f's device.
+int
+fileioctl(struct file *f, int req, int arg)
+{
+  struct inode *ip;
+  int r;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ip = f->ip;
+  ilock(ip);
+  if(ip->type != T_DEV || ip->major < 0 || ip->major >= NDEV ||
+     !devsw[ip->major].ioctl){
+    iunlock(ip);
+    return -1;
+  }
+  r = devsw[ip->major].ioctl(ip, req, arg);
+  iunlock(ip);
+  return r;
+}
+
+// Read the entries of directory f into addr, a buffer of
+// n bytes, as struct dirstats.  Returns the number of bytes
+// filled, 0 at the end of the directory.
+int
+filegetdents(struct file *f, char *addr, int n)
+{
+  int r;
+
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  ilock(f->ip);
+  r = dirread(f->ip, &f->off, (struct dirstat*)addr,
+              n / sizeof(struct dirstat));
+  iunlock(f->ip);
+  if(r < 0)
+    return -1;
+  return r * sizeof(struct dirstat);
+}
+
+// Read from file f at offset off, without using or
+// changing f->off.  Only inodes have offsets.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  r = readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -112,46 +164,151 @@ fileread(struct file *f, char *addr, int n)
   panic("fileread");
 }
 
+// An upper bound on the log blocks that writing nb data
+// blocks can use: the data, the indirect blocks, the
+// double-indirect block and its indirect blocks, the
+// bitmap blocks and the i-node.
+#define WRITEBLOCKS(nb) \
+  ((nb) + 2*((nb)/NINDIRECT + 2) + (nb)/BPB + 2 + 1)
+
+// Begin a transaction for writing up to n bytes.
+// Reserves as much log space as begin_opmax() can give,
+// sets *nres to the reservation for end_opmax(), and
+// returns how many of the bytes fit in it.  The offset
+// may move before the write locks the inode, so allow for
+// the bytes spanning one more block than they fill.
+// This really belongs lower down, since writei()
+// might be writing a device like the console.
+static int
+beginwrite(int n, int *nres)
+{
+  int nb;
+
+  nb = (n + BSIZE-1) / BSIZE + 1;
+  *nres = begin_opmax(WRITEBLOCKS(nb));
+  while(WRITEBLOCKS(nb) > *nres)
+    nb--;
+  if(n > (nb-1)*BSIZE)
+    n = (nb-1)*BSIZE;
+  return n;
+}
+
+// Write n bytes to inode ip at *off, advancing *off,
+// in as few transactions as the log allows.  The tmpfs
+// needs no log, so it is written in one go.
+static int
+inodewrite(struct inode *ip, char *addr, int n, uint *off)
+{
+  int r, nres;
+  int i = 0;
+
+  if(ip->dev == TMPDEV){
+    ilock(ip);
+    if((r = writei(ip, addr, *off, n)) > 0)
+      *off += r;
+    iunlock(ip);
+    return r;
+  }
+
+  while(i < n){
+    int n1 = beginwrite(n - i, &nres);
+
+    ilock(ip);
+    if ((r = writei(ip, addr + i, *off, n1)) > 0)
+      *off += r;
+    iunlock(ip);
+    end_opmax(nres);
+
+    if(r < 0)
+      break;
+    if(r != n1)
+      panic("short filewrite");
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 //PAGEBREAK!
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+  if(f->type == FD_INODE)
+    return inodewrite(f->ip, addr, n, &f->off);
+  panic("filewrite");
+}
+
+// Write to file f at offset off, without using or
+// changing f->off.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return inodewrite(f->ip, addr, n, &off);
+}
+
+//PAGEBREAK!
+// Move up to n bytes from in to out without a trip through
+// user space.  One of them must be a pipe and the other an
+// inode; data moves between the inode (the buffer cache)
+// and the pipe ring in a single copy.
+// Like read, return the number of bytes moved, 0 at end of
+// file, or -1 on error.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *buf;
+  int m, r, tot, nres;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
 
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    for(tot = 0; tot < n; tot += r){
+      if((m = pipewbegin(out->pipe, &buf)) < 0)
+        break;
+      if(m > n - tot)
+        m = n - tot;
+      ilock(in->ip);
+      if((r = readi(in->ip, buf, in->off, m)) > 0)
+        in->off += r;
+      iunlock(in->ip);
+      pipewend(out->pipe, r > 0 ? r : 0);
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+      if(r < m){
+        // end of file, or a device with no more for now
+        tot += r;
+        return tot;
+      }
     }
-    return i == n ? n : -1;
+    return tot > 0 || n == 0 ? tot : -1;
+  }
+
+  if(in->type == FD_PIPE && out->type == FD_INODE){
+    for(tot = 0; tot < n; tot += r){
+      // Block only until there is something to move.
+      if((m = piperbegin(in->pipe, &buf, tot == 0)) <= 0)
+        return tot > 0 ? tot : m;
+      if(m > n - tot)
+        m = n - tot;
+      m = beginwrite(m, &nres);
+      ilock(out->ip);
+      if((r = writei(out->ip, buf, out->off, m)) > 0)
+        out->off += r;
+      iunlock(out->ip);
+      end_opmax(nres);
+      piperend(in->pipe, r > 0 ? r : 0);
+      if(r != m)
+        return tot > 0 ? tot : -1;
+    }
+    return tot;
   }
-  panic("filewrite");
-}
 
+  return -1;
+}
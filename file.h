@@ -14,15 +14,22 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int npages;         // pages in the mmap page cache; pcache.lock
+  struct inode *next; // icache hash chain; icache.lock
+  struct inode *lrunext; // icache LRU of unused entries; icache.lock
+  struct inode *lruprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ralast;        // last block read, for read-ahead
+  uint raend;         // first block not yet read ahead
+  uint lastblock;     // block balloc() last gave this inode
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // table mapping major device number to
@@ -30,8 +37,13 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*ioctl)(struct inode*, int, int);
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define PROF    2
+#define INTR    3
+#define SWAP    4
+#define STATS   5
@@ -2,83 +2,420 @@
 #include "stat.h"
 #include "user.h"
 #include "fcntl.h"
+#include "mman.h"
+#include "param.h"
 
-int is_digit(char c) {
-    return c >= '0' && c <= '9';
+#define BUFSZ   (32 * 1024) // bytes per read()
+#define MAXJOBS 8
+#define PGSIZE  4096
+#define BASE    1000000000  // a limb holds 9 decimal digits
+
+char buf[BUFSZ];
+
+static uint pow10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000};
+
+// Numbers of any length, in base BASE.
+struct big {
+    uint *d;
+    int n;
+    int cap;
+};
+
+void big_push(struct big *b, uint v) {
+    if (b->n == b->cap) {
+        int cap = b->cap ? 2 * b->cap : 8;
+        uint *d = malloc(cap * sizeof(d[0]));
+        if (d == 0) {
+            printf(2, "find_sum: out of memory\n");
+            exit();
+        }
+        if (b->d) {
+            memmove(d, b->d, b->n * sizeof(d[0]));
+            free(b->d);
+        }
+        b->d = d;
+        b->cap = cap;
+    }
+    b->d[b->n++] = v;
+}
+
+// Add limb v to b, at limb i.
+void big_add_at(struct big *b, int i, uint v) {
+    uint t;
+
+    while (v) {
+        while (b->n <= i)
+            big_push(b, 0);
+        t = b->d[i] + v;
+        v = t >= BASE;
+        b->d[i++] = t - (v ? BASE : 0);
+    }
 }
 
-void reverse(char *str, int length) {
-    int start = 0;
-    int end = length - 1;
-    while (start < end) {
-        char temp = str[start];
-        str[start] = str[end];
-        str[end] = temp;
-        start++;
-        end--;
+// Add the n limbs at d, least significant first, to b.
+void big_add(struct big *b, uint *d, int n) {
+    uint carry = 0, t;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (i == b->n)
+            big_push(b, 0);
+        t = b->d[i] + d[i] + carry;
+        carry = t >= BASE;
+        b->d[i] = t - (carry ? BASE : 0);
     }
+    big_add_at(b, n, carry);
 }
 
-int itoa(long long num, char *str) {
-    int i = 0;
-    if (num == 0) {
-        str[i++] = '0';
-        str[i] = '\0';
-        return i;
+// Running state of a scan, so that a number may be split
+// across the buffers it is read in.  The number being read is
+// kept as its 9-digit chunks so far, in num, most significant
+// first, and the ncur digits since, in cur.
+struct scan {
+    struct big sum;
+    struct big num;
+    uint cur;
+    int ncur;
+    int indigit;
+};
+
+// Add the number just read to the sum.  Chunk c of num is worth
+// c * 10^ncur, which is split as a*BASE + b*10^ncur to keep the
+// arithmetic in 32 bits.
+void add_number(struct scan *s) {
+    uint p = pow10[s->ncur], q = pow10[9 - s->ncur];
+    uint low = s->cur, c, limb, carry = 0, t;
+    int k, n = s->num.n;
+
+    if (n == 0) {
+        big_add_at(&s->sum, 0, s->cur);
+        goto out;
     }
-    
-    while (num != 0) {
-        int rem = num % 10;
-        str[i++] = rem + '0';
-        num = num / 10;
+    for (k = 0; k <= n; k++) {
+        if (k < n) {
+            c = s->num.d[n - 1 - k];
+            limb = c % q * p + low;
+            low = c / q;
+        } else
+            limb = low;
+        if (k == s->sum.n)
+            big_push(&s->sum, 0);
+        t = s->sum.d[k] + limb + carry;
+        carry = t >= BASE;
+        s->sum.d[k] = t - (carry ? BASE : 0);
     }
-    
-    reverse(str, i);
-    str[i] = '\0';
-    return i;
+    big_add_at(&s->sum, n + 1, carry);
+out:
+    s->num.n = 0;
+    s->cur = 0;
+    s->ncur = 0;
 }
 
+// Skip to each run of digits a word at a time, then take the
+// digits of the run in.
+void scan(struct scan *s, char *p, int n) {
+    char *e = p + n, *q;
 
-int main(int argc, char *argv[]) {
-    if (argc <= 1) {
-        printf(2, "Usage: find_sum <string1> [string2] ...\n");
-        exit();
+    while (p < e) {
+        if (!s->indigit) {
+            p += spannondigit(p, e - p);
+            if (p == e)
+                break;
+            s->indigit = 1;
+        }
+        for (q = p + spandigit(p, e - p); p < q; p++) {
+            s->cur = s->cur * 10 + (*p - '0');
+            if (++s->ncur == 9) {
+                big_push(&s->num, s->cur);
+                s->cur = 0;
+                s->ncur = 0;
+            }
+        }
+        if (p < e) {
+            add_number(s);
+            s->indigit = 0;
+        }
+    }
+}
+
+void scan_end(struct scan *s) {
+    if (s->indigit)
+        add_number(s);
+    s->indigit = 0;
+}
+
+// Format b in decimal at out, with room for 9 digits a limb,
+// and return the length.  Digits are written in place, most
+// significant first.
+int big_dec(struct big *b, char *out) {
+    int i, k, w, n = b->n, len = 0;
+    uint v;
+
+    while (n > 1 && b->d[n - 1] == 0)
+        n--;
+    for (i = n - 1; i >= 0; i--) {
+        v = b->d[i];
+        w = 9;
+        if (i == n - 1)
+            for (w = 1; w < 9 && v >= pow10[w]; w++)
+                ;
+        for (k = w - 1; k >= 0; k--, v /= 10)
+            out[len + k] = '0' + v % 10;
+        len += w;
+    }
+    if (len == 0)
+        out[len++] = '0';
+    return len;
+}
+
+// Halve b, returning the remainder.
+uint big_half(struct big *b) {
+    uint r = 0, v;
+    int i;
+
+    for (i = b->n - 1; i >= 0; i--) {
+        v = b->d[i];
+        b->d[i] = v / 2 + r * (BASE / 2);
+        r = v % 2;
     }
+    while (b->n > 0 && b->d[b->n - 1] == 0)
+        b->n--;
+    return r;
+}
+
+// Format b in hex at out, which needs room for 8 digits a limb
+// and "0x", and return the length.  b is used up.
+int big_hex(struct big *b, char *out, int size) {
+    char *p = out + size;
+    int k, nib;
+
+    while (b->n > 0 && b->d[b->n - 1] == 0)
+        b->n--;
+    while (b->n > 0) {
+        for (nib = 0, k = 0; k < 4; k++)
+            nib |= big_half(b) << k;
+        *--p = "0123456789abcdef"[nib];
+    }
+    if (p == out + size)
+        *--p = '0';
+    *--p = 'x';
+    *--p = '0';
+    memmove(out, p, out + size - p);
+    return out + size - p;
+}
+
+// Add up the numbers read from fd, counting the bytes in *nbytes.
+int sum_fd(int fd, struct scan *s, uint *nbytes) {
+    int n;
 
-    long long total_sum = 0;
-    for (int j = 1; j < argc; j++) {
-        char *input_str = argv[j];
-        int i = 0;
-        while (input_str[i] != '\0') {
-            if (is_digit(input_str[i])) {
-                int current_num = 0;
-                while (is_digit(input_str[i])) {
-                    current_num = current_num * 10 + (input_str[i] - '0');
-                    i++;
-                }
-                total_sum += current_num;
-            } else {
-                i++;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        scan(s, buf, n);
+        *nbytes += n;
+    }
+    scan_end(s);
+    return n;
+}
+
+// Add up the numbers that start in [lo, hi) of fd, a file of
+// size bytes, by mapping it.  The page before lo is mapped too,
+// to see whether a number runs into lo, and so is the rest of the
+// file, for a number that runs past hi; only the pages looked at
+// are read.
+int sum_range(int fd, uint lo, uint hi, uint size, struct scan *s) {
+    uint start = lo >= PGSIZE ? lo - PGSIZE : 0;
+    char *m, *p, *q, *end;
+
+    m = mmap(0, size - start, PROT_READ, MAP_SHARED, fd, start);
+    if (m == MAP_FAILED)
+        return -1;
+    p = m + (lo - start);
+    end = m + (size - start);
+    if (lo > 0 && isdigit(p[-1]))  // belongs to the worker before
+        while (p < m + (hi - start) && isdigit(*p))
+            p++;
+    scan(s, p, m + (hi - start) - p);
+    if (s->indigit) {
+        for (q = m + (hi - start); q < end && isdigit(*q); q++)
+            ;
+        scan(s, m + (hi - start), q - (m + (hi - start)));
+    }
+    scan_end(s);
+    munmap(m, size - start);
+    return 0;
+}
+
+// Split the size-byte file fd among jobs workers.  Each sends
+// its sum back through a pipe of its own, as a limb count (-1 if
+// it failed) and the limbs.
+int sum_parallel(int fd, uint size, int jobs, struct scan *s) {
+    struct scan t;
+    uint chunk, lo, *d;
+    int p[2], rfd[MAXJOBS], w, n, ok;
+
+    chunk = (size / jobs + PGSIZE - 1) / PGSIZE * PGSIZE;
+    for (n = 0, lo = 0; lo < size; n++, lo += chunk) {
+        if (pipe(p) < 0)
+            break;
+        if (fork() == 0) {
+            close(p[0]);
+            memset(&t, 0, sizeof(t));
+            w = -1;
+            if (sum_range(fd, lo, lo + chunk < size ? lo + chunk : size,
+                          size, &t) == 0)
+                w = t.sum.n;
+            write(p[1], &w, sizeof(w));
+            if (w > 0)
+                write(p[1], t.sum.d, w * sizeof(uint));
+            exit();
+        }
+        close(p[1]);
+        rfd[n] = p[0];
+    }
+    ok = lo >= size;
+    for (w = 0; w < n; w++) {
+        int m;
+        if (read(rfd[w], &m, sizeof(m)) != sizeof(m) || m < 0)
+            ok = 0;
+        else if (m > 0) {
+            if ((d = malloc(m * sizeof(uint))) == 0)
+                ok = 0;
+            else {
+                int want = m * sizeof(uint), got = 0, r;
+                while (got < want && (r = read(rfd[w], (char *)d + got, want - got)) > 0)
+                    got += r;
+                if (got == want)
+                    big_add(&s->sum, d, m);
+                else
+                    ok = 0;
+                free(d);
             }
         }
+        close(rfd[w]);
     }
+    for (w = 0; w < n; w++)
+        wait();
+    return ok ? 0 : -1;
+}
 
- 
-    char result_buf[50];
-    int len = itoa(total_sum, result_buf);
-    result_buf[len] = '\n'; 
-    len++;
+// Add up the numbers in the file named path, or in the standard
+// input if path is "-".
+int sum_file(char *path, int jobs, struct scan *s, uint *nbytes) {
+    struct stat st;
+    struct scan t;
+    int fd, r;
 
-    int fd = open("result.txt", O_CREATE | O_WRONLY);
+    if (strcmp(path, "-") == 0)
+        return sum_fd(0, s, nbytes);
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        printf(2, "find_sum: cannot open %s\n", path);
+        return -1;
+    }
+    r = -1;
+    if (jobs > 1 && fstat(fd, &st) == 0 && st.type == T_FILE &&
+        st.size >= (uint)jobs * PGSIZE) {
+        memset(&t, 0, sizeof(t));
+        if ((r = sum_parallel(fd, st.size, jobs, &t)) == 0) {
+            big_add(&s->sum, t.sum.d, t.sum.n);
+            *nbytes += st.size;
+        }
+        if (t.sum.d)
+            free(t.sum.d);
+    }
+    if (r < 0)
+        r = sum_fd(fd, s, nbytes);
+    close(fd);
+    return r;
+}
+
+void usage(void) {
+    printf(2, "Usage: find_sum [-a] [-x] <string1> [string2] ...\n");
+    printf(2, "       find_sum [-a] [-x] [-j workers] -f [file ...]\n");
+    exit();
+}
+
+// Write line, the result, to result.txt: replacing what is there,
+// or after it if append is set.  Either way it takes one write().
+void save(char *line, int len, int append) {
+    int fd;
+
+    if (!append)
+        unlink("result.txt");
+    fd = open("result.txt", O_CREATE | O_RDWR);
     if (fd < 0) {
         printf(2, "find_sum: cannot open result.txt\n");
         exit();
     }
-    if(write(fd, result_buf, len) != len){
+    if (append)
+        while (read(fd, buf, sizeof(buf)) > 0)
+            ;
+    if(write(fd, line, len) != len){
         printf(2, "find_sum: error writing to result.txt\n");
     }
-    
     close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    struct scan s;
+    int j, jobs = 1, files = argc == 1, append = 0, hex = 0;
+    uint nbytes = 0;
+    int t0 = uptime();
+
+    memset(&s, 0, sizeof(s));
+    for (j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "-a") == 0)
+            append = 1;
+        else if (strcmp(argv[j], "-x") == 0)
+            hex = 1;
+        else if (strcmp(argv[j], "-j") == 0 && j + 1 < argc) {
+            jobs = atoi(argv[++j]);
+            if (jobs < 1 || jobs > MAXJOBS)
+                usage();
+        } else if (strcmp(argv[j], "-f") == 0) {
+            files = 1;
+            j++;
+            break;
+        } else
+            break;
+    }
+    if (!files && j == argc)
+        files = 1;
+
+    if (!files) {
+        for (; j < argc; j++) {
+            scan(&s, argv[j], strlen(argv[j]));
+            scan_end(&s);
+        }
+    } else if (j == argc) {
+        if (sum_fd(0, &s, &nbytes) < 0)
+            printf(2, "find_sum: read error\n");
+    } else {
+        for (; j < argc; j++)
+            if (sum_file(argv[j], jobs, &s, &nbytes) < 0)
+                printf(2, "find_sum: error reading %s\n", argv[j]);
+    }
+
+    if (files) {
+        int t = uptime() - t0;
+        if (t == 0)
+            t = 1;
+        // HZ ticks a second; report tenths of a Mbyte a second.
+        uint kbps = nbytes / 1024 * HZ / t;
+        uint rate = kbps * 10 / 1024;
+        printf(2, "find_sum: %d bytes in %d ticks, %d.%d MB/s\n",
+               nbytes, t, rate / 10, rate % 10);
+    }
+
+    int size = 9 * s.sum.n + 4;
+    char *result = malloc(size);
+    if (result == 0) {
+        printf(2, "find_sum: out of memory\n");
+        exit();
+    }
+    int len = hex ? big_hex(&s.sum, result, size - 1) : big_dec(&s.sum, result);
+    result[len++] = '\n';
+    save(result, len, append);
 
     exit();
-}
\ No newline at end of file
+}
@@ -7,7 +7,8 @@
 //
 // This file contains the low-level file system manipulation
 // routines.  The (higher-level) system call implementations
-// are in sysfile.c.
+// are in sysfile.c.  Inodes on TMPDEV keep their contents in
+// memory instead; see tmpfs.c.
 
 #include "types.h"
 #include "defs.h"
@@ -20,12 +21,12 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "stats.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+static void dcinit(void);
+static void dcpurge(uint, uint);
 
 // Read the super block.
 void
@@ -44,54 +45,199 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  bp = bclear(dev, bno);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
+//
+// Each disk with a file system has a struct fsdisk, holding
+// its superblock and free map.  fm->nfree[] counts the free
+// blocks each bitmap block describes, so balloc() skips full
+// bitmap blocks without reading them.  A count only changes
+// while its bitmap block's buffer is locked, which serializes
+// the updates; balloc() reads the counts without a lock, as
+// hints.
+
+#define NBMAP (FSSIZE/BPB + 1)
+
+struct fsdisk {
+  struct superblock sb;
+  int nbmap;           // bitmap blocks in use
+  int nfree[NBMAP];    // free blocks per bitmap block
+  uint inext;          // where ialloc() looks first
+};
+
+static struct fsdisk fsdisk[NDISK];
+
+#define SB(dev) (fsdisk[dev].sb)
+
+// Mount table: the root directory of device dev covers
+// directory on.  Entries are filled in under mountlock, which
+// serializes mount(), and never removed, so namex() reads
+// them without the lock; each holds a reference to its
+// directory.
+
+#define NMOUNT 4
+
+struct mount {
+  uint dev;
+  struct inode *on;    // 0 if the slot is free
+};
+
+static struct sleeplock mountlock;
+static struct mount mounts[NMOUNT];
+
+// Bits described by bitmap block i of fm.
+static int
+bmapbits(struct fsdisk *fm, int i)
+{
+  return min(BPB, fm->sb.size - i*BPB);
+}
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// Read dev's superblock and count its free blocks.
+// Return -1 if it does not hold a file system.
+static int
+freemapinit(uint dev)
 {
-  int b, bi, m;
+  struct fsdisk *fm;
   struct buf *bp;
+  uint *w, x;
+  int i, j, n, nbits;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  fm = &fsdisk[dev];
+  readsb(dev, &fm->sb);
+  if(fm->sb.size == 0 || fm->sb.size > FSSIZE || fm->sb.ninodes == 0 ||
+     fm->sb.bmapstart >= fm->sb.size)
+    return -1;
+  fm->nbmap = (fm->sb.size + BPB - 1) / BPB;
+  for(i = 0; i < fm->nbmap; i++){
+    bp = bread(dev, fm->sb.bmapstart + i);
+    w = (uint*)bp->data;
+    n = nbits = bmapbits(fm, i);
+    for(j = 0; j*32 < nbits; j++){
+      x = w[j];
+      if((j+1)*32 > nbits)   // ignore bits past the end
+        x |= ~0U << (nbits % 32);
+      for(; x; x &= x - 1)
+        n--;
+    }
+    fm->nfree[i] = n;
+    brelse(bp);
+  }
+  fm->inext = 1;
+  return 0;
+}
+
+// Return the first clear bit at or after bit from in the
+// bitmap block data, of which nbits are used, or -1.
+// Looks at 32 bits at a time.
+static int
+bmapfind(uchar *data, int from, int nbits)
+{
+  uint *w, x;
+  int i, b;
+
+  w = (uint*)data;
+  for(i = from/32; i*32 < nbits; i++){
+    x = ~w[i];
+    if(i == from/32)
+      x &= ~0U << (from%32);
+    if(x){
+      b = i*32 + __builtin_ctz(x);
+      return b < nbits ? b : -1;
+    }
+  }
+  return -1;
+}
+
+// Allocate a disk block for ip, preferring the first free
+// block after the one ip was last given, so that a file
+// written in order is laid out in order.  The block is
+// zeroed unless the caller is about to overwrite all of it.
+static uint
+balloc(struct inode *ip, int zero)
+{
+  int i, n, bi, start;
+  uint b;
+  struct buf *bp;
+  struct fsdisk *fm;
+
+  fm = &fsdisk[ip->dev];
+  start = ip->lastblock + 1;
+  if(ip->lastblock == 0 || start >= fm->sb.size)
+    start = 0;
+  // Visit each bitmap block once, starting with start's,
+  // and then the part of start's before start.
+  for(n = 0; n <= fm->nbmap; n++){
+    i = (start/BPB + n) % fm->nbmap;
+    if(fm->nfree[i] == 0)
+      continue;
+    bp = bread(ip->dev, fm->sb.bmapstart + i);
+    bi = bmapfind(bp->data, n == 0 ? start % BPB : 0, bmapbits(fm, i));
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      fm->nfree[i]--;
+      log_write(bp);
+      brelse(bp);
+      b = i*BPB + bi;
+      if(zero)
+        bzero(ip->dev, b);
+      ip->lastblock = b;
+      return b;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Blocks to be freed, collected so that each bitmap block
+// is read and logged once per batch rather than per block.
+#define NFREEBATCH 64
+
+struct freebatch {
+  uint dev;
+  int n;
+  uint b[NFREEBATCH];
+};
+
+// Free the disk blocks in fb, one bitmap block at a time.
 static void
-bfree(int dev, uint b)
+bfreeflush(struct freebatch *fb)
 {
   struct buf *bp;
-  int bi, m;
-
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  int i, j, bi, m;
+  uint bb;
+
+  while(fb->n > 0){
+    bb = BBLOCK(fb->b[0], SB(fb->dev));
+    bp = bread(fb->dev, bb);
+    for(i = j = 0; i < fb->n; i++){
+      if(BBLOCK(fb->b[i], SB(fb->dev)) != bb){
+        fb->b[j++] = fb->b[i];   // keep for a later bitmap block
+        continue;
+      }
+      bi = fb->b[i] % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+      fsdisk[fb->dev].nfree[fb->b[i] / BPB]++;
+    }
+    fb->n = j;
+    log_write(bp);
+    brelse(bp);
+  }
+}
+
+// Queue disk block b to be freed when fb is flushed.
+static void
+bfree(struct freebatch *fb, uint b)
+{
+  if(fb->n == NFREEBATCH)
+    bfreeflush(fb);
+  fb->b[fb->n++] = b;
 }
 
 // Inodes.
@@ -159,30 +305,85 @@ bfree(int dev, uint b)
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
 //
+// Entries come from a slab cache, so there is no limit on how
+// many inodes can be in use at once.  They are hashed on
+// (dev, inum) into NIHASH chains.  Up to NINODE entries are
+// kept when free, on an LRU list; iget() finds them again,
+// still valid, or recycles the least recently used one for
+// another inode.
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev)*7 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmcache *cache;
+  struct inode *hash[NIHASH];  // chains through ip->next
+  struct inode *lru;   // unused entries, most recently used first
+  struct inode *lrutail;
+  int n;               // entries in the cache
+  uint nhit;           // iget()s that found the inode
+  uint nmiss;          // iget()s that made or recycled an entry
 } icache;
 
+// Put the unused entry ip at the head of the LRU list.
+// Caller must hold icache.lock.
+static void
+lruput(struct inode *ip)
+{
+  ip->lruprev = 0;
+  ip->lrunext = icache.lru;
+  if(icache.lru)
+    icache.lru->lruprev = ip;
+  else
+    icache.lrutail = ip;
+  icache.lru = ip;
+}
+
+// Take ip off the LRU list.  Caller must hold icache.lock.
+static void
+lruremove(struct inode *ip)
+{
+  if(ip->lruprev)
+    ip->lruprev->lrunext = ip->lrunext;
+  else
+    icache.lru = ip->lrunext;
+  if(ip->lrunext)
+    ip->lrunext->lruprev = ip->lruprev;
+  else
+    icache.lrutail = ip->lruprev;
+}
+
+// Take ip off its hash chain.  Caller must hold icache.lock.
+static void
+unhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  pp = &icache.hash[IHASH(ip->dev, ip->inum)];
+  while(*pp != ip)
+    pp = &(*pp)->next;
+  *pp = ip->next;
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  initsleeplock(&mountlock, "mount");
+  icache.cache = kmcreate("inode", sizeof(struct inode));
+  dcinit();
 
-  readsb(dev, &sb);
+  if(freemapinit(dev) < 0)
+    panic("iinit: no file system");
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
-          sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+ inodestart %d bmap start %d\n", SB(dev).size, SB(dev).nblocks,
+          SB(dev).ninodes, SB(dev).nlog, SB(dev).logstart,
+          SB(dev).inodestart, SB(dev).bmapstart);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -194,18 +395,27 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  int i, inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
+  if(dev == TMPDEV)
+    return (inum = tmpialloc(type)) ? iget(dev, inum) : 0;
+
+  // Start after the inode last allocated rather than at 1,
+  // which is usually taken, wrapping round once.
+  inum = fsdisk[dev].inext;
+  for(i = 1; i < SB(dev).ninodes; i++, inum++){
+    if(inum >= SB(dev).ninodes)
+      inum = 1;
+    bp = bread(dev, IBLOCK(inum, SB(dev)));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
       brelse(bp);
+      fsdisk[dev].inext = inum + 1;
       return iget(dev, inum);
     }
     brelse(bp);
@@ -223,7 +433,11 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  if(ip->dev == TMPDEV){
+    tmpiupdate(ip);
+    return;
+  }
+  bp = bread(ip->dev, IBLOCK(ip->inum, SB(ip->dev)));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
@@ -241,36 +455,64 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **hp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  hp = &icache.hash[IHASH(dev, inum)];
+  for(ip = *hp; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
+      icache.nhit++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
-
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  icache.nmiss++;
+
+  // Recycle the least recently used entry once NINODE are
+  // kept, else make a new one.
+  ip = 0;
+  if(icache.lrutail == 0 || icache.n < NINODE)
+    ip = kmalloc(icache.cache);
+  if(ip){
+    initsleeplock(&ip->lock, "inode");
+    icache.n++;
+  } else {
+    if((ip = icache.lrutail) == 0)
+      panic("iget: no inodes");
+    lruremove(ip);
+    unhash(ip);
+    pcpurge(ip);
+  }
+  ip->next = *hp;
+  *hp = ip;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ralast = 0;
+  ip->raend = 0;
+  ip->lastblock = 0;
   release(&icache.lock);
 
   return ip;
 }
 
+// Fill in st's inode cache counters.
+void
+istat(struct sysstat *st)
+{
+  acquire(&icache.lock);
+  st->ninode = NINODE;
+  st->icached = icache.n;
+  st->ihit = icache.nhit;
+  st->imiss = icache.nmiss;
+  release(&icache.lock);
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
@@ -296,15 +538,19 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
-    ip->major = dip->major;
-    ip->minor = dip->minor;
-    ip->nlink = dip->nlink;
-    ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
-    brelse(bp);
+    if(ip->dev == TMPDEV)
+      tmpiload(ip);
+    else {
+      bp = bread(ip->dev, IBLOCK(ip->inum, SB(ip->dev)));
+      dip = (struct dinode*)bp->data + ip->inum%IPB;
+      ip->type = dip->type;
+      ip->major = dip->major;
+      ip->minor = dip->minor;
+      ip->nlink = dip->nlink;
+      ip->size = dip->size;
+      memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+      brelse(bp);
+    }
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -321,6 +567,17 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Take the unused entry ip out of the cache and free it.
+// Caller must hold icache.lock.
+static void
+ifree(struct inode *ip)
+{
+  unhash(ip);
+  icache.n--;
+  pcpurge(ip);
+  kmfree(icache.cache, ip);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
@@ -338,6 +595,8 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -348,6 +607,12 @@ iput(struct inode *ip)
 
   acquire(&icache.lock);
   ip->ref--;
+  if(ip->ref == 0){
+    if(icache.n > NINODE)
+      ifree(ip);
+    else
+      lruput(ip);
+  }
   release(&icache.lock);
 }
 
@@ -365,19 +630,22 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The NDINDIRECT blocks
+// after that are listed in the indirect blocks whose numbers
+// are in block ip->addrs[NDIRECT+1].
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, zeroed
+// if zero is set.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int zero)
 {
   uint addr, *a;
   struct buf *bp;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip, zero);
     return addr;
   }
   bn -= NDIRECT;
@@ -385,11 +653,34 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip, 1);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = balloc(ip, zero);
+      log_write(bp);
+    }
+    brelse(bp);
+    return addr;
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect block
+    // it points to, allocating either if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip, 1);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = addr = balloc(ip, 1);
+      log_write(bp);
+    }
+    brelse(bp);
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn % NINDIRECT]) == 0){
+      a[bn % NINDIRECT] = addr = balloc(ip, zero);
       log_write(bp);
     }
     brelse(bp);
@@ -407,13 +698,21 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
-
+  int i, j, k;
+  struct buf *bp, *bp2;
+  uint *a, *a2;
+  struct freebatch fb;
+
+  pcpurge(ip);
+  if(ip->dev == TMPDEV){
+    tmptrunc(ip);
+    return;
+  }
+  fb.dev = ip->dev;
+  fb.n = 0;
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      bfree(&fb, ip->addrs[i]);
       ip->addrs[i] = 0;
     }
   }
@@ -423,13 +722,34 @@ itrunc(struct inode *ip)
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        bfree(&fb, a[j]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfree(&fb, ip->addrs[NDIRECT]);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j] == 0)
+        continue;
+      bp2 = bread(ip->dev, a[j]);
+      a2 = (uint*)bp2->data;
+      for(k = 0; k < NINDIRECT; k++){
+        if(a2[k])
+          bfree(&fb, a2[k]);
+      }
+      brelse(bp2);
+      bfree(&fb, a[j]);
+    }
+    brelse(bp);
+    bfree(&fb, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  bfreeflush(&fb);
   ip->size = 0;
   iupdate(ip);
 }
@@ -446,6 +766,38 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// If ip is being read sequentially, start asynchronous
+// reads of the blocks following [first, last] so that they
+// are in the buffer cache by the time readi gets to them.
+// The window is refilled once half of it has been consumed.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint bn, end, nb;
+
+  if(first != ip->ralast && first != ip->ralast+1){
+    ip->ralast = last;
+    ip->raend = last+1;
+    return;
+  }
+  ip->ralast = last;
+
+  nb = (ip->size + BSIZE-1) / BSIZE;
+  end = first + 1 + RAWINDOW;
+  if(end > nb)
+    end = nb;
+  bn = ip->raend;
+  if(bn < first+1)
+    bn = first+1;
+  if(bn > first + 1 + RAWINDOW/2)
+    return;
+  for(; bn < end; bn++)
+    breadahead(ip->dev, bmap(ip, bn, 1));
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
@@ -465,9 +817,13 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(ip->dev == TMPDEV)
+    return tmpread(ip, dst, off, n);
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off+n-1)/BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -492,13 +848,21 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
+  if(ip->dev == TMPDEV)
+    return tmpwrite(ip, src, off, n);
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    // A block written in full needs neither zeroing when it
+    // is allocated nor reading if it exists.
+    if(m == BSIZE)
+      bp = bclear(ip->dev, bmap(ip, off/BSIZE, 0));
+    else
+      bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
     memmove(bp->data + off%BSIZE, src, m);
+    pcwrite(ip, off, src, m);
     log_write(bp);
     brelse(bp);
   }
@@ -519,6 +883,147 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory entry cache.
+//
+// Remembers the inode number and offset of names that
+// dirlookup() has found, keyed by (dev, directory inum, name),
+// so that repeated lookups skip the directory scan.
+// Only names that exist are cached.  sys_unlink() calls
+// dcremove() when it clears a dirent, and iput() purges the
+// entries of a directory it frees, so an entry is never stale.
+// Callers hold the directory's sleep-lock; dcache.lock
+// protects the table itself.
+
+#define NDCACHE 128
+#define NDHASH  61
+
+struct dentry {
+  uint dev;
+  uint dir;            // inum of directory; 0 if free
+  char name[DIRSIZ];
+  uint inum;
+  uint off;            // byte offset of dirent in dir
+  struct dentry *next; // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDHASH];
+  int hand;            // next entry to recycle
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry**
+dchash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev*31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+// Find the entry for name in dir.  Caller holds dcache.lock.
+static struct dentry*
+dcfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dchash(dev, dir, name); d; d = d->next)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Unhash d and mark it free.  Caller holds dcache.lock.
+static void
+dcdrop(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dchash(d->dev, d->dir, d->name); *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      break;
+    }
+  }
+  d->dir = 0;
+}
+
+// Look up name in dp.  On a hit, set *inum and *off.
+static int
+dclookup(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  d = dcfind(dp->dev, dp->inum, name);
+  if(d){
+    *inum = d->inum;
+    *off = d->off;
+  }
+  release(&dcache.lock);
+  return d != 0;
+}
+
+// Remember that name in dp is inode inum at offset off,
+// recycling entries round-robin.
+static void
+dcinsert(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, **pp;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    d = &dcache.ent[dcache.hand];
+    dcache.hand = (dcache.hand + 1) % NDCACHE;
+    if(d->dir)
+      dcdrop(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    pp = dchash(d->dev, d->dir, d->name);
+    d->next = *pp;
+    *pp = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  release(&dcache.lock);
+}
+
+// Forget name in dp; its dirent is being cleared.
+void
+dcremove(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) != 0)
+    dcdrop(d);
+  release(&dcache.lock);
+}
+
+// Forget all names in directory dir, which is being freed.
+static void
+dcpurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++)
+    if(d->dir == dir && d->dev == dev)
+      dcdrop(d);
+  release(&dcache.lock);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -530,6 +1035,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dclookup(dp, name, &inum, &off)){
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -540,6 +1051,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcinsert(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
@@ -573,10 +1085,50 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcinsert(dp, name, inum, off);
+  if(dp->dev == ROOTDEV && dp->inum == ROOTINO)
+    trieadd(name);
 
   return 0;
 }
 
+// Fill in up to n entries of ds from directory dp, starting
+// at byte *off, and advance *off past the entries read.
+// Metadata comes from the on-disk inodes, which iupdate()
+// keeps current, so no other inode need be locked.
+// Caller must hold dp->lock.  Returns the number of entries.
+int
+dirread(struct inode *dp, uint *off, struct dirstat *ds, int n)
+{
+  struct dirent de;
+  struct buf *bp;
+  struct dinode *dip;
+  int i;
+
+  if(dp->type != T_DIR)
+    return -1;
+  for(i = 0; i < n && *off + sizeof(de) <= dp->size; *off += sizeof(de)){
+    if(readi(dp, (char*)&de, *off, sizeof(de)) != sizeof(de))
+      panic("dirread");
+    if(de.inum == 0)
+      continue;
+    memmove(ds[i].name, de.name, DIRSIZ);
+    ds[i].name[DIRSIZ] = 0;
+    ds[i].ino = de.inum;
+    if(dp->dev == TMPDEV)
+      tmpstat(de.inum, &ds[i].type, &ds[i].size);
+    else {
+      bp = bread(dp->dev, IBLOCK(de.inum, SB(dp->dev)));
+      dip = (struct dinode*)bp->data + de.inum%IPB;
+      ds[i].type = dip->type;
+      ds[i].size = dip->size;
+      brelse(bp);
+    }
+    i++;
+  }
+  return i;
+}
+
 //PAGEBREAK!
 // Paths
 
@@ -617,6 +1169,62 @@ skipelem(char *path, char *name)
   return path;
 }
 
+// Return the mount whose root covers ip, or 0.
+static struct mount*
+mountedon(struct inode *ip)
+{
+  struct mount *m;
+
+  for(m = mounts; m < mounts+NMOUNT; m++)
+    if(m->on == ip)
+      return m;
+  return 0;
+}
+
+// Return the mount of dev, or 0.
+static struct mount*
+mountof(uint dev)
+{
+  struct mount *m;
+
+  for(m = mounts; m < mounts+NMOUNT; m++)
+    if(m->on && m->dev == dev)
+      return m;
+  return 0;
+}
+
+// Mount the file system of device dev, a disk or TMPDEV,
+// over directory dp.  Caller must hold dp->lock.
+int
+mount(struct inode *dp, uint dev)
+{
+  struct mount *m;
+
+  if(dp->type != T_DIR || dev == ROOTDEV)
+    return -1;
+  if(dev != TMPDEV && !idepresent(dev))
+    return -1;
+  acquiresleep(&mountlock);
+  // mountedon(0) is a free slot.
+  if(mountedon(dp) || mountof(dev) || (m = mountedon(0)) == 0 ||
+     (dev != TMPDEV && freemapinit(dev) < 0)){
+    releasesleep(&mountlock);
+    return -1;
+  }
+  m->dev = dev;
+  __sync_synchronize();  // namex() must not see on before dev
+  m->on = idup(dp);
+  releasesleep(&mountlock);
+  return 0;
+}
+
+// Is ip a mount point?
+int
+ismount(struct inode *ip)
+{
+  return mountedon(ip) != 0;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
@@ -625,6 +1233,7 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct mount *m;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
@@ -642,12 +1251,24 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
+    if(ip->dev != ROOTDEV && ip->inum == ROOTINO &&
+       namecmp(name, "..") == 0 && (m = mountof(ip->dev)) != 0){
+      // Leave a mounted file system for the parent of the
+      // directory it covers.
+      iunlockput(ip);
+      ip = idup(m->on);
+      ilock(ip);
+    }
     if((next = dirlookup(ip, name, 0)) == 0){
       iunlockput(ip);
       return 0;
     }
     iunlockput(ip);
     ip = next;
+    if((m = mountedon(ip)) != 0){
+      iput(ip);
+      ip = iget(m->dev, ROOTINO);
+    }
   }
   if(nameiparent){
     iput(ip);
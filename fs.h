@@ -7,7 +7,7 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                             free bit map | swap area | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -19,11 +19,14 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of swap blocks, 0 if none
 };
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +35,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -48,6 +51,12 @@ struct dinode {
 #define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
+// Blocks of log header: a count, a checksum, the count and
+// checksum of the log before the last commit, and LOGSIZE
+// block numbers.
+#define LOGHDRWORDS 4
+#define LOGHDR ((4*(LOGSIZE+LOGHDRWORDS) + BSIZE-1) / BSIZE)
+
 #define DIRSIZ 14
 
 struct dirent {
@@ -55,3 +64,12 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory entry with its inode's metadata, as returned
+// by getdents().
+struct dirstat {
+  char name[DIRSIZ+1];  // nul-terminated
+  short type;
+  uint ino;
+  uint size;
+};
+
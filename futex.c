@@ -0,0 +1,136 @@
+// Futexes: words of user memory that threads wait on.
+//
+// FUTEX_WAIT sleeps if the word still holds the value the
+// caller expects, and FUTEX_WAKE wakes up to n of the threads
+// sleeping on the word.  A word is known by its physical
+// address, so all threads of a process, and processes sharing
+// the page, agree on which word it is.  Waiters hang off a
+// hash table of buckets, each with its own lock.  The waiter
+// checks the word holding that lock, so a wake that follows a
+// store to the word cannot slip in between the check and the
+// sleep.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "mman.h"
+#include "futex.h"
+
+#define NFUTEX  64
+#define FHASH(key)  (((key) >> 2) % NFUTEX)
+
+struct futexwaiter {
+  uint key;                   // kernel address of the word
+  int woken;
+  struct futexwaiter *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct futexwaiter *head;
+} futex[NFUTEX];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEX; i++)
+    initlock(&futex[i].lock, "futex");
+}
+
+// Return the kernel address of the user word at addr,
+// or 0 if it is not a word the process may read.
+static uint
+futexkey(uint addr)
+{
+  char *page;
+
+  if(addr % 4 != 0 || checkuser(addr, 4, PROT_READ) < 0)
+    return 0;
+  if((page = uva2ka(myproc()->pgdir, (char*)PGROUNDDOWN(addr))) == 0)
+    return 0;
+  return (uint)page + addr % PGSIZE;
+}
+
+// Sleep until woken if the word at addr holds val.
+// Returns 0, or -1 if addr is bad or the process is killed.
+static int
+futexwait(uint addr, uint val)
+{
+  struct futexwaiter w, **pp;
+  int b;
+
+  if((w.key = futexkey(addr)) == 0)
+    return -1;
+  b = FHASH(w.key);
+  acquire(&futex[b].lock);
+  if(*(uint*)w.key != val){
+    release(&futex[b].lock);
+    return 0;
+  }
+  w.woken = 0;
+  w.next = futex[b].head;
+  futex[b].head = &w;
+  while(!w.woken){
+    if(myproc()->killed){
+      for(pp = &futex[b].head; *pp != &w; pp = &(*pp)->next)
+        ;
+      *pp = w.next;
+      release(&futex[b].lock);
+      return -1;
+    }
+    sleep(&w, &futex[b].lock);
+  }
+  release(&futex[b].lock);
+  return 0;
+}
+
+// Wake up to n threads waiting on the word at addr.
+// Returns how many were woken, or -1 if addr is bad.
+static int
+futexwake(uint addr, int n)
+{
+  struct futexwaiter *w, **pp;
+  uint key;
+  int b, woken;
+
+  if((key = futexkey(addr)) == 0)
+    return -1;
+  b = FHASH(key);
+  woken = 0;
+  acquire(&futex[b].lock);
+  for(pp = &futex[b].head; *pp && woken < n; ){
+    w = *pp;
+    if(w->key != key){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&futex[b].lock);
+  return woken;
+}
+
+int
+sys_futex(void)
+{
+  int addr, op, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
@@ -0,0 +1,3 @@
+// futex() operations.
+#define FUTEX_WAIT  1   // sleep if *addr == val, until a wake
+#define FUTEX_WAKE  2   // wake up to val threads waiting on addr
@@ -1,107 +1,310 @@
 // Simple grep.  Only supports ^ . * $ operators.
+// -c prints the number of matching lines, and -l the names of
+// the files with one.
+//
+// The pattern is compiled to a list of items, each a character
+// or '.', maybe starred, which are the states of an NFA: being in
+// state i means items 0..i-1 have matched.  Lines are run through
+// a DFA whose states are sets of NFA states, built as the lines
+// need them and cached, so each byte costs one table lookup.
+// When every match must contain a literal string, lines without
+// it are skipped without running the DFA at all.
 
 #include "types.h"
 #include "stat.h"
 #include "user.h"
 
-char buf[1024];
-int match(char*, char*);
+#define MAXITEM 31    // so a set of NFA states fits in a uint
+#define NSTATE  64    // DFA states cached
+#define ANY     -1    // item for '.'
+#define BUFSZ   (4*4096)  // initial input buffer
+#define OBUFSZ  4096
+
+char *buf;            // input: lines not yet looked at
+int bufsz;
+char obuf[OBUFSZ];    // output: matching lines, written together
+int on;
+int cflag, lflag;
+
+struct item {
+  int c;
+  int star;
+} item[MAXITEM];
+int nitem;
+int bol, eol;         // pattern starts with ^, ends with $
+char lit[MAXITEM];    // literal each match begins with
+int nlit;
+
+uint dset[NSTATE];    // NFA states of each DFA state
+short dnext[NSTATE][256];  // DFA transitions, -1 if not built
+int ndstate;
+int dflushes;
 
 void
-grep(char *pattern, int fd)
+compile(char *re)
 {
-  int n, m;
-  char *p, *q;
-
-  m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
+  if(*re == '^'){
+    bol = 1;
+    re++;
+  }
+  while(*re){
+    if(re[0] == '$' && re[1] == '\0'){
+      eol = 1;
+      break;
     }
-    if(p == buf)
-      m = 0;
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+    if(nitem == MAXITEM){
+      printf(2, "grep: pattern too long\n");
+      exit();
     }
+    item[nitem].c = *re == '.' ? ANY : (uchar)*re;
+    item[nitem].star = re[1] == '*';
+    re += item[nitem].star ? 2 : 1;
+    nitem++;
   }
+  if(!bol)
+    while(nlit < nitem && !item[nlit].star && item[nlit].c != ANY){
+      lit[nlit] = item[nlit].c;
+      nlit++;
+    }
+}
+
+// Add the states reachable by skipping starred items.
+uint
+closure(uint set)
+{
+  int i;
+
+  for(i = 0; i < nitem; i++)
+    if((set >> i) & 1 && item[i].star)
+      set |= 1 << (i+1);
+  return set;
 }
 
+// Return the DFA state for set, making it if need be.  A full
+// cache is emptied and refilled from scratch.
 int
-main(int argc, char *argv[])
+dstate(uint set)
 {
-  int fd, i;
-  char *pattern;
+  int i;
 
-  if(argc <= 1){
-    printf(2, "usage: grep pattern [file ...]\n");
-    exit();
+  for(i = 0; i < ndstate; i++)
+    if(dset[i] == set)
+      return i;
+  if(ndstate == NSTATE){
+    ndstate = 0;
+    dflushes++;
   }
-  pattern = argv[1];
+  dset[ndstate] = set;
+  memset(dnext[ndstate], 0xff, sizeof(dnext[0]));
+  return ndstate++;
+}
 
-  if(argc <= 2){
-    grep(pattern, 0);
-    exit();
+int
+dstep(int s, int c)
+{
+  uint set, t;
+  int i, k, f;
+
+  if((k = dnext[s][c]) >= 0)
+    return k;
+  set = dset[s];
+  t = 0;
+  for(i = 0; i < nitem; i++)
+    if((set >> i) & 1 && (item[i].c == ANY || item[i].c == c))
+      t |= 1 << (item[i].star ? i : i+1);
+  if(!bol)
+    t |= 1;   // a match may start at any byte
+  f = dflushes;
+  k = dstate(closure(t));
+  if(f == dflushes)
+    dnext[s][c] = k;
+  return k;
+}
+
+int
+accepts(int s)
+{
+  return (dset[s] >> nitem) & 1;
+}
+
+// Does the n-byte line at p match?
+int
+match(char *p, int n)
+{
+  char *e;
+  int s;
+
+  s = dstate(closure(1));
+  for(e = p + n; ; p++){
+    if(!eol && accepts(s))
+      return 1;
+    if(p == e || dset[s] == 0)
+      break;
+    s = dstep(s, (uchar)*p);
   }
+  return eol && accepts(s);
+}
 
-  for(i = 2; i < argc; i++){
-    if((fd = open(argv[i], 0)) < 0){
-      printf(1, "grep: cannot open %s\n", argv[i]);
-      exit();
+// Return the first copy of lit in p[0..n), or 0.
+char*
+findlit(char *p, int n)
+{
+  char *e;
+  int i;
+
+  for(e = p + n; (p = memchr(p, lit[0], e - p)) != 0; p++){
+    for(i = 1; i < nlit && p + i < e && p[i] == lit[i]; i++)
+      ;
+    if(i == nlit)
+      return p;
+  }
+  return 0;
+}
+
+void
+flushout(void)
+{
+  if(on > 0)
+    write(1, obuf, on);
+  on = 0;
+}
+
+void
+output(char *p, int n)
+{
+  if(on + n > OBUFSZ){
+    flushout();
+    if(n > OBUFSZ){
+      write(1, p, n);
+      return;
     }
-    grep(pattern, fd);
-    close(fd);
   }
-  exit();
+  memmove(obuf + on, p, n);
+  on += n;
 }
 
-// Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9.
+// Make room at the end of buf for more input, keeping the
+// n bytes at *pp on: move them to the front when they are only
+// part of the buffer, since that happens once a buffer's worth
+// of input, or double the buffer for a line that fills it.
+void
+makeroom(char **pp, int n)
+{
+  char *nbuf;
 
-int matchhere(char*, char*);
-int matchstar(int, char*, char*);
+  if(*pp > buf){
+    memmove(buf, *pp, n);
+  } else {
+    if((nbuf = malloc(2*bufsz)) == 0){
+      printf(2, "grep: line too long\n");
+      exit();
+    }
+    memmove(nbuf, buf, n);
+    free(buf);
+    buf = nbuf;
+    bufsz *= 2;
+  }
+  *pp = buf;
+}
 
+// Return how many lines of fd match, or with -l, 1 as soon as
+// one does.
 int
-match(char *re, char *text)
+grep(int fd)
 {
-  if(re[0] == '^')
-    return matchhere(re+1, text);
-  do{  // must look at empty string
-    if(matchhere(re, text))
-      return 1;
-  }while(*text++ != '\0');
-  return 0;
+  int n, count;
+  char *p, *q, *e;
+
+  count = 0;
+  p = e = buf;
+  for(;;){
+    if(buf + bufsz - e < OBUFSZ && (p > buf || e == buf + bufsz)){
+      n = e - p;
+      makeroom(&p, n);
+      e = p + n;
+    }
+    if((n = read(fd, e, buf + bufsz - e)) <= 0)
+      break;
+    e += n;
+    for(;;){
+      if(nlit > 0){
+        // Skip to the line holding the next copy of lit.
+        if((q = findlit(p, e - p)) == 0)
+          q = e;
+        while(q > p && q[-1] != '\n')
+          q--;
+        p = q;
+      }
+      if((q = memchr(p, '\n', e - p)) == 0)
+        break;
+      if(match(p, q - p)){
+        count++;
+        if(lflag)
+          return 1;
+        if(!cflag)
+          output(p, q+1 - p);
+      }
+      p = q+1;
+    }
+  }
+  return count;
 }
 
-// matchhere: search for re at beginning of text
-int matchhere(char *re, char *text)
+// Report on a file with name name, or standard input if name is 0.
+void
+report(int fd, char *name, int many)
 {
-  if(re[0] == '\0')
-    return 1;
-  if(re[1] == '*')
-    return matchstar(re[0], re+2, text);
-  if(re[0] == '$' && re[1] == '\0')
-    return *text == '\0';
-  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
-    return matchhere(re+1, text+1);
-  return 0;
+  int n;
+
+  n = grep(fd);
+  if(lflag && n)
+    printf(1, "%s\n", name ? name : "(standard input)");
+  else if(cflag && many)
+    printf(1, "%s:%d\n", name, n);
+  else if(cflag)
+    printf(1, "%d\n", n);
 }
 
-// matchstar: search for c*re at beginning of text
-int matchstar(int c, char *re, char *text)
+int
+main(int argc, char *argv[])
 {
-  do{  // a * matches zero or more instances
-    if(matchhere(re, text))
-      return 1;
-  }while(*text!='\0' && (*text++==c || c=='.'));
-  return 0;
-}
+  int fd, i, many;
 
+  for(i = 1; i < argc; i++){
+    if(strcmp(argv[i], "-c") == 0)
+      cflag = 1;
+    else if(strcmp(argv[i], "-l") == 0)
+      lflag = 1;
+    else
+      break;
+  }
+  if(i >= argc){
+    printf(2, "usage: grep [-c] [-l] pattern [file ...]\n");
+    exit();
+  }
+  compile(argv[i++]);
+  bufsz = BUFSZ;
+  if((buf = malloc(bufsz)) == 0){
+    printf(2, "grep: out of memory\n");
+    exit();
+  }
+
+  if(i >= argc){
+    report(0, 0, 0);
+    flushout();
+    exit();
+  }
+
+  many = argc - i > 1;
+  for(; i < argc; i++){
+    if((fd = open(argv[i], 0)) < 0){
+      flushout();
+      printf(1, "grep: cannot open %s\n", argv[i]);
+      exit();
+    }
+    report(fd, argv[i], many);
+    close(fd);
+  }
+  flushout();
+  exit();
+}
@@ -1,4 +1,10 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.
+//
+// Contiguous queued requests for the same disk and direction
+// are started as one multi-sector command.  If a PCI IDE
+// controller with bus-master DMA is found, the command moves
+// the data by DMA; otherwise it uses READ/WRITE MULTIPLE PIO,
+// so either way the disk interrupts once per command.
 
 #include "types.h"
 #include "defs.h"
@@ -23,146 +29,491 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDEMULT       16   // sectors per PIO interrupt (SET MULTIPLE)
+#define IDEDMAMAX     128  // sectors per DMA command
 
-static struct spinlock idelock;
-static struct buf *idequeue;
+// PCI configuration space.
+#define PCI_ADDR      0xcf8
+#define PCI_DATA      0xcfc
+#define PCI_CMD       0x04
+#define PCI_CLASS     0x08
+#define PCI_BAR4      0x20
+#define PCI_CMD_IO    0x1
+#define PCI_CMD_BM    0x4
 
-static int havedisk1;
-static void idestart(struct buf*);
+// Bus-master DMA registers, relative to BAR4 (primary channel).
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
 
-// Wait for IDE disk to become ready.
+#define PRD_EOT       0x80000000
+
+// Physical region descriptor: one contiguous piece of a DMA transfer.
+// No piece may cross a 64K boundary.
+struct prd {
+  uint addr;
+  uint count;   // bytes in low 16 bits (0 means 64K); PRD_EOT on the last
+};
+
+// Drive d is drive d%2 (master or slave) of channel d/2.
+// Each channel has its own registers, interrupt and queue,
+// so the two channels run commands at the same time.
+//
+// c->queue points to the buf now being read/written to the disk.
+// c->queue->qnext points to the next buf to be processed.
+// The first c->nbuf bufs of the queue are the active command;
+// the rest are kept in C-LOOK order (see iderw).
+// You must hold c->lock while manipulating the queue.
+
+struct channel {
+  struct spinlock lock;
+  ushort base;        // command block registers
+  ushort ctl;         // device control register
+  int irq;
+  struct buf *queue;
+  int nbuf;
+  int depth;          // bufs in queue
+  ushort bm;          // bus-master registers, 0 if no DMA
+  struct prd *prdt;
+  int dma;            // active command uses DMA
+  int present[2];     // per drive
+  int multsect[2];    // sectors per PIO interrupt, per drive
+  struct {
+    uint reqs;      // bufs passed to iderw
+    uint cmds;      // commands started
+    uint merged;    // bufs that rode along on another's command
+    uint maxdepth;
+  } stat;
+};
+
+static struct channel chans[2] = {
+  { .base = 0x1f0, .ctl = 0x3f6, .irq = IRQ_IDE },
+  { .base = 0x170, .ctl = 0x376, .irq = IRQ_IDE+1 },
+};
+
+static void idestart(struct channel*, struct buf*);
+
+// Wait for the channel's selected drive to become ready.
 static int
-idewait(int checkerr)
+idewait(struct channel *c, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+  while(((r = inb(c->base+7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+static uint
+pciread(int bus, int dev, int fn, int reg)
+{
+  outl(PCI_ADDR, 0x80000000 | (bus<<16) | (dev<<11) | (fn<<8) | reg);
+  return inl(PCI_DATA);
+}
+
+static void
+pciwrite(int bus, int dev, int fn, int reg, uint v)
+{
+  outl(PCI_ADDR, 0x80000000 | (bus<<16) | (dev<<11) | (fn<<8) | reg);
+  outl(PCI_DATA, v);
+}
+
+// Look for a PCI IDE controller (class 1, subclass 1) on bus 0
+// that can bus-master, and enable it.  The secondary channel's
+// registers follow the primary's.
+static void
+dmainit(void)
+{
+  int dev, fn, i;
+  uint bar;
+
+  for(dev = 0; dev < 32; dev++){
+    for(fn = 0; fn < 8; fn++){
+      if((pciread(0, dev, fn, 0) & 0xffff) == 0xffff)
+        continue;
+      if((pciread(0, dev, fn, PCI_CLASS) >> 16) != 0x0101)
+        continue;
+      bar = pciread(0, dev, fn, PCI_BAR4);
+      if((bar & 1) == 0 || (bar & ~3) == 0)
+        continue;
+      pciwrite(0, dev, fn, PCI_CMD,
+        pciread(0, dev, fn, PCI_CMD) | PCI_CMD_IO | PCI_CMD_BM);
+      for(i = 0; i < 2; i++)
+        if((chans[i].prdt = (struct prd*)kalloc()) != 0)
+          chans[i].bm = (bar & ~3) + 8*i;
+      return;
+    }
+  }
+}
+
+// Switch drive to READ/WRITE MULTIPLE with IDEMULT sectors
+// per interrupt, leaving multsect 0 if the drive refuses.
+static void
+setmultiple(struct channel *c, int drive)
+{
+  idewait(c, 0);
+  outb(c->base+6, 0xe0 | (drive<<4));
+  outb(c->base+2, IDEMULT);
+  outb(c->base+7, IDE_CMD_SETMUL);
+  if(idewait(c, 1) >= 0)
+    c->multsect[drive] = IDEMULT;
+}
+
+// Is there an ATA disk at drive of c?  An absent channel
+// floats at 0xff; a CD-ROM leaves its signature in the
+// LBA registers.
+static int
+probe(struct channel *c, int drive)
+{
+  int i, r;
+
+  outb(c->base+6, 0xe0 | (drive<<4));
+  for(i=0; i<1000; i++){
+    r = inb(c->base+7);
+    if(r == 0xff)
+      return 0;
+    if(r != 0)
+      return inb(c->base+4) != 0x14 || inb(c->base+5) != 0xeb;
+  }
+  return 0;
+}
+
 void
 ideinit(void)
 {
-  int i;
+  struct channel *c;
+  int drive;
+  uint mask;
 
-  initlock(&idelock, "ide");
-  ioapicenable(IRQ_IDE, ncpu - 1);
-  idewait(0);
+  for(c = chans; c < chans+2; c++){
+    initlock(&c->lock, "ide");
+    // Disk 0, which we booted from, is surely there.
+    if(c == chans){
+      c->present[0] = 1;
+      idewait(c, 0);
+    } else
+      c->present[0] = probe(c, 0);
+    c->present[1] = probe(c, 1);
+    if(!c->present[0] && !c->present[1])
+      continue;
+    // Completions, and their PIO copies, may go to any CPU
+    // but the first, which takes the keyboard and serial port.
+    mask = (1 << ncpu) - 1;
+    if(ncpu > 1)
+      mask &= ~1;
+    ioapicenable(c->irq, mask);
 
-  // Check if disk 1 is present
-  outb(0x1f6, 0xe0 | (1<<4));
-  for(i=0; i<1000; i++){
-    if(inb(0x1f7) != 0){
-      havedisk1 = 1;
-      break;
-    }
+    // No interrupts until the first request.
+    outb(c->ctl, 0x2);
+    for(drive = 0; drive < 2; drive++)
+      if(c->present[drive])
+        setmultiple(c, drive);
   }
+  dmainit();
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Is disk dev attached?
+int
+idepresent(int dev)
+{
+  return dev >= 0 && dev < 4 && chans[dev/2].present[dev%2];
+}
+
+// Fill c's PRD table for the n bufs starting at b.
 static void
-idestart(struct buf *b)
+dmaprep(struct channel *c, struct buf *b, int n)
 {
+  struct prd *p;
+  uint pa, end, m;
+
+  p = c->prdt;
+  for(; n > 0; n--, b = b->qnext){
+    pa = V2P(b->data);
+    end = pa + BSIZE;
+    for(; pa < end; pa += m){
+      m = end - pa;
+      if((pa & 0xffff) + m > 0x10000)
+        m = 0x10000 - (pa & 0xffff);
+      p->addr = pa;
+      p->count = m;
+      p++;
+    }
+  }
+  p[-1].count |= PRD_EOT;
+}
+
+// Start the request for b and as many of the contiguous
+// requests queued behind it as one command can carry.
+// Caller must hold c->lock.
+static void
+idestart(struct channel *c, struct buf *b)
+{
+  struct buf *q;
+  int n, maxsect, nsect, write, cmd, drive;
+
   if(b == 0)
     panic("idestart");
   if(b->blockno >= FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  drive = b->dev % 2;
 
-  if (sector_per_block > 7) panic("idestart");
+  if(c->bm)
+    maxsect = IDEDMAMAX;
+  else if(c->multsect[drive])
+    maxsect = c->multsect[drive];
+  else
+    maxsect = 1;
+  if (sector_per_block > maxsect) panic("idestart");
 
-  idewait(0);
-  outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
-  outb(0x1f3, sector & 0xff);
-  outb(0x1f4, (sector >> 8) & 0xff);
-  outb(0x1f5, (sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
-  } else {
-    outb(0x1f7, read_cmd);
+  write = (b->flags & B_DIRTY) != 0;
+  n = 1;
+  for(q = b; q->qnext && (n+1)*sector_per_block <= maxsect; q = q->qnext, n++){
+    if(q->qnext->dev != b->dev || q->qnext->blockno != q->blockno+1)
+      break;
+    if(((q->qnext->flags & B_DIRTY) != 0) != write)
+      break;
+    if(q->qnext->blockno >= FSSIZE)
+      break;
+  }
+  nsect = n * sector_per_block;
+  c->nbuf = n;
+  c->stat.cmds++;
+  c->stat.merged += n - 1;
+  c->dma = c->bm != 0;
+
+  if(c->dma){
+    dmaprep(c, b, n);
+    outl(c->bm+BM_PRDT, V2P(c->prdt));
+    outb(c->bm+BM_CMD, write ? 0 : BM_CMD_READ);
+    outb(c->bm+BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    cmd = write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA;
+  } else if(c->multsect[drive])
+    cmd = write ? IDE_CMD_WRMUL : IDE_CMD_RDMUL;
+  else
+    cmd = write ? IDE_CMD_WRITE : IDE_CMD_READ;
+
+  idewait(c, 0);
+  outb(c->ctl, 0);  // generate interrupt
+  outb(c->base+2, nsect);  // number of sectors
+  outb(c->base+3, sector & 0xff);
+  outb(c->base+4, (sector >> 8) & 0xff);
+  outb(c->base+5, (sector >> 16) & 0xff);
+  outb(c->base+6, 0xe0 | (drive<<4) | ((sector>>24)&0x0f));
+  outb(c->base+7, cmd);
+  if(c->dma)
+    outb(c->bm+BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  else if(write){
+    for(q = b; n > 0; n--, q = q->qnext)
+      outsl(c->base, q->data, BSIZE/4);
   }
 }
 
-// Interrupt handler.
+// Interrupt handler for channel ch.
 void
-ideintr(void)
+ideintr(int ch)
 {
-  struct buf *b;
+  struct channel *c;
+  struct buf *b, *async;
+  int i, ok;
 
-  // First queued buffer is the active request.
-  acquire(&idelock);
+  // First queued buffers are the active request.
+  c = &chans[ch];
+  acquire(&c->lock);
 
-  if((b = idequeue) == 0){
-    release(&idelock);
+  if((b = c->queue) == 0){
+    release(&c->lock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(c->dma){
+    if((inb(c->bm+BM_STATUS) & BM_ST_INTR) == 0){
+      release(&c->lock);  // not ours yet
+      return;
+    }
+    outb(c->bm+BM_CMD, 0);
+    outb(c->bm+BM_STATUS, inb(c->bm+BM_STATUS) | BM_ST_ERR|BM_ST_INTR);
+  }
+  ok = idewait(c, 1) >= 0;
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  async = 0;
+  for(i = 0; i < c->nbuf; i++){
+    b = c->queue;
+    c->queue = b->qnext;
+    c->depth--;
+
+    // Read data if needed.
+    if(!c->dma && !(b->flags & B_DIRTY) && ok)
+      insl(c->base, b->data, BSIZE/4);
+
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+
+    // No one waits for a read-ahead; collect it to release below.
+    if(b->flags & B_ASYNC){
+      b->qnext = async;
+      async = b;
+    }
+  }
+  c->nbuf = 0;
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(c->queue != 0)
+    idestart(c, c->queue);
+
+  release(&c->lock);
 
-  release(&idelock);
+  while((b = async) != 0){
+    async = b->qnext;
+    bdone(b);
+  }
 }
 
-//PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Does a go before q in C-LOOK order, given that the
+// disk head is at block pos?  Blocks at or past pos are
+// served in this sweep, in ascending order; the rest wait
+// for the next sweep, which starts from the lowest block.
+static int
+elevbefore(struct buf *a, struct buf *q, uint pos)
 {
-  struct buf **pp;
+  int wa, wq;
+
+  wa = a->blockno < pos;
+  wq = q->blockno < pos;
+  if(wa != wq)
+    return wa < wq;
+  return a->blockno < q->blockno;
+}
 
+// Check a request and return the channel it goes to.
+static struct channel*
+idechan(struct buf *b)
+{
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  if(!idepresent(b->dev))
+    panic("iderw: ide disk not present");
+  return &chans[b->dev/2];
+}
 
-  acquire(&idelock);  //DOC:acquire-lock
+// Queue b on c, starting the disk if it is idle.
+// Caller must hold c->lock.
+static void
+idequeue(struct channel *c, struct buf *b)
+{
+  struct buf **pp;
+  uint pos;
+  int i;
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
+  // Insert b into the queue behind the active command.
+  pos = 0;
+  pp = &c->queue;
+  for(i = 0; i < c->nbuf && *pp; i++){
+    pos = (*pp)->blockno;
+    pp = &(*pp)->qnext;
+  }
+  for(; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+    if(elevbefore(b, *pp, pos))
+      break;
+  b->qnext = *pp;
   *pp = b;
 
+  c->stat.reqs++;
+  if(++c->depth > c->stat.maxdepth)
+    c->stat.maxdepth = c->depth;
+
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(c->queue == b)
+    idestart(c, b);
+}
+
+//PAGEBREAK!
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return once the read is queued;
+// ideintr() releases the buffer when it completes.
+void
+iderw(struct buf *b)
+{
+  struct channel *c;
+
+  c = idechan(b);
+  acquire(&c->lock);  //DOC:acquire-lock
+  idequeue(c, b);
+
+  if(b->flags & B_ASYNC){
+    release(&c->lock);
+    return;
+  }
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+    sleep(b, &c->lock);
   }
 
 
-  release(&idelock);
+  release(&c->lock);
+}
+
+// Sync n bufs with disk, as iderw() does, but queue them all
+// before waiting for any, so that the disk sees them as one
+// batch: it may run them in any order, and contiguous ones
+// share a command.  None may be B_ASYNC.
+void
+iderwv(struct buf **bp, int n)
+{
+  struct channel *c;
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(bp[i]->flags & B_ASYNC)
+      panic("iderwv: async");
+    c = idechan(bp[i]);
+    acquire(&c->lock);
+    idequeue(c, bp[i]);
+    release(&c->lock);
+  }
+  for(i = 0; i < n; i++){
+    c = &chans[bp[i]->dev/2];
+    acquire(&c->lock);
+    while((bp[i]->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(bp[i], &c->lock);
+    release(&c->lock);
+  }
+}
+
+// Print queue depth and merge counts.
+// Runs when user types ^P on console.
+// No lock to avoid wedging a stuck machine further.
+void
+idedump(void)
+{
+  struct channel *c;
+
+  for(c = chans; c < chans+2; c++){
+    if(!c->present[0] && !c->present[1])
+      continue;
+    cprintf("ide%d: %s, %d queued (max %d), %d requests in %d commands, %d merged\n",
+            c - chans, c->bm ? "dma" : "pio", c->depth, c->stat.maxdepth,
+            c->stat.reqs, c->stat.cmds, c->stat.merged);
+  }
 }
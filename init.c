@@ -4,6 +4,7 @@
 #include "stat.h"
 #include "user.h"
 #include "fcntl.h"
+#include "param.h"
 
 char *argv[] = { "sh", 0 };
 
@@ -18,6 +19,16 @@ main(void)
   }
   dup(0);  // stdout
   dup(0);  // stderr
+  mknod("prof", 2, 0);  // profiler samples; fails if it exists
+  mknod("interrupts", 3, 0);  // interrupt counts, by CPU
+  mknod("swap", 4, 0);        // swap space statistics
+  mknod("stats", 5, 0);       // memory and cache counters
+  mkdir("/tmp");        // scratch files, kept in memory
+  if(mount("/tmp", TMPDEV) < 0)
+    printf(1, "init: cannot mount /tmp\n");
+  mkdir("/disk2");      // the second channel's disk, if any
+  if(mount("/disk2", 2) < 0)
+    unlink("/disk2");
 
   for(;;){
     printf(1, "init: starting sh\n");
@@ -0,0 +1,80 @@
+// intr: show how many interrupts each CPU has taken,
+// or change which CPUs take an interrupt.
+//
+//   intr            counts by IRQ, one column per CPU
+//   intr irq mask   send irq to the CPUs in mask, bit i for CPU i
+//
+// The counts come from the interrupts device; only the IRQs
+// that some CPU has taken are listed.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "param.h"
+#include "traps.h"
+#include "ioctl.h"
+
+uint count[NCPU][NIRQ];
+
+static char*
+name(int irq)
+{
+  switch(irq){
+  case IRQ_TIMER:    return "timer";
+  case IRQ_KBD:      return "kbd";
+  case IRQ_COM1:     return "com1";
+  case IRQ_IDE:      return "ide0";
+  case IRQ_IDE+1:    return "ide1";
+  case IRQ_ERROR:    return "error";
+  case IRQ_WAKE:     return "wake";
+  case IRQ_SPURIOUS: return "spurious";
+  }
+  return "";
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n, ncpu, irq, c;
+  uint tot;
+
+  if((fd = open("/interrupts", O_RDONLY)) < 0){
+    printf(2, "intr: cannot open /interrupts\n");
+    exit();
+  }
+  if(argc == 3){
+    if(ioctl(fd, INTRROUTE, atoi(argv[1]) | atoi(argv[2]) << 8) < 0)
+      printf(2, "intr: cannot route irq %s to cpus %s\n", argv[1], argv[2]);
+    exit();
+  }
+  if(argc != 1){
+    printf(2, "usage: intr [irq mask]\n");
+    exit();
+  }
+
+  n = read(fd, count, sizeof(count));
+  close(fd);
+  ncpu = n / sizeof(count[0]);
+  if(ncpu <= 0){
+    printf(2, "intr: read failed\n");
+    exit();
+  }
+
+  printf(1, "irq");
+  for(c = 0; c < ncpu; c++)
+    printf(1, "\tcpu%d", c);
+  printf(1, "\n");
+  for(irq = 0; irq < NIRQ; irq++){
+    tot = 0;
+    for(c = 0; c < ncpu; c++)
+      tot += count[c][irq];
+    if(tot == 0)
+      continue;
+    printf(1, "%d", irq);
+    for(c = 0; c < ncpu; c++)
+      printf(1, "\t%d", count[c][irq]);
+    printf(1, "\t%s\n", name(irq));
+  }
+  exit();
+}
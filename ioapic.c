@@ -1,10 +1,29 @@
 // The I/O APIC manages hardware interrupts for an SMP system.
 // http://www.intel.com/design/chipsets/datashts/29056601.pdf
 // See also picirq.c.
+//
+// Each interrupt goes to a set of CPUs, its affinity, given as
+// a mask with bit i for cpus[i].  The local APICs use flat
+// logical destination mode, in which lapicinit() gives each
+// CPU one bit of the eight, so the mask is also the
+// redirection entry's destination.  An interrupt with several
+// CPUs is delivered lowest-priority: the hardware picks one of
+// them, the one at lowest task priority.
+//
+// The interrupts device reports how many interrupts each CPU
+// has taken, and its INTRROUTE ioctl changes an affinity.
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "ioctl.h"
 
 #define IOAPIC  0xFEC00000   // Default physical address of IO APIC
 
@@ -21,8 +40,11 @@
 #define INT_LEVEL      0x00008000  // Level-triggered (vs edge-)
 #define INT_ACTIVELOW  0x00002000  // Active low (vs high)
 #define INT_LOGICAL    0x00000800  // Destination is CPU id (vs APIC ID)
+#define INT_LOWEST     0x00000100  // Lowest-priority delivery (vs fixed)
 
 volatile struct ioapic *ioapic;
+static struct spinlock ioapiclock;  // each access is two registers
+static int maxintr;
 
 // IO APIC MMIO structure: write reg, then read or write data.
 struct ioapic {
@@ -48,8 +70,9 @@ ioapicwrite(int reg, uint data)
 void
 ioapicinit(void)
 {
-  int i, id, maxintr;
+  int i, id;
 
+  initlock(&ioapiclock, "ioapic");
   ioapic = (volatile struct ioapic*)IOAPIC;
   maxintr = (ioapicread(REG_VER) >> 16) & 0xFF;
   id = ioapicread(REG_ID) >> 24;
@@ -64,12 +87,87 @@ ioapicinit(void)
   }
 }
 
+// Mark interrupt edge-triggered, active high, enabled,
+// and routed to the CPUs in mask.  Returns -1 if none of
+// them exists.
+int
+ioapicenable(int irq, uint mask)
+{
+  uint lo;
+
+  mask &= (1 << ncpu) - 1;
+  if(irq < 0 || irq > maxintr || mask == 0)
+    return -1;
+  lo = INT_LOGICAL | (T_IRQ0 + irq);
+  if(mask & (mask - 1))
+    lo |= INT_LOWEST;
+  acquire(&ioapiclock);
+  // Masked while the destination changes.
+  ioapicwrite(REG_TABLE+2*irq, INT_DISABLED | lo);
+  ioapicwrite(REG_TABLE+2*irq+1, mask << 24);
+  ioapicwrite(REG_TABLE+2*irq, lo);
+  release(&ioapiclock);
+  return 0;
+}
+
+// Is irq enabled?
+static int
+ioapicenabled(int irq)
+{
+  int on;
+
+  if(irq < 0 || irq > maxintr)
+    return 0;
+  acquire(&ioapiclock);
+  on = !(ioapicread(REG_TABLE+2*irq) & INT_DISABLED);
+  release(&ioapiclock);
+  return on;
+}
+
+// Copy each CPU's interrupt counts, NIRQ to a CPU,
+// as many as fit in n bytes.  Each read returns all of
+// them afresh.
+static int
+intrread(struct inode *ip, char *dst, int n)
+{
+  int c, m, tot;
+
+  tot = 0;
+  for(c = 0; c < ncpu && tot < n; c++){
+    m = sizeof(cpus[c].nintr);
+    if(m > n - tot)
+      m = n - tot;
+    memmove(dst + tot, cpus[c].nintr, m);
+    tot += m;
+  }
+  return tot;
+}
+
+static int
+intrwrite(struct inode *ip, char *src, int n)
+{
+  return -1;
+}
+
+// INTRROUTE sends IRQ arg & 0xFF to the CPUs in mask arg >> 8.
+// Only interrupts a driver has enabled can be moved.
+static int
+intrioctl(struct inode *ip, int req, int arg)
+{
+  int irq;
+
+  if(req != INTRROUTE)
+    return -1;
+  irq = arg & 0xFF;
+  if(!ioapicenabled(irq))
+    return -1;
+  return ioapicenable(irq, (uint)arg >> 8);
+}
+
 void
-ioapicenable(int irq, int cpunum)
+intrinit(void)
 {
-  // Mark interrupt edge-triggered, active high,
-  // enabled, and routed to the given cpunum,
-  // which happens to be that cpu's APIC ID.
-  ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
-  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+  devsw[INTR].read = intrread;
+  devsw[INTR].write = intrwrite;
+  devsw[INTR].ioctl = intrioctl;
 }
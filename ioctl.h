@@ -0,0 +1,5 @@
+// ioctl() requests.
+#define CONSRAW     1   // console: arg 1 for raw input, 0 for line editing
+#define PROFON      2   // prof: discard old samples and start sampling
+#define PROFOFF     3   // prof: stop sampling; returns samples dropped
+#define INTRROUTE   4   // interrupts: send IRQ arg&0xFF to CPU mask arg>>8
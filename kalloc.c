@@ -1,13 +1,24 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// pipe buffers, and slabs (see slab.c). Allocates 4096-byte pages.
+//
+// Free pages live on a global free list and in small per-CPU
+// caches.  A CPU allocates from and frees to its own cache with
+// interrupts disabled and no lock; only when the cache runs dry
+// or overflows does it move a batch of KBATCH pages to or from
+// the global list under kmem.lock.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
+#include "stats.h"
+
+#define KCACHE  32   // max pages in a per-CPU cache
+#define KBATCH  16   // pages moved between a cache and kmem at once
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -21,13 +32,41 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  int nfree;         // pages on freelist
+  int nreserved;     // pages promised by kreserve()
+  int npage;         // pages given to freerange()
 } kmem;
 
+// Per-CPU free-page cache.  Only touched by its own CPU,
+// with interrupts off.  Pages cached on other CPUs are not
+// visible to kalloc(), so at most ncpu*KCACHE pages can be
+// stranded when memory is almost exhausted.
+struct kcache {
+  struct run *freelist;
+  int n;             // pages on freelist
+  uint hits;         // kalloc()s served from the cache
+  uint refills;      // batches taken from kmem
+  uint drains;       // batches returned to kmem
+};
+static struct kcache kcache[NCPU];
+
+// Reference counts of physical pages, indexed by physical page
+// number.  kalloc() hands out a page with one reference;
+// copy-on-write fork adds more with kincref(), and kfree()
+// only puts the page back on the free list when the last
+// reference is dropped.  Updated with atomic instructions,
+// so no lock is needed.
+static ushort pgref[PHYSTOP/PGSIZE];
+
+#define PGREF(v) (&pgref[V2P(v)/PGSIZE])
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// The per-CPU caches are used only after kinit2(), once
+// cpuid() works on every CPU.
 void
 kinit1(void *vstart, void *vend)
 {
@@ -48,32 +87,91 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    *PGREF(p) = 1;
     kfree(p);
+    kmem.npage++;
+  }
+}
+
+// Move up to KBATCH pages from kmem to cache kc.
+// Interrupts must be off.
+static void
+krefill(struct kcache *kc)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KBATCH && (r = kmem.freelist) != 0; i++){
+    kmem.freelist = r->next;
+    kmem.nfree--;
+    r->next = kc->freelist;
+    kc->freelist = r;
+    kc->n++;
+  }
+  release(&kmem.lock);
+  kc->refills++;
+}
+
+// Move KBATCH pages from cache kc back to kmem.
+// Interrupts must be off.
+static void
+kdrain(struct kcache *kc)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < KBATCH && (r = kc->freelist) != 0; i++){
+    kc->freelist = r->next;
+    kc->n--;
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    kmem.nfree++;
+  }
+  release(&kmem.lock);
+  kc->drains++;
 }
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference goes away.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *kc;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if(*PGREF(v) == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(PGREF(v), 1) > 0)
+    return;
 
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    kmem.nfree++;
+    return;
+  }
+
+  pushcli();
+  kc = &kcache[cpuid()];
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->n++;
+  if(kc->n > KCACHE)
+    kdrain(kc);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +181,123 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+    }
+  } else {
+    pushcli();
+    kc = &kcache[cpuid()];
+    if(kc->freelist)
+      kc->hits++;
+    else
+      krefill(kc);
+    r = kc->freelist;
+    if(r){
+      kc->freelist = r->next;
+      kc->n--;
+    }
+    popcli();
+  }
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    *PGREF(r) = 1;
   return (char*)r;
 }
 
+// Number of free pages, including those in per-CPU caches.
+// No lock: the count is only a hint.
+int
+kfreepages(void)
+{
+  int i, nfree;
+
+  nfree = kmem.nfree;
+  for(i = 0; i < ncpu; i++)
+    nfree += kcache[i].n;
+  return nfree;
+}
+
+// Reservations let memory be promised now and allocated on
+// first touch (see lazyuvm() in vm.c).  kreserve() refuses to
+// promise more pages than are free, less a margin for page
+// tables, kernel stacks, and pages stranded in per-CPU caches.
+// Free swap slots count as free pages, since swapout() can
+// make room for a page by writing another to one.
+// The caller kunreserve()s each page once it has kalloc()ed it,
+// or when it gives the promise up.
+#define KSLACK  (NCPU*KCACHE + 64)
+
+int
+kreserve(int n)
+{
+  int nfree;
+
+  acquire(&kmem.lock);
+  nfree = kfreepages() + swapfree();
+  if(nfree - kmem.nreserved - n < KSLACK){
+    release(&kmem.lock);
+    return -1;
+  }
+  kmem.nreserved += n;
+  release(&kmem.lock);
+  return 0;
+}
+
+void
+kunreserve(int n)
+{
+  acquire(&kmem.lock);
+  kmem.nreserved -= n;
+  if(kmem.nreserved < 0)
+    panic("kunreserve");
+  release(&kmem.lock);
+}
+
+// Add a reference to the allocated page pointed at by v.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+  if(__sync_fetch_and_add(PGREF(v), 1) == 0)
+    panic("kincref: free page");
+}
+
+// Return the number of references to the page pointed at by v.
+int
+krefcnt(char *v)
+{
+  return *PGREF(v);
+}
+
+// Fill in st's page counts.  No lock: they are only a snapshot.
+void
+kallocstat(struct sysstat *st)
+{
+  st->npage = kmem.npage;
+  st->nfree = kfreepages();
+  st->nreserved = kmem.nreserved;
+}
+
+// Print free-page counts and per-CPU cache hit rates.
+// Runs when user types ^P on console.
+// No lock to avoid wedging a stuck machine further.
+void
+kallocdump(void)
+{
+  struct kcache *kc;
+  uint total;
+  int i;
+
+  cprintf("kmem: %d free pages in pool, %d reserved\n", kmem.nfree, kmem.nreserved);
+  for(i = 0; i < ncpu; i++){
+    kc = &kcache[i];
+    total = kc->hits + kc->refills;
+    cprintf("cpu%d: %d cached, %d/%d allocs from cache, %d refills, %d drains\n",
+            i, kc->n, kc->hits, total, kc->refills, kc->drains);
+  }
+}
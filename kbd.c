@@ -2,20 +2,24 @@
 #include "x86.h"
 #include "defs.h"
 #include "kbd.h"
+#include "ring.h"
 
-int
+static struct ring kbd;  // scan codes, from kbdintr() to kbdrecv()
+
+// Translate the next queued scan code.
+static int
 kbdgetc(void)
 {
   static uint shift;
   static uchar *charcode[4] = {
     normalmap, shiftmap, ctlmap, ctlmap
   };
-  uint st, data, c;
+  int code;
+  uint data, c;
 
-  st = inb(KBSTATP);
-  if((st & KBS_DIB) == 0)
+  if((code = ringget(&kbd)) < 0)
     return -1;
-  data = inb(KBDATAP);
+  data = code;
 
   if(data == 0xE0){
     shift |= E0ESC;
@@ -43,8 +47,18 @@ kbdgetc(void)
   return c;
 }
 
+// Hand the keys kbdintr() queued to the console.
+// Called by its bottom half, consd.
 void
-kbdintr(void)
+kbdrecv(void)
 {
   consoleintr(kbdgetc);
 }
+
+void
+kbdintr(void)
+{
+  while(inb(KBSTATP) & KBS_DIB)
+    ringput(&kbd, inb(KBDATAP));
+  consolekick();
+}
@@ -17,6 +17,9 @@
 #define EOI     (0x00B0/4)   // EOI
 #define SVR     (0x00F0/4)   // Spurious Interrupt Vector
   #define ENABLE     0x00000100   // Unit Enable
+#define LDR     (0x00D0/4)   // Logical Destination
+#define DFR     (0x00E0/4)   // Destination Format
+  #define FLAT       0xFFFFFFFF   // flat model: one bit per CPU
 #define ESR     (0x0280/4)   // Error Status
 #define ICRLO   (0x0300/4)   // Interrupt Command
   #define INIT       0x00000500   // INIT/RESET
@@ -32,6 +35,7 @@
 #define TIMER   (0x0320/4)   // Local Vector Table 0 (TIMER)
   #define X1         0x0000000B   // divide counts by 1
   #define PERIODIC   0x00020000   // Periodic
+  #define ONESHOT    0x00000000   // One-shot
 #define PCINT   (0x0340/4)   // Performance Counter LVT
 #define LINT0   (0x0350/4)   // Local Vector Table 1 (LINT0)
 #define LINT1   (0x0360/4)   // Local Vector Table 2 (LINT1)
@@ -43,6 +47,28 @@
 
 volatile uint *lapic;  // Initialized in mp.c
 
+// Timer counts per tick, and TSC cycles per millisecond,
+// measured by calibrate().
+static uint tickcount;
+uint tsckhz;
+
+// For nanotime(): the TSC at calibration, and nanoseconds
+// per TSC cycle in 4.28 fixed point.
+uint64 tsc0;
+uint nspercycle;
+
+// Divide n by d, for a quotient known to fit in 32 bits.
+// (The kernel has no libgcc for 64-bit division.)
+static inline uint
+div64(uint64 n, uint d)
+{
+  uint q, r;
+
+  asm("divl %4" : "=a" (q), "=d" (r) : "a" ((uint)n), "d" ((uint)(n >> 32)),
+      "rm" (d));
+  return q;
+}
+
 //PAGEBREAK!
 static void
 lapicw(int index, int value)
@@ -51,6 +77,70 @@ lapicw(int index, int value)
   lapic[ID];  // wait for write to finish, by reading
 }
 
+#define PIT_HZ    1193182   // PIT input clock
+#define PIT_CTL   0x43
+#define PIT_CH2   0x42
+#define PIT_GATE  0x61        // bit 0: channel 2 gate; bit 5: its output
+#define CALMS     10          // calibration interval, milliseconds
+
+// Measure the timer's and the TSC's rates against the PIT,
+// by letting channel 2 count down for CALMS milliseconds.
+// Falls back to the old fixed count if the PIT never fires.
+static void
+calibrate(void)
+{
+  uint n, t0, count;
+  int i;
+
+  lapicw(TDCR, X1);
+  lapicw(TIMER, MASKED | ONESHOT | (T_IRQ0 + IRQ_TIMER));
+
+  outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);  // gate on, speaker off
+  outb(PIT_CTL, 0xB0);   // channel 2, low then high byte, mode 0
+  n = PIT_HZ / (1000 / CALMS);
+  outb(PIT_CH2, n & 0xFF);
+  outb(PIT_CH2, n >> 8);
+  lapicw(TICR, 0xFFFFFFFF);
+  t0 = rdtsc();
+  for(i = 0; (inb(PIT_GATE) & 0x20) == 0; i++){
+    if(i == 10000000){
+      tickcount = 10000000;
+      return;
+    }
+  }
+  count = 0xFFFFFFFF - lapic[TCCR];
+  tsckhz = (rdtsc() - t0) / CALMS;
+  tickcount = count / CALMS * 1000 / HZ;
+  if(tsckhz > 1000000 >> 4){  // else nspercycle would overflow
+    tsc0 = rdtsc64();
+    nspercycle = div64((uint64)1000000 << 28, tsckhz);
+  }
+}
+
+// Nanoseconds since boot, from the TSC if calibrate()
+// measured it, else from the tick count.
+uint64
+nanotime(void)
+{
+  uint64 c;
+
+  if(nspercycle == 0)
+    return (uint64)ticks * (1000000000 / HZ);
+  c = rdtsc64() - tsc0;
+  // c * nspercycle >> 28, without losing the high bits.
+  return ((uint64)(uint)(c >> 32) * nspercycle << 4) +
+         ((uint64)(uint)c * nspercycle >> 28);
+}
+
+// Have the timer interrupt HZ times a second.
+static void
+timerperiodic(void)
+{
+  lapicw(TDCR, X1);
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, tickcount);
+}
+
 void
 lapicinit(void)
 {
@@ -60,13 +150,18 @@ lapicinit(void)
   // Enable local APIC; set spurious interrupt vector.
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
+  // Answer to logical destination bit cpuid(), so that the
+  // I/O APIC can route an interrupt to a set of CPUs.
+  lapicw(DFR, FLAT);
+  lapicw(LDR, (1 << cpuid()) << 24);
+
   // The timer repeatedly counts down at bus frequency
   // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
-  lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  // The first CPU to get here calibrates it, before the
+  // others are started.
+  if(tickcount == 0)
+    calibrate();
+  timerperiodic();
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -113,6 +208,43 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Tickless idle.  Only CPU 0 counts ticks, so the others can
+// stop their timers while they have nothing to run; another
+// CPU that gives them work wakes them with lapicwake().  A
+// one-shot interrupt after IDLETICKS ticks is a backstop.
+#define IDLETICKS 100
+
+// Called by an idle CPU other than CPU 0 before it halts.
+void
+lapicidle(void)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, ONESHOT | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, tickcount * IDLETICKS);
+}
+
+// Called by a CPU that has stopped idling.
+void
+lapicbusy(void)
+{
+  if(!lapic)
+    return;
+  timerperiodic();
+}
+
+// Interrupt the CPU with APIC ID apicid, to wake it from hlt.
+void
+lapicwake(uchar apicid)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | (T_IRQ0 + IRQ_WAKE));
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
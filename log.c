@@ -5,6 +5,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "stats.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -16,64 +17,164 @@
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
+// the count of in-progress FS system calls and reserves
+// MAXOPBLOCKS of log space for it.
+// But if the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// A large write can instead call begin_opmax() to reserve
+// as much of the free log space as it can use.
+//
+// The last end_op() copies the transaction's blocks into
+// private buffers and starts a new, empty transaction before
+// writing anything, so new FS system calls proceed while the
+// commit is on its way to disk.  At most one commit is
+// writing at a time; the committer takes the next
+// transaction too if it is ready when it finishes.
+//
+// A commit only appends the transaction to the log; its
+// blocks stay pinned in the buffer cache, and committed
+// transactions pile up in the log behind one header.  Once
+// half the log is used, or begin_op() finds too little of it
+// free, the flusher thread checkpoints: it writes the newest
+// logged copy of each block to its home location, in block
+// order, clears the log and unpins the blocks.  A checkpoint
+// excludes commits, as a commit excludes other commits.
 //
 // The log is a physical re-do log containing disk blocks.
+// There is one log, on the root disk, for the blocks of all
+// disks, so a transaction can span file systems; each block
+// is named by a key holding its device and block number.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+//   LOGHDR header blocks, containing a count, a checksum,
+//     the count and checksum before the last commit, and
+//     then keys for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A block logged by several transactions appears once for each,
+// and recovery replays the log in order, so the newest wins.
+//
+// The checksum covers the keys and contents of the first
+// count blocks, so a commit writes its blocks and the header
+// in one batch, in any order, and waits once.  If the system
+// crashes before the batch is all on disk, the checksum does
+// not match, and recovery falls back to the log as it was
+// before that commit, which must have been on disk already.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint sum;             // checksum of the n blocks
+  int block[LOGSIZE];   // keys
 };
 
+#define SUMSEED 2166136261U
+
+// Add a logged block, its key and its contents, to checksum s.
+// This is FNV-1a with a word at a time instead of a byte.
+static uint
+checksum(uint s, int key, uchar *data)
+{
+  uint *w;
+
+  s = (s ^ key) * 16777619;
+  for (w = (uint*)data; w < (uint*)(data + BSIZE); w++)
+    s = (s ^ *w) * 16777619;
+  return s;
+}
+
+#define LOGKEY(dev, b)  ((dev)<<24 | (b))
+#define KEYDEV(k)       ((uint)(k) >> 24)
+#define KEYBNO(k)       ((k) & 0xffffff)
+
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // data blocks in the log, at most LOGSIZE
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by them.
+  int snapshot;    // commit() is copying blocks, please wait.
+  int committing;  // a commit or checkpoint is in progress.
+  int checkpoint;  // the flusher should checkpoint.
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // transaction being accumulated
+  struct logheader clh;  // transactions in the log
+  int maxused;     // most blocks clh has held
+  uint ncommit;    // transactions committed
+  uint ncheckpoint;
+  uint nwait;      // begin_opmax()s that waited for space
 };
 struct log log;
 
+// Copies of the logged blocks, logbuf[i] of the one in log
+// slot i.  They are written first to the log and, at the next
+// checkpoint, to their home locations, so later transactions
+// can change the cached blocks meanwhile.  Only the committer
+// and the flusher use them; they are not in the buffer cache.
+static struct buf logbuf[LOGSIZE];
+
 static void recover_from_log(void);
-static void commit();
+static void commit(void);
+static void flusher(void);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
-
   struct superblock sb;
+  int i;
+
   initlock(&log.lock, "log");
+  for (i = 0; i < LOGSIZE; i++)
+    initsleeplock(&logbuf[i].lock, "logbuf");
   readsb(dev, &sb);
   log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.size = sb.nlog - LOGHDR;
+  if (log.size > LOGSIZE)
+    log.size = LOGSIZE;
+  if (log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
   recover_from_log();
+  kthread("logflush", flusher);
+}
+
+// How many of the logged blocks did a commit finish writing?
+// All n if their checksum is sum, else the pn that were
+// there before the last commit, if their checksum is psum.
+static int
+check_trans(int pn, uint psum)
+{
+  struct buf *lbuf;
+  uint s;
+  int tail, good;
+
+  good = 0;
+  s = SUMSEED;
+  for (tail = 0; ; tail++) {
+    if (tail == pn && s == psum)
+      good = pn;
+    if (tail == log.clh.n)
+      break;
+    lbuf = bread(log.dev, log.start+LOGHDR+tail);
+    s = checksum(s, log.clh.block[tail], lbuf->data);
+    brelse(lbuf);
+  }
+  return s == log.clh.sum ? log.clh.n : good;
 }
 
 // Copy committed blocks from log to their home location
+// via the buffer cache.  Used only during recovery.
 static void
-install_trans(void)
+recover_trans(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *lbuf = bread(log.dev, log.start+LOGHDR+tail); // read log block
+    struct buf *dbuf = bread(KEYDEV(log.clh.block[tail]),
+                             KEYBNO(log.clh.block[tail])); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
     brelse(lbuf);
@@ -81,123 +182,343 @@ install_trans(void)
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// The header is an array of ints spread over LOGHDR blocks:
+// the LOGHDRWORDS words described above, then the keys.
+#define HPB (BSIZE / sizeof(int))   // header words per block
+
+// Read the log header from disk into the in-memory log header,
+// and return the count and checksum before the last commit.
 static void
-read_head(void)
+read_head(int *pn, uint *psum)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
-  }
+  struct buf *buf;
+  int *w, h, k;
+
+  buf = bread(log.dev, log.start);
+  w = (int*)buf->data;
+  log.clh.n = w[0];
+  log.clh.sum = w[1];
+  *pn = w[2];
+  *psum = w[3];
   brelse(buf);
+  if (log.clh.n < 0 || log.clh.n > log.size || *pn < 0 || *pn > log.clh.n)
+    panic("read_head: bad log header");
+  for (h = 0; h <= (log.clh.n + LOGHDRWORDS - 1) / HPB; h++) {
+    buf = bread(log.dev, log.start+h);
+    w = (int*)buf->data;
+    for (k = h*HPB; k < (h+1)*HPB && k < log.clh.n + LOGHDRWORDS; k++)
+      if (k >= LOGHDRWORDS)
+        log.clh.block[k-LOGHDRWORDS] = w[k - h*HPB];
+    brelse(buf);
+  }
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
-static void
-write_head(void)
+// Lock the header blocks into hb, which must have room for
+// LOGHDR, and fill them in for the first n blocks of clh, with
+// checksum sum, or the first pn, with checksum psum.
+// Returns how many blocks there are.
+static int
+fill_head(struct buf **hb, int n, uint sum, int pn, uint psum)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  int *w, h, k;
+  int hw[LOGHDRWORDS];
+
+  hw[0] = n;
+  hw[1] = sum;
+  hw[2] = pn;
+  hw[3] = psum;
+  for (h = 0; h <= (n + LOGHDRWORDS - 1) / HPB; h++) {
+    hb[h] = bclear(log.dev, log.start+h);
+    w = (int*)hb[h]->data;
+    for (k = h*HPB; k < (h+1)*HPB && k < n + LOGHDRWORDS; k++)
+      w[k - h*HPB] = k < LOGHDRWORDS ? hw[k] : log.clh.block[k-LOGHDRWORDS];
+    hb[h]->flags |= B_DIRTY;
   }
-  bwrite(buf);
-  brelse(buf);
+  return h;
+}
+
+// Write the header of an empty log to disk.
+static void
+clear_head(void)
+{
+  struct buf *hb[LOGHDR];
+
+  fill_head(hb, 0, SUMSEED, 0, SUMSEED);
+  iderw(hb[0]);
+  brelse(hb[0]);
 }
 
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  int pn;
+  uint psum;
+
+  read_head(&pn, &psum);
+  log.clh.n = check_trans(pn, psum);
+  recover_trans(); // if committed, copy from log to disk
+  clear_head();    // clear the log
+  log.clh.n = 0;
+  log.clh.sum = SUMSEED;
 }
 
-// called at the start of each FS system call.
-void
-begin_op(void)
+// Ask the flusher to checkpoint, unless the log is empty.
+// Caller must hold log.lock.
+static void
+wantcheckpoint(void)
 {
+  if (log.clh.n > 0 && !log.checkpoint) {
+    log.checkpoint = 1;
+    wakeup(&log.checkpoint);
+  }
+}
+
+// Start an FS operation that may log up to want blocks.
+// Waits until at least MAXOPBLOCKS are free, and reserves
+// as many of the free blocks, up to want, as there are.
+// Returns the number reserved, which the caller must pass
+// to end_opmax().
+int
+begin_opmax(int want)
+{
+  int n, waited;
+
+  if(want < MAXOPBLOCKS)
+    want = MAXOPBLOCKS;
+  waited = 0;
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    n = log.size - log.clh.n - log.lh.n - log.reserved;
+    if(log.snapshot){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(n < MAXOPBLOCKS){
+      // this op might exhaust log space; wait for commit
+      // or checkpoint.
+      if(!waited){
+        waited = 1;
+        log.nwait++;
+      }
+      wantcheckpoint();
       sleep(&log, &log.lock);
     } else {
+      if(n > want)
+        n = want;
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
-      break;
+      return n;
     }
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opmax(MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  end_opmax(MAXOPBLOCKS);
+}
 
+// End an FS operation that reserved n log blocks.
+// Commits if this was the last outstanding operation
+// and no commit is already in progress.
+void
+end_opmax(int n)
+{
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
+  log.reserved -= n;
+  if(log.outstanding == 0 && !log.committing && log.lh.n > 0){
     log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    commit();
   }
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
+// Append the accumulated transaction to clh, copy its
+// blocks into logbuf, add them to the checksum, and start
+// a new one.  No FS system calls are active.  Returns the
+// first slot it fills.
+static int
+snapshot(void)
+{
+  struct buf *from;
+  int i, start;
+
+  log.snapshot = 1;
+  start = log.clh.n;
+  for (i = 0; i < log.lh.n; i++)
+    log.clh.block[start+i] = log.lh.block[i];
+  log.clh.n += log.lh.n;
+  log.lh.n = 0;
+  release(&log.lock);
+
+  for (i = start; i < log.clh.n; i++) {
+    from = bread(KEYDEV(log.clh.block[i]), KEYBNO(log.clh.block[i]));
+    memmove(logbuf[i].data, from->data, BSIZE);
+    brelse(from);
+    log.clh.sum = checksum(log.clh.sum, log.clh.block[i], logbuf[i].data);
+  }
+
+  acquire(&log.lock);
+  log.snapshot = 0;
+  wakeup(&log);
+  release(&log.lock);
+  return start;
+}
+
+// Write the copied blocks from slot start on to the log, and
+// the header for them, in one batch.  The log before them had
+// checksum psum.  Once this returns, the transaction is
+// committed.
+static void
+write_log(int start, uint psum)
+{
+  static struct buf *batch[LOGSIZE + LOGHDR];
+  int tail, n, i;
+
+  n = 0;
+  for (tail = start; tail < log.clh.n; tail++) {
+    acquiresleep(&logbuf[tail].lock);
+    logbuf[tail].dev = log.dev;
+    logbuf[tail].blockno = log.start+LOGHDR+tail;
+    logbuf[tail].flags = B_DIRTY;
+    batch[n++] = &logbuf[tail];
+  }
+  n += fill_head(batch + n, log.clh.n, log.clh.sum, start, psum);
+  iderwv(batch, n);
+  for (i = 0; i < n; i++) {
+    if (batch[i] >= logbuf && batch[i] < logbuf+LOGSIZE)
+      releasesleep(&batch[i]->lock);
+    else
+      brelse(batch[i]);
+  }
+}
+
+// Slots of the newest copy of each logged block, by key.
+static int order[LOGSIZE];
+
+// Write the newest copy of each logged block to its home
+// location, in block order, so that the disk head sweeps
+// across each disk once.  Returns the number of blocks.
+static int
+install_trans(void)
+{
+  int i, j, n, tail;
+
+  n = 0;
+  for (tail = log.clh.n - 1; tail >= 0; tail--) {
+    for (j = 0; j < n; j++)
+      if (log.clh.block[order[j]] == log.clh.block[tail])
+        break;
+    if (j < n)
+      continue;   // an older copy
+    for (i = n++; i > 0 && log.clh.block[order[i-1]] > log.clh.block[tail]; i--)
+      order[i] = order[i-1];
+    order[i] = tail;
+  }
+
+  for (i = 0; i < n; i++) {
+    tail = order[i];
+    acquiresleep(&logbuf[tail].lock);
+    logbuf[tail].dev = KEYDEV(log.clh.block[tail]);
+    logbuf[tail].blockno = KEYBNO(log.clh.block[tail]);
+    logbuf[tail].flags = B_DIRTY;
+    iderw(&logbuf[tail]);
+    releasesleep(&logbuf[tail].lock);
+  }
+  return n;
+}
+
+// Let the cache evict the n installed blocks again,
+// unless the new transaction has logged them since.
+// None can be in the middle of a log_write(): that
+// happens with the block's sleep-lock held.
+static void
+unpin_trans(int n)
+{
+  struct buf *b;
+  int key, j, i;
+
+  for (j = 0; j < n; j++) {
+    key = log.clh.block[order[j]];
+    b = bread(KEYDEV(key), KEYBNO(key));
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    for (i = 0; i < log.lh.n; i++) {
+      if (log.lh.block[i] == key)
+        break;
+    }
+    if (i == log.lh.n)
+      b->flags &= ~B_DIRTY;
     release(&log.lock);
+    brelse(b);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Commit transactions until there is none ready.
+// Called with log.lock held and log.committing set;
+// returns with log.lock held and log.committing clear.
+// The lock is dropped while copying and writing,
+// since not allowed to sleep with locks.
 static void
-write_log(void)
+commit(void)
 {
-  int tail;
+  int start;
+  uint psum;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  while (log.outstanding == 0 && log.lh.n > 0) {
+    psum = log.clh.sum;
+    start = snapshot(); // Copy the transaction, start the next one
+    write_log(start, psum); // Append the copies and header -- the real commit
+    acquire(&log.lock);
+    log.ncommit++;
+    if (log.clh.n > log.maxused)
+      log.maxused = log.clh.n;
+    if (log.clh.n > log.size / 2)
+      wantcheckpoint();
+    wakeup(&log);
   }
+  log.committing = 0;
+  if (log.checkpoint)
+    wakeup(&log.checkpoint);
 }
 
+// The flusher thread: checkpoint whenever asked to.
+// Transactions that end meanwhile wait, and the
+// flusher commits them afterwards.
 static void
-commit()
+flusher(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int n;
+
+  acquire(&log.lock);
+  for (;;) {
+    while (!log.checkpoint || log.committing)
+      sleep(&log.checkpoint, &log.lock);
+    log.checkpoint = 0;
+    log.committing = 1;
+    log.ncheckpoint++;
+    release(&log.lock);
+
+    n = install_trans(); // Write the newest copies home
+    clear_head();        // Erase the transactions from the log
+    unpin_trans(n);
+
+    acquire(&log.lock);
+    log.clh.n = 0;
+    log.clh.sum = SUMSEED;
+    commit();
+    wakeup(&log);
   }
 }
 
@@ -213,22 +534,36 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
+  int i, key;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
+  key = LOGKEY(b->dev, b->blockno);
   acquire(&log.lock);
   for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+    if (log.lh.block[i] == key)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
+  log.lh.block[i] = key;
   if (i == log.lh.n)
     log.lh.n++;
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
 
+// Fill in st's log counters.
+void
+logstat(struct sysstat *st)
+{
+  acquire(&log.lock);
+  st->logsize = log.size;
+  st->logused = log.clh.n + log.lh.n;
+  st->logmax = log.maxused;
+  st->ncommit = log.ncommit;
+  st->ncheckpoint = log.ncheckpoint;
+  st->nlogwait = log.nwait;
+  release(&log.lock);
+}
@@ -8,35 +8,99 @@
 
 static void startothers(void);
 static void mpmain(void)  __attribute__((noreturn));
+static void bootmark(char*);
+static void bootreport(void);
 extern pde_t *kpgdir;
 extern char end[]; // first address after kernel loaded from ELF file
 
+// Boot-phase timestamps, taken by bootmark() at the end of each
+// phase and printed by bootreport() once the TSC's rate is known.
+// The first phase starts when bootmain() does; under another
+// boot loader its time is meaningless.
+#define NBOOTMARK 10
+static uint boottsc;
+static struct {
+  char *name;
+  uint tsc;      // low 32 bits of the TSC
+} marks[NBOOTMARK];
+static int nmark;
+
 // Bootstrap processor starts running C code here.
 // Allocate a real stack and switch to it, first
 // doing some setup required for memory allocator to work.
 int
 main(void)
 {
+  boottsc = *(uint*)P2V(BOOTTSC);
+  bootmark("loader");
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
+  kminit();        // slab allocator
+  bootmark("memory");
   mpinit();        // detect other processors
   lapicinit();     // interrupt controller
   seginit();       // segment descriptors
   picinit();       // disable pic
   ioapicinit();    // another interrupt controller
+  bootmark("interrupts");
   consoleinit();   // console hardware
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
+  profinit();      // sampling profiler
+  intrinit();      // interrupt counts and affinity
+  statsinit();     // memory and cache counters
+  traceinit();     // system call statistics
+  futexinit();     // futex wait table
+  shminit();       // shared memory segments
   binit();         // buffer cache
   fileinit();      // file table
+  pipeinit();      // pipe cache
+  pcinit();        // mmap page cache
+  tmpinit();       // in-memory file system
+  trieinit();      // root directory names, for completion
+  uinfoinit();     // clock page for user programs
+  bootmark("kernel");
   ideinit();       // disk 
+  bootmark("disk");
   startothers();   // start other processors
+  bootmark("cpus");
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  bootmark("freemem");
   userinit();      // first user process
+  bootreport();
   mpmain();        // finish this processor's setup
 }
 
+static void
+bootmark(char *name)
+{
+  if(nmark < NBOOTMARK){
+    marks[nmark].name = name;
+    marks[nmark].tsc = rdtsc();
+    nmark++;
+  }
+}
+
+// Print each phase's time, in microseconds if the TSC
+// was calibrated, else in cycles.
+static void
+bootreport(void)
+{
+  uint mhz, prev, t;
+  int i;
+
+  mhz = tsckhz / 1000;
+  prev = boottsc;
+  cprintf("boot:");
+  for(i = 0; i < nmark; i++){
+    t = marks[i].tsc - prev;
+    prev = marks[i].tsc;
+    cprintf(" %s %d%s", marks[i].name, mhz ? t / mhz : t, mhz ? "us" : "");
+  }
+  cprintf("\n");
+}
+
 // Other CPUs jump here from entryother.S.
 static void
 mpenter(void)
@@ -72,9 +136,10 @@ static void
 startothers(void)
 {
   extern uchar _binary_entryother_start[], _binary_entryother_size[];
+  static char *stacks[NCPU];
   uchar *code;
   struct cpu *c;
-  char *stack;
+  int n;
 
   // Write entry code to unused memory at 0x7000.
   // The linker has placed the image of entryother.S in
@@ -82,24 +147,28 @@ startothers(void)
   code = P2V(0x7000);
   memmove(code, _binary_entryother_start, (uint)_binary_entryother_size);
 
-  for(c = cpus; c < cpus+ncpu; c++){
-    if(c == mycpu())  // We've started already.
-      continue;
-
-    // Tell entryother.S what stack to use, where to enter, and what
-    // pgdir to use. We cannot use kpgdir yet, because the AP processor
-    // is running in low  memory, so we use entrypgdir for the APs too.
-    stack = kalloc();
-    *(void**)(code-4) = stack + KSTACKSIZE;
-    *(void(**)(void))(code-8) = mpenter;
-    *(int**)(code-12) = (void *) V2P(entrypgdir);
-
-    lapicstartap(c->apicid, V2P(code));
-
-    // wait for cpu to finish mpmain()
-    while(c->started == 0)
+  // Tell entryother.S what stacks to use, where to enter, and what
+  // pgdir to use. We cannot use kpgdir yet, because the AP processor
+  // is running in low  memory, so we use entrypgdir for the APs too.
+  // Each AP takes a stack by incrementing code-16, so all of them
+  // can be started at once.
+  n = 0;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c != mycpu())  // We've started already.
+      stacks[n++] = kalloc() + KSTACKSIZE;
+  *(char***)(code-4) = stacks;
+  *(void(**)(void))(code-8) = mpenter;
+  *(int**)(code-12) = (void *) V2P(entrypgdir);
+  *(uint*)(code-16) = 0;
+
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(c != mycpu())
+      lapicstartap(c->apicid, V2P(code));
+
+  // wait for every cpu to finish mpmain()
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(c != mycpu() && c->started == 0)
       ;
-  }
 }
 
 // The boot page table used in entry.S and entryother.S.
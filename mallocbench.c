@@ -0,0 +1,161 @@
+// Time malloc() and free() against the first-fit allocator
+// they replaced, which is kept here for comparison.
+//
+// The "parse" workload allocates many small nodes and frees
+// them together, the way sh builds and drops each command's
+// tree; "mixed" frees and allocates blocks of random sizes
+// in random order.  Each runs in a child of its own, so the
+// two allocators never share a heap.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+static void
+krfree(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+krmorecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  krfree((void*)(hp + 1));
+  return freep;
+}
+
+static void*
+krmalloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = krmorecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+#define NSLOT   512
+#define ROUNDS  200
+
+void *slot[NSLOT];
+uint seed = 1;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+void
+parse(void *(*alloc)(uint), void (*dealloc)(void*))
+{
+  int i, r;
+
+  for(r = 0; r < ROUNDS; r++){
+    for(i = 0; i < NSLOT; i++)
+      slot[i] = alloc(16 + rand() % 100);
+    for(i = 0; i < NSLOT; i++)
+      dealloc(slot[i]);
+  }
+}
+
+void
+mixed(void *(*alloc)(uint), void (*dealloc)(void*))
+{
+  int i, n;
+
+  for(i = 0; i < ROUNDS*NSLOT; i++){
+    n = rand() % NSLOT;
+    if(slot[n]){
+      dealloc(slot[n]);
+      slot[n] = 0;
+    } else
+      slot[n] = alloc(rand() % 4096);
+  }
+}
+
+void
+run(char *name, void (*work)(void*(*)(uint), void(*)(void*)),
+    void *(*alloc)(uint), void (*dealloc)(void*))
+{
+  int t;
+
+  if(fork() == 0){
+    t = uptime();
+    work(alloc, dealloc);
+    printf(1, "%s: %d ticks\n", name, uptime() - t);
+    exit();
+  }
+  wait();
+}
+
+int
+main(int argc, char *argv[])
+{
+  run("parse, malloc", parse, malloc, free);
+  run("parse, first-fit", parse, krmalloc, krfree);
+  run("mixed, malloc", mixed, malloc, free);
+  run("mixed, first-fit", mixed, krmalloc, krfree);
+  exit();
+}
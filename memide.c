@@ -13,7 +13,7 @@
 #include "fs.h"
 #include "buf.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_fsmem_img_start[], _binary_fsmem_img_size[];
 
 static int disksize;
 static uchar *memdisk;
@@ -21,17 +21,24 @@ static uchar *memdisk;
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  memdisk = _binary_fsmem_img_start;
+  disksize = (uint)_binary_fsmem_img_size/BSIZE;
 }
 
 // Interrupt handler.
 void
-ideintr(void)
+ideintr(int ch)
 {
   // no-op
 }
 
+// Only disk 1 is in memory.
+int
+idepresent(int dev)
+{
+  return dev == 1;
+}
+
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
@@ -57,4 +64,21 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  if(b->flags & B_ASYNC)
+    bdone(b);
+}
+
+// Sync n bufs with disk.
+void
+iderwv(struct buf **bp, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderw(bp[i]);
+}
+
+void
+idedump(void)
+{
 }
@@ -1,5 +1,6 @@
 // Memory layout
 
+#define BOOTTSC 0x7E00              // bootmain() leaves its TSC, low 32 bits, here
 #define EXTMEM  0x100000            // Start of extended memory
 #define PHYSTOP 0xE000000           // Top physical memory
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #define stat xv6_stat  // avoid clash with host struct stat
 #include "types.h"
@@ -15,31 +16,37 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
-
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+// [ boot block | sb block | log | inode blocks | free bit map | swap | data blocks ]
+//
+// The image is built in memory, mapped from the output file,
+// so that blocks are written with memmove() rather than a
+// system call each.  Every file gets one contiguous run of
+// data blocks, followed by its indirect blocks, sized from
+// the file's length before any of it is copied, and its
+// contents are read straight into place.  The free bit map
+// is filled in once, at the end.
+
+int fssize = FSSIZE;  // -s overrides
+int ninodes = 200;    // -i overrides
+int nlog = LOGHDR+LOGSIZE;  // header + data blocks; -l overrides
+int nswap = 0;        // swap blocks, whole pages; -w overrides
+int nbitmap;
+int ninodeblocks;
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap, swap)
 int nblocks;  // Number of data blocks
 
-int fsfd;
+uchar *img;
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
+#define BLK(b) (img + (b)*BSIZE)
+#define PGBLOCKS (4096/BSIZE)  // blocks in a page, a slot of swap
 
-void balloc(int);
-void wsect(uint, void*);
-void winode(uint, struct dinode*);
-void rinode(uint inum, struct dinode *ip);
-void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
-void iappend(uint inum, void *p, int n);
+uint iextent(uint inum, uint size);
+void balloc(int);
 
 // convert to intel byte order
 ushort
@@ -67,65 +74,112 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
-  char buf[BSIZE];
-  struct dinode din;
-
+  int i, fd, fsfd, nde, cc;
+  uint rootino, size, b, off;
+  off_t len;
+  struct dirent *de;
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  while(argc > 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-l") == 0)
+      nlog = atoi(argv[2]);
+    else if(strcmp(argv[1], "-s") == 0)
+      fssize = atoi(argv[2]);
+    else if(strcmp(argv[1], "-i") == 0)
+      ninodes = atoi(argv[2]);
+    else if(strcmp(argv[1], "-w") == 0)
+      nswap = atoi(argv[2]);
+    else
+      break;
+    argv += 2;
+    argc -= 2;
+  }
+
+  if(argc < 2 || argv[1][0] == '-'){
+    fprintf(stderr, "Usage: mkfs [-l nlog] [-s size] [-i ninodes] [-w nswap] fs.img files...\n");
+    exit(1);
+  }
+
+  if(nlog < LOGHDR+MAXOPBLOCKS){
+    fprintf(stderr, "mkfs: log needs at least %d blocks\n", LOGHDR+MAXOPBLOCKS);
+    exit(1);
+  }
+  if(fssize <= 0 || fssize > FSSIZE){
+    fprintf(stderr, "mkfs: size must be at most FSSIZE (%d) blocks\n", FSSIZE);
+    exit(1);
+  }
+  if(nswap < 0 || nswap % PGBLOCKS != 0){
+    fprintf(stderr, "mkfs: swap must be whole pages of %d blocks\n", PGBLOCKS);
+    exit(1);
+  }
+  if(ninodes < argc){
+    fprintf(stderr, "mkfs: %d inodes are too few for %d files\n",
+            ninodes, argc - 2);
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
-  fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
-  if(fsfd < 0){
-    perror(argv[1]);
+  // 1 fs block = 1 disk sector
+  ninodeblocks = ninodes / IPB + 1;
+  nbitmap = fssize/(BSIZE*8) + 1;
+  nmeta = 2 + nlog + ninodeblocks + nbitmap + nswap;
+  nblocks = fssize - nmeta;
+  if(nblocks <= 0){
+    fprintf(stderr, "mkfs: %d blocks leave no room for data\n", fssize);
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
-
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(2+nlog+ninodeblocks+nbitmap);
+  sb.nswap = xint(nswap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u, swap blocks %u) blocks %d total %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nswap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  // A fresh file of the right size reads as zeros.
+  fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
+  if(fsfd < 0){
+    perror(argv[1]);
+    exit(1);
+  }
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
+  img = mmap(0, (size_t)fssize * BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fsfd, 0);
+  if(img == MAP_FAILED){
+    perror("mmap");
+    exit(1);
+  }
 
-  memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(BLK(1), &sb, sizeof(sb));
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  // The root directory is written last, once its
+  // entries are known; collect them meanwhile.
+  de = calloc(argc, sizeof(struct dirent));
+  if(de == 0){
+    perror("calloc");
+    exit(1);
+  }
+  de[0].inum = xshort(rootino);
+  strcpy(de[0].name, ".");
+  de[1].inum = xshort(rootino);
+  strcpy(de[1].name, "..");
+  nde = 2;
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -134,6 +188,11 @@ main(int argc, char *argv[])
       perror(argv[i]);
       exit(1);
     }
+    if((len = lseek(fd, 0, SEEK_END)) < 0 || lseek(fd, 0, SEEK_SET) < 0){
+      perror(argv[i]);
+      exit(1);
+    }
+    size = len;
 
     // Skip leading _ in name when writing to file system.
     // The binaries are named _rm, _cat, etc. to keep the
@@ -142,156 +201,126 @@ main(int argc, char *argv[])
     if(argv[i][0] == '_')
       ++argv[i];
 
-    inum = ialloc(T_FILE);
-
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
-
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    de[nde].inum = xshort(ialloc(T_FILE));
+    strncpy(de[nde].name, argv[i], DIRSIZ);
+    b = iextent(xshort(de[nde].inum), size);
+    nde++;
 
+    for(off = 0; off < size; off += cc){
+      if((cc = read(fd, BLK(b) + off, size - off)) <= 0){
+        fprintf(stderr, "mkfs: short read of %s\n", argv[i]);
+        exit(1);
+      }
+    }
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  // The root directory ends with a block of free entries.
+  size = (nde * sizeof(struct dirent) / BSIZE + 1) * BSIZE;
+  b = iextent(rootino, size);
+  memmove(BLK(b), de, nde * sizeof(struct dirent));
+  free(de);
 
   balloc(freeblock);
 
-  exit(0);
-}
-
-void
-wsect(uint sec, void *buf)
-{
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
-    perror("write");
+  if(munmap(img, (size_t)fssize * BSIZE) < 0 || close(fsfd) < 0){
+    perror(argv[1]);
     exit(1);
   }
+  exit(0);
 }
 
-void
-winode(uint inum, struct dinode *ip)
+struct dinode*
+dinode(uint inum)
 {
-  char buf[BSIZE];
-  uint bn;
-  struct dinode *dip;
-
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *dip = *ip;
-  wsect(bn, buf);
+  return (struct dinode*)BLK(IBLOCK(inum, sb)) + inum % IPB;
 }
 
-void
-rinode(uint inum, struct dinode *ip)
+uint
+ialloc(ushort type)
 {
-  char buf[BSIZE];
-  uint bn;
-  struct dinode *dip;
-
-  bn = IBLOCK(inum, sb);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *ip = *dip;
-}
+  uint inum = freeinode++;
+  struct dinode *din;
 
-void
-rsect(uint sec, void *buf)
-{
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
-    perror("lseek");
+  if(inum >= ninodes){
+    fprintf(stderr, "mkfs: out of inodes\n");
     exit(1);
   }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
+  din = dinode(inum);
+  din->type = xshort(type);
+  din->nlink = xshort(1);
+  din->size = xint(0);
+  return inum;
+}
+
+// Take n contiguous blocks, which read as zeros.
+uint
+bextent(uint n)
+{
+  uint b;
+
+  if(freeblock + n > fssize){
+    fprintf(stderr, "mkfs: out of blocks\n");
     exit(1);
   }
+  b = freeblock;
+  freeblock += n;
+  return b;
 }
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// Give empty inode inum size bytes of contiguous data blocks,
+// followed by whatever indirect blocks they need, and
+// return the first data block.
 uint
-ialloc(ushort type)
+iextent(uint inum, uint size)
 {
-  uint inum = freeinode++;
-  struct dinode din;
+  struct dinode *din;
+  uint n, first, bn, b, i, j, *ind, *dind;
 
-  bzero(&din, sizeof(din));
-  din.type = xshort(type);
-  din.nlink = xshort(1);
-  din.size = xint(0);
-  winode(inum, &din);
-  return inum;
+  n = (size + BSIZE - 1) / BSIZE;
+  if(n > MAXFILE){
+    fprintf(stderr, "mkfs: file too large\n");
+    exit(1);
+  }
+  din = dinode(inum);
+  din->size = xint(size);
+  first = bextent(n);
+
+  for(bn = 0; bn < min(n, NDIRECT); bn++)
+    din->addrs[bn] = xint(first + bn);
+  if(n <= NDIRECT)
+    return first;
+
+  b = bextent(1);
+  din->addrs[NDIRECT] = xint(b);
+  ind = (uint*)BLK(b);
+  for(; bn < min(n, NDIRECT + NINDIRECT); bn++)
+    ind[bn - NDIRECT] = xint(first + bn);
+  if(n <= NDIRECT + NINDIRECT)
+    return first;
+
+  b = bextent(1);
+  din->addrs[NDIRECT+1] = xint(b);
+  dind = (uint*)BLK(b);
+  for(i = 0; bn < n; i++){
+    b = bextent(1);
+    dind[i] = xint(b);
+    ind = (uint*)BLK(b);
+    for(j = 0; j < NINDIRECT && bn < n; j++, bn++)
+      ind[j] = xint(first + bn);
+  }
+  return first;
 }
 
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
-  }
+  for(i = 0; i < used; i++)
+    BLK(sb.bmapstart)[i/8] |= 0x1 << (i%8);
   printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
-}
-
-#define min(a, b) ((a) < (b) ? (a) : (b))
-
-void
-iappend(uint inum, void *xp, int n)
-{
-  char *p = (char*)xp;
-  uint fbn, off, n1;
-  struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
-
-  rinode(inum, &din);
-  off = xint(din.size);
-  // printf("append inum %d at off %d sz %d\n", inum, off, n);
-  while(n > 0){
-    fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
-    n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
-    n -= n1;
-    off += n1;
-    p += n1;
-  }
-  din.size = xint(off);
-  winode(inum, &din);
 }
@@ -0,0 +1,8 @@
+// mmap() protections and flags.
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+#define MAP_SHARED  0x1   // see the file's pages; read-only
+#define MAP_PRIVATE 0x2   // writes go to private copies
+
+#define MAP_FAILED  ((void*)-1)
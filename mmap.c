@@ -0,0 +1,445 @@
+// Memory-mapped files.
+//
+// mmap() records a mapping in the process's vma[] table;
+// nothing is read until the process touches a page, when
+// mmapfault() maps it from the page cache.
+//
+// The page cache holds whole pages of files, keyed by inode
+// and page-aligned offset, so every process mapping a page of
+// a file shares the same physical page.  writei() passes new
+// data to pcwrite(), which copies it into any cached page, so
+// mappings stay coherent with write().  Because nothing writes
+// dirty pages back to the file, MAP_SHARED mappings are read-only;
+// MAP_PRIVATE ones may be writable, using copy-on-write.
+//
+// A cached page holds a reference to its physical page, and each
+// mapping of it holds another.  Only pages that no process maps
+// are evicted, so a mapped page is never left stale.  The cache
+// drops an inode's pages when it is truncated, and when its
+// inode cache entry is recycled (no file can be mapped then).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "mman.h"
+#include "shm.h"
+#include "uinfo.h"
+
+#define MMAPTOP UINFO  // mappings are placed below here
+
+struct pcpage {
+  struct inode *ip;   // 0 if the slot is unused
+  uint off;           // page-aligned offset in the file
+  char *data;
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  int hand;           // next eviction candidate
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached page at offset off of ip, with a reference
+// for the caller, reading it from the file if need be.
+// Caller must hold ip->lock.
+char*
+pcget(struct inode *ip, uint off)
+{
+  struct pcpage *pg;
+  char *mem;
+  int i;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->ip == ip && pg->off == off){
+      kincref(pg->data);
+      release(&pcache.lock);
+      return pg->data;
+    }
+  }
+  release(&pcache.lock);
+
+  // Holding ip->lock keeps writei() out until the page is cached.
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  if(off < ip->size && readi(ip, mem, off, PGSIZE) < 0){
+    kfree(mem);
+    return 0;
+  }
+
+  // Take a free slot, or else the next one no process maps.
+  // If every page is mapped, hand out an uncached page.
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCACHE; i++){
+    pg = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(pg->ip == 0 || krefcnt(pg->data) == 1)
+      break;
+  }
+  if(i < NPCACHE){
+    if(pg->ip){
+      pg->ip->npages--;
+      kfree(pg->data);
+    }
+    pg->ip = ip;
+    pg->off = off;
+    pg->data = mem;
+    ip->npages++;
+    kincref(mem);
+  }
+  release(&pcache.lock);
+  return mem;
+}
+
+// Copy the n bytes at src, just written to ip at offset off,
+// into ip's cached page, if it has one.  The bytes must lie
+// in a single page.  Caller must hold ip->lock.
+void
+pcwrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct pcpage *pg;
+
+  if(ip->npages == 0)
+    return;
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->ip == ip && pg->off == PGROUNDDOWN(off)){
+      memmove(pg->data + off % PGSIZE, src, n);
+      break;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Drop ip's pages from the cache.  Processes that still map
+// one keep their own reference to it.
+void
+pcpurge(struct inode *ip)
+{
+  struct pcpage *pg;
+
+  if(ip->npages == 0)
+    return;
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < &pcache.page[NPCACHE]; pg++){
+    if(pg->ip == ip){
+      kfree(pg->data);
+      pg->ip = 0;
+      pg->data = 0;
+    }
+  }
+  ip->npages = 0;
+  release(&pcache.lock);
+}
+
+//PAGEBREAK!
+// Return p's mapping that holds address va, or 0.
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start && va >= v->start && va < v->start + v->len)
+      return v;
+  return 0;
+}
+
+static struct vma*
+freevma(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start == 0)
+      return v;
+  return 0;
+}
+
+// Does [start, end) overlap any of p's mappings?
+int
+mmapoverlaps(struct proc *p, uint start, uint end)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start && start < v->start + v->len && end > v->start)
+      return 1;
+  return 0;
+}
+
+// Do [va, va+n) lie in one of p's mappings with protection prot?
+int
+mmapcovers(struct proc *p, uint va, uint n, int prot)
+{
+  struct vma *v;
+
+  if(va + n < va || (v = findvma(p, va)) == 0)
+    return 0;
+  return va + n <= v->start + v->len && (v->prot & prot) == prot;
+}
+
+// Find room for a len-byte mapping in p: just below the
+// lowest mapping it fits under, leaving the rest of the
+// address space for sbrk().  Return its address, or -1.
+static uint
+placevma(struct proc *p, uint len)
+{
+  struct vma *w;
+  uint va;
+
+  va = MMAPTOP - len;
+  for(;;){
+    for(w = p->vma; w < &p->vma[NVMA]; w++)
+      if(w->start && va < w->start + w->len && va + len > w->start)
+        break;
+    if(w == &p->vma[NVMA])
+      break;
+    if(w->start < len)
+      return -1;
+    va = w->start - len;
+  }
+  if(va < PGROUNDUP(p->sz))
+    return -1;
+  return va;
+}
+
+// Map len bytes of f, starting at offset off, into the current
+// process.  Return the address of the mapping, or -1.
+int
+mmap(struct file *f, uint len, int prot, int flags, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint va;
+  int type;
+
+  if(f->type != FD_INODE || !f->readable || !(prot & PROT_READ))
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE))
+    return -1;
+  if(len == 0 || len > MMAPTOP || off % PGSIZE != 0)
+    return -1;
+  // Mappings are per process, so threads sharing
+  // a page table cannot have them; see clone().
+  if(krefcnt((char*)p->pgdir) > 1)
+    return -1;
+  ilock(f->ip);
+  type = f->ip->type;
+  iunlock(f->ip);
+  if(type != T_FILE)
+    return -1;
+  if((v = freevma(p)) == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((va = placevma(p, len)) == -1)
+    return -1;
+
+  v->start = va;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = filedup(f);
+  v->off = off;
+  v->shm = 0;
+  return va;
+}
+
+// Map shared memory segment s into the current process, with
+// the caller's reference to it.  Return the address, or -1.
+int
+mmapshm(struct shm *s)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint va, len;
+  int i;
+
+  if(krefcnt((char*)p->pgdir) > 1)
+    return -1;
+  if((v = freevma(p)) == 0)
+    return -1;
+  len = s->npage * PGSIZE;
+  if((va = placevma(p, len)) == -1)
+    return -1;
+  for(i = 0; i < s->npage; i++){
+    kincref(s->page[i]);
+    if(uvmmap(p->pgdir, va + i*PGSIZE, s->page[i],
+              PTE_W|PTE_U|PTE_SHARED) < 0){
+      kfree(s->page[i]);
+      deallocuvm(p->pgdir, va + i*PGSIZE, va);
+      return -1;
+    }
+  }
+
+  v->start = va;
+  v->len = len;
+  v->prot = PROT_READ|PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->f = 0;
+  v->off = 0;
+  v->shm = s;
+  return va;
+}
+
+// Unmap [va, va+len) of the current process, which must lie
+// within one mapping.  Return 0 on success, -1 on error.
+int
+munmap(uint va, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *w;
+  struct file *f;
+  struct shm *s;
+
+  if(va % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if(va + len < va || (v = findvma(p, va)) == 0)
+    return -1;
+  if(va + len > v->start + v->len)
+    return -1;
+  // Shared memory goes all at once.
+  if(v->shm && (va != v->start || len != v->len))
+    return -1;
+
+  f = 0;
+  s = 0;
+  if(va > v->start && va + len < v->start + v->len){
+    // Punch a hole: what is above it becomes a mapping of its own.
+    if((w = freevma(p)) == 0)
+      return -1;
+    *w = *v;
+    w->start = va + len;
+    w->len = v->start + v->len - w->start;
+    w->off = v->off + (w->start - v->start);
+    filedup(w->f);
+    v->len = va - v->start;
+  } else if(va > v->start){
+    v->len = va - v->start;
+  } else if(len < v->len){
+    v->start += len;
+    v->len -= len;
+    v->off += len;
+  } else {
+    f = v->f;
+    s = v->shm;
+    v->start = 0;
+    v->f = 0;
+    v->shm = 0;
+  }
+
+  deallocuvm(p->pgdir, va + len, va);
+  lcr3(V2P(p->pgdir));
+  if(f)
+    fileclose(f);
+  if(s)
+    shmput(s);
+  return 0;
+}
+
+// Detach the shared memory segment mapped at va.
+// Return 0 on success, -1 if none is.
+int
+munmapshm(uint va)
+{
+  struct vma *v;
+
+  if((v = findvma(myproc(), va)) == 0 || v->shm == 0 || v->start != va)
+    return -1;
+  return munmap(v->start, v->len);
+}
+
+// Bring in the mapped page at user address va of process p.
+// Reading the file may sleep, so mmapfault() refuses unless
+// cansleep is set.  Return 0 on success, -1 if va is not in a
+// mapping or the page could not be brought in.
+int
+mmapfault(struct proc *p, uint va, int cansleep)
+{
+  struct vma *v;
+  struct inode *ip;
+  uint a;
+  char *mem;
+  int perm;
+
+  if((v = findvma(p, va)) == 0 || v->shm || !cansleep)
+    return -1;
+  a = PGROUNDDOWN(va);
+  ip = v->f->ip;
+  ilock(ip);
+  mem = pcget(ip, v->off + (a - v->start));
+  iunlock(ip);
+  if(mem == 0)
+    return -1;
+
+  // A private writable page starts out as the cache's page
+  // and gets a copy of its own when first written.
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_COW;
+  if(uvmmap(p->pgdir, a, mem, perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Give the child np copies of p's mappings, sharing the
+// pages p has already brought in.
+int
+mmapfork(struct proc *np, struct proc *p)
+{
+  struct vma *v, *nv;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->start == 0)
+      continue;
+    *nv = *v;
+    if(nv->shm)
+      shmdup(nv->shm);
+    else
+      filedup(nv->f);
+    if(copyuvmrange(p->pgdir, np->pgdir, v->start, v->start + v->len) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Forget p's mappings.  The caller frees the page table
+// that holds their pages.
+void
+mmapclose(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start == 0)
+      continue;
+    if(v->shm)
+      shmput(v->shm);
+    else
+      fileclose(v->f);
+    v->start = 0;
+    v->f = 0;
+    v->shm = 0;
+  }
+}
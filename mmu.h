@@ -10,6 +10,7 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -83,6 +84,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define SPGSIZE         0x400000  // bytes mapped by a PTE_PS superpage
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
@@ -94,12 +96,20 @@ struct segdesc {
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global: kept in the TLB across %cr3 loads
+#define PTE_COW         0x200   // Copy-on-write (software-defined)
+#define PTE_SHARED      0x400   // Shared memory, never copied (software)
+#define PTE_LAZY        0x800   // Not present yet: pagein() on touch (software)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// Swap slot named by a PTE_LAZY entry, if nonzero (see swap.c)
+#define PTE_SLOT(pte)   (PTE_ADDR(pte) >> PTXSHIFT)
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
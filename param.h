@@ -1,14 +1,27 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       512  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
-#define NCPU          8  // maximum number of CPUs
+#define NCPU          8  // maximum number of CPUs; at most 8, see ioapic.c
+#define NIRQ         32  // interrupts counted per CPU, from T_IRQ0
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE      200  // unused i-nodes kept cached
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define NDISK         4  // IDE disks, two on each channel
+#define TMPDEV        4  // device number of the in-memory tmpfs
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*30)  // max data blocks in on-disk log
+#define NBUF         512  // size of disk block cache
+#define RAWINDOW     8  // blocks of sequential read-ahead
+#define NPCACHE      256  // file pages cached for mmap()
+#define NTRIE        512  // trie nodes for completing root directory names
+#define NSCROLLBACK  200  // lines of console scrollback
+#define NLOCKSTAT    64  // lock names with contention statistics
+#define TICKETLOCK    1  // FIFO ticket spin locks; 0 for test-and-set
+#ifndef HZ
+#define HZ          100  // timer interrupts per second; see Makefile
+#endif
+#define MLFQ          1  // multi-level feedback queue scheduler; 0 for round robin
+#define BOOSTTICKS  100  // ticks between MLFQ priority boosts
+#define FSSIZE       40000  // size of file system in blocks, swap area included
 
@@ -8,17 +8,31 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The ring is a page of its own; PIPESIZE must be a power
+// of two so that nread and nwrite may wrap around.
+#define PIPESIZE PGSIZE
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // PIPESIZE bytes
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rwait;      // a reader is sleeping on nread
+  int wwait;      // a writer is sleeping on nwrite
+  int rbusy;      // piperbegin() has the read end
+  int wbusy;      // pipewbegin() has the write end
 };
 
+static struct kmcache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmcreate("pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +42,18 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = kmalloc(pipecache)) == 0)
+    goto bad;
+  if((p->data = kalloc()) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->rwait = 0;
+  p->wwait = 0;
+  p->rbusy = 0;
+  p->wbusy = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,8 +67,11 @@ pipealloc(struct file **f0, struct file **f1)
 
 //PAGEBREAK: 20
  bad:
-  if(p)
-    kfree((char*)p);
+  if(p){
+    if(p->data)
+      kfree(p->data);
+    kmfree(pipecache, p);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,30 +92,61 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    kfree(p->data);
+    kmfree(pipecache, p);
   } else
     release(&p->lock);
 }
 
+// Wake readers or writers, but only if one is asleep;
+// wakeup() has to scan the whole process table.
+// Caller must hold p->lock.
+static void
+pipewakeread(struct pipe *p)
+{
+  if(p->rwait){
+    p->rwait = 0;
+    wakeup(&p->nread);
+  }
+}
+
+static void
+pipewakewrite(struct pipe *p)
+{
+  if(p->wwait){
+    p->wwait = 0;
+    wakeup(&p->nwrite);
+  }
+}
+
 //PAGEBREAK: 40
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m, off;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->wbusy || p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      pipewakeread(p);
+      p->wwait = 1;
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    // Copy as much as fits, up to the end of the ring.
+    off = p->nwrite % PIPESIZE;
+    m = PIPESIZE - (p->nwrite - p->nread);
+    if(m > PIPESIZE - off)
+      m = PIPESIZE - off;
+    if(m > n - i)
+      m = n - i;
+    memmove(p->data + off, addr + i, m);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  pipewakeread(p);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
@@ -100,22 +154,115 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m, off;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  while(p->rbusy || (p->nread == p->nwrite && p->writeopen)){  //DOC: pipe-empty
     if(myproc()->killed){
       release(&p->lock);
       return -1;
     }
+    p->rwait = 1;
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    off = p->nread % PIPESIZE;
+    m = p->nwrite - p->nread;
+    if(m > PIPESIZE - off)
+      m = PIPESIZE - off;
+    if(m > n - i)
+      m = n - i;
+    memmove(addr + i, p->data + off, m);
+    p->nread += m;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  pipewakewrite(p);  //DOC: piperead-wakeup
   release(&p->lock);
   return i;
 }
+
+//PAGEBREAK: 40
+// Splice support: give the caller direct access to the ring.
+// pipewbegin() reserves the contiguous free space at the write
+// end and pipewend() commits the n bytes put there;
+// piperbegin() and piperend() do the same for the data at the
+// read end.  p->lock is not held in between, so the caller may
+// sleep; the busy flag keeps other writers (readers) out.
+
+// Wait for free space; return its size and set *buf to it.
+// Return -1 if there are no readers or the caller is killed.
+int
+pipewbegin(struct pipe *p, char **buf)
+{
+  int m, off;
+
+  acquire(&p->lock);
+  while(p->wbusy || p->nwrite == p->nread + PIPESIZE){
+    if(p->readopen == 0 || myproc()->killed){
+      release(&p->lock);
+      return -1;
+    }
+    pipewakeread(p);
+    p->wwait = 1;
+    sleep(&p->nwrite, &p->lock);
+  }
+  off = p->nwrite % PIPESIZE;
+  m = PIPESIZE - (p->nwrite - p->nread);
+  if(m > PIPESIZE - off)
+    m = PIPESIZE - off;
+  p->wbusy = 1;
+  *buf = p->data + off;
+  release(&p->lock);
+  return m;
+}
+
+void
+pipewend(struct pipe *p, int n)
+{
+  acquire(&p->lock);
+  p->nwrite += n;
+  p->wbusy = 0;
+  pipewakeread(p);
+  pipewakewrite(p);
+  release(&p->lock);
+}
+
+// Return the size of the data at the read end and set *buf to it.
+// If wait is set and the pipe is empty, wait for a writer.
+// Return 0 at end of file or if the pipe is empty and wait is
+// clear; -1 if the caller is killed.
+int
+piperbegin(struct pipe *p, char **buf, int wait)
+{
+  int m, off;
+
+  acquire(&p->lock);
+  while(p->rbusy || (wait && p->nread == p->nwrite && p->writeopen)){
+    if(myproc()->killed){
+      release(&p->lock);
+      return -1;
+    }
+    p->rwait = 1;
+    sleep(&p->nread, &p->lock);
+  }
+  off = p->nread % PIPESIZE;
+  m = p->nwrite - p->nread;
+  if(m > PIPESIZE - off)
+    m = PIPESIZE - off;
+  if(m > 0){
+    p->rbusy = 1;
+    *buf = p->data + off;
+  }
+  release(&p->lock);
+  return m;
+}
+
+void
+piperend(struct pipe *p, int n)
+{
+  acquire(&p->lock);
+  p->nread += n;
+  p->rbusy = 0;
+  pipewakewrite(p);
+  pipewakeread(p);
+  release(&p->lock);
+}
@@ -1,11 +1,78 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "param.h"
+
+// Output is buffered per fd.  A console (device) fd is flushed
+// at each newline and at the end of each printf(); other fds
+// are flushed when the buffer fills, by fflush(), and before
+// fork(), exec(), exit(), and close() of the fd (see ulib.c).
+
+#define OUTBUF 512
+
+enum { UNKNOWN, LINE, FULL, NONE };
+
+static struct {
+  int mode;
+  int n;
+  char *buf;
+} ob[NOFILE];
+
+extern void (*outflush)(int);
+
+void
+fflush(int fd)
+{
+  int i;
+
+  if(fd < 0){
+    for(i = 0; i < NOFILE; i++)
+      fflush(i);
+    return;
+  }
+  if(fd < NOFILE && ob[fd].n > 0){
+    write(fd, ob[fd].buf, ob[fd].n);
+    ob[fd].n = 0;
+  }
+}
+
+// Flush fd; if it is about to be closed, forget its mode,
+// since the next file opened as fd may be different.
+static void
+closeflush(int fd)
+{
+  fflush(fd);
+  if(fd >= 0 && fd < NOFILE)
+    ob[fd].mode = UNKNOWN;
+}
 
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE){
+    write(fd, &c, 1);
+    return;
+  }
+  if(ob[fd].mode == UNKNOWN){
+    if(ob[fd].buf == 0)
+      ob[fd].buf = malloc(OUTBUF);
+    if(ob[fd].buf == 0)
+      ob[fd].mode = NONE;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEV)
+      ob[fd].mode = LINE;
+    else
+      ob[fd].mode = FULL;
+    outflush = closeflush;
+  }
+  if(ob[fd].mode == NONE){
+    write(fd, &c, 1);
+    return;
+  }
+  ob[fd].buf[ob[fd].n++] = c;
+  if(ob[fd].n == OUTBUF || (c == '\n' && ob[fd].mode == LINE))
+    fflush(fd);
 }
 
 static void
@@ -82,4 +149,6 @@ printf(int fd, const char *fmt, ...)
       state = 0;
     }
   }
+  if(fd >= 0 && fd < NOFILE && ob[fd].mode == LINE)
+    fflush(fd);
 }
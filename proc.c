@@ -6,10 +6,22 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "spawn.h"
+#include "wait.h"
+#include "stats.h"
 
+#define NSLEEPQ 64  // sleep queues; a power of two
+#define NPIDHASH 64 // pid hash chains; a power of two
+
+// Process structures come from a slab cache, up to NPROC
+// of them at a time, and are freed when reaped.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct kmcache *cache;
+  struct proc *all;              // Every struct proc, by allnext
+  int nproc;                     // Length of all
+  struct proc *sleepq[NSLEEPQ];  // SLEEPING processes, by chan
+  struct proc *pidhash[NPIDHASH]; // By pid, linked by hnext
 } ptable;
 
 static struct proc *initproc;
@@ -18,12 +30,15 @@ int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
+static void adopt(struct proc *parent, struct proc *p);
 static void wakeup1(void *chan);
+static void runqput(struct proc *p);
 
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  ptable.cache = kmcreate("proc", sizeof(struct proc));
 }
 
 // Must be called with interrupts disabled
@@ -66,8 +81,54 @@ myproc(void) {
 }
 
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
+// Return the process with the given pid, or 0.
+// Caller must hold ptable.lock.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidhash[pid & (NPIDHASH-1)]; p; p = p->hnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Unlink p from the pid hash and the list of all procs,
+// and free it.  Caller must hold ptable.lock.
+static void
+procput(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[p->pid & (NPIDHASH-1)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == p){
+      *pp = p->hnext;
+      break;
+    }
+  }
+  if(p->allprev)
+    p->allprev->allnext = p->allnext;
+  else
+    ptable.all = p->allnext;
+  if(p->allnext)
+    p->allnext->allprev = p->allprev;
+  ptable.nproc--;
+  kmfree(ptable.cache, p);
+}
+
+// Free p, made by allocproc() but never started.
+static void
+freeproc(struct proc *p)
+{
+  kfree(p->kstack);
+  acquire(&ptable.lock);
+  procput(p);
+  release(&ptable.lock);
+}
+
+// Allocate a proc, unless there are NPROC already.
+// If successful, set its state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
 static struct proc*
@@ -78,22 +139,34 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if(ptable.nproc >= NPROC || (p = kmalloc(ptable.cache)) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
+  memset(p, 0, sizeof(*p));
+  ptable.nproc++;
+  p->allnext = ptable.all;
+  if(ptable.all)
+    ptable.all->allprev = p;
+  ptable.all = p;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->hnext = ptable.pidhash[p->pid & (NPIDHASH-1)];
+  ptable.pidhash[p->pid & (NPIDHASH-1)] = p;
+  p->level = 0;
+  p->slice = 0;
+  p->ticks = 0;
+  p->affinity = ~0;
+  p->trace = 0;
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    procput(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -148,30 +221,74 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  p->cpu = cpuid();
+  runqput(p);
 
   release(&ptable.lock);
 }
 
+// Start a kernel thread running fn, which must not return.
+// It is a process of its own, so it can sleep, but it has
+// no user memory and never returns to user space.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kthread");
+  // forkret() returns to fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->cpu = cpuid();
+  runqput(p);
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
+// New pages are only reserved; each is allocated on first touch.
+// Threads sharing the page table grow together.  They cannot
+// shrink, since the other threads' TLBs could still hold the
+// pages being freed.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
   uint sz;
+  int shared;
+  struct proc *p;
   struct proc *curproc = myproc();
 
+  // Keep sibling threads from growing the same range.
+  // Only this process can make its page table shared.
+  shared = krefcnt((char*)curproc->pgdir) > 1;
+  if(shared)
+    acquire(&ptable.lock);
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+    if(mmapoverlaps(curproc, sz, PGROUNDUP(sz + n)) ||
+       (sz = lazyuvm(curproc->pgdir, sz, sz + n)) == 0)
+      goto bad;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+    if(shared || (sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+      goto bad;
   }
   curproc->sz = sz;
-  switchuvm(curproc);
+  if(shared){
+    for(p = ptable.all; p; p = p->allnext)
+      if(p->pgdir == curproc->pgdir)
+        p->sz = sz;
+    release(&ptable.lock);
+  }
+  lcr3(rcr3());  // flush the TLB of pages dropped
   return 0;
+
+bad:
+  if(shared)
+    release(&ptable.lock);
+  return -1;
 }
 
 // Create a new process copying p as the parent.
@@ -191,13 +308,17 @@ fork(void)
 
   // Copy process state from proc.
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+    freeproc(np);
+    return -1;
+  }
+  if(uinfomap(np->pgdir, np->pid) < 0 || mmapfork(np, curproc) < 0){
+    mmapclose(np);
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    freeproc(np);
     return -1;
   }
   np->sz = curproc->sz;
-  np->parent = curproc;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -207,20 +328,180 @@ fork(void)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
   np->cwd = idup(curproc->cwd);
+  np->exe = curproc->exe ? idup(curproc->exe) : 0;
+  np->nseg = curproc->nseg;
+  for(i = 0; i < curproc->nseg; i++)
+    np->seg[i] = curproc->seg[i];
+
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  np->affinity = curproc->affinity;
+  np->trace = curproc->trace;
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  adopt(curproc, np);
+
+  // Start the child next to its parent; idle CPUs
+  // will steal it if this one stays busy.
+  np->cpu = cpuid();
+  runqput(np);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
+// Create a thread: a new process sharing the current one's
+// memory, which starts by calling fn(arg) on the page-sized
+// user stack at stack.  Open files, the current directory,
+// and the rest are copied as by fork().  The thread must not
+// return from fn; it calls exit(), and the creator join()s it.
+// Processes with mapped files cannot make threads, since each
+// process keeps its own mappings.
+int
+clone(uint fn, uint arg, char *stack)
+{
+  int i, pid;
+  uint *sp;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  for(i = 0; i < NVMA; i++)
+    if(curproc->vma[i].start)
+      return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  if(shareuvm(curproc->pgdir, curproc->sz) < 0){
+    freeproc(np);
+    return -1;
+  }
+  uinfoshare(curproc->pgdir);
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  np->ustack = stack;
+  *np->tf = *curproc->tf;
+
+  // Call fn(arg) with a return address that faults.
+  sp = (uint*)(stack + PGSIZE);
+  *--sp = arg;
+  *--sp = 0xffffffff;
+  np->tf->esp = (uint)sp;
+  np->tf->eip = fn;
+
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+  np->exe = curproc->exe ? idup(curproc->exe) : 0;
+  np->nseg = curproc->nseg;
+  for(i = 0; i < curproc->nseg; i++)
+    np->seg[i] = curproc->seg[i];
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  np->affinity = curproc->affinity;
+  np->trace = curproc->trace;
 
   pid = np->pid;
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  adopt(curproc, np);
+
+  // As in fork(), idle CPUs will steal the thread.
+  np->cpu = cpuid();
+  runqput(np);
 
   release(&ptable.lock);
 
   return pid;
 }
 
+// Apply spawn() file action a to the open files of np.
+static int
+spawnact(struct proc *np, struct spawnact *a)
+{
+  struct file *f;
+
+  if(a->fd < 0 || a->fd >= NOFILE)
+    return -1;
+  switch(a->op){
+  case SPAWN_OPEN:
+    if((f = fileopen(a->path, a->arg)) == 0)
+      return -1;
+    break;
+  case SPAWN_DUP:
+    if(a->arg < 0 || a->arg >= NOFILE || np->ofile[a->arg] == 0)
+      return -1;
+    f = filedup(np->ofile[a->arg]);
+    break;
+  case SPAWN_CLOSE:
+    f = 0;
+    break;
+  default:
+    return -1;
+  }
+  if(np->ofile[a->fd])
+    fileclose(np->ofile[a->fd]);
+  np->ofile[a->fd] = f;
+  return 0;
+}
+
+// Run the program at path with arguments argv in a new child,
+// without copying the current process as fork() and exec()
+// would: the child gets fresh memory from loadimage(), the
+// current directory, and copies of the open files changed by
+// the nact actions in act.  Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawnact *act, int nact)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  for(i = 0; i < nact; i++)
+    if(spawnact(np, &act[i]) < 0)
+      goto bad;
+  *np->tf = *curproc->tf;
+  np->tf->eax = 0;
+  if(loadimage(np, path, argv) < 0)
+    goto bad;
+  np->cwd = idup(curproc->cwd);
+  np->affinity = curproc->affinity;
+  np->trace = curproc->trace;
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  adopt(curproc, np);
+
+  // As in fork(), idle CPUs will steal the child.
+  np->cpu = cpuid();
+  runqput(np);
+
+  release(&ptable.lock);
+
+  return pid;
+
+bad:
+  for(i = 0; i < NOFILE; i++){
+    if(np->ofile[i]){
+      fileclose(np->ofile[i]);
+      np->ofile[i] = 0;
+    }
+  }
+  freeproc(np);
+  return -1;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -235,6 +516,7 @@ exit(void)
     panic("init exiting");
 
   // Close all open files.
+  mmapclose(curproc);
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
       fileclose(curproc->ofile[fd]);
@@ -244,8 +526,12 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
+  curproc->nseg = 0;
 
   acquire(&ptable.lock);
 
@@ -253,12 +539,11 @@ exit(void)
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+  while((p = curproc->children) != 0){
+    curproc->children = p->sibling;
+    adopt(initproc, p);
+    if(p->state == ZOMBIE)
+      wakeup1(initproc);
   }
 
   // Jump into the scheduler, never to return.
@@ -267,34 +552,46 @@ exit(void)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(void)
+// Make p a child of parent.  Caller must hold ptable.lock.
+static void
+adopt(struct proc *parent, struct proc *p)
 {
-  struct proc *p;
-  int havekids, pid;
+  p->parent = parent;
+  p->sibling = parent->children;
+  parent->children = p;
+}
+
+// Wait for a child to exit and return its pid: a child
+// process, or with threads set a child thread, whose user
+// stack is stored in *stack.  If pid is not -1, only the
+// child with that pid will do.  With WNOHANG in options,
+// return 0 rather than wait if no such child has exited.
+// Return -1 if this process has no such children.
+static int
+waitchild(int pid, int threads, int options, char **stack)
+{
+  struct proc *p, **pp;
+  int havekids;
   struct proc *curproc = myproc();
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through the children looking for exited ones.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+    for(pp = &curproc->children; (p = *pp) != 0; pp = &p->sibling){
+      if((pid != -1 && p->pid != pid) ||
+         (p->pgdir == curproc->pgdir) != threads)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
+        *pp = p->sibling;
         pid = p->pid;
+        if(threads)
+          *stack = p->ustack;
         kfree(p->kstack);
-        p->kstack = 0;
         freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        procput(p);
         release(&ptable.lock);
         return pid;
       }
@@ -305,17 +602,220 @@ wait(void)
       release(&ptable.lock);
       return -1;
     }
+    if(options & WNOHANG){
+      release(&ptable.lock);
+      return 0;
+    }
 
     // Wait for children to exit.  (See wakeup1 call in proc_exit.)
     sleep(curproc, &ptable.lock);  //DOC: wait-sleep
   }
 }
 
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int
+wait(void)
+{
+  return waitchild(-1, 0, 0, 0);
+}
+
+// Wait for child process pid, or any child process if pid
+// is -1, to exit and return its pid.  With WNOHANG in
+// options, return 0 if none has exited yet.
+// Return -1 if this process has no such children.
+int
+waitpid(int pid, int options)
+{
+  return waitchild(pid, 0, options, 0);
+}
+
+// Wait for a thread made by clone() to exit and return its
+// pid, storing in *stack the user stack it was given.
+// Return -1 if this process has no threads.
+int
+join(char **stack)
+{
+  return waitchild(-1, 1, 0, stack);
+}
+
 //PAGEBREAK: 42
+// Run queues.
+// Each CPU has its own queue of RUNNABLE processes, so picking
+// the next process is O(1) instead of a scan over ptable.
+// A process rejoins the queue of the CPU it last ran on,
+// which keeps it cache-warm; an idle CPU steals work from
+// the CPU with the longest queue.  setaffinity() can pin a
+// process to some CPUs: p->cpu is always one of them, and
+// no other CPU steals it.
+//
+// With MLFQ, each queue has NLEVEL priority levels.  A process
+// starts at level 0 and may run for QUANTUM(level) ticks
+// before it drops a level, so CPU hogs sink while processes
+// that sleep often, like the shell, stay on top.  Every
+// BOOSTTICKS ticks all processes go back to level 0, so the
+// ones at the bottom are not starved.
+
+#define QUANTUM(level) (1 << (level))
+
+// Add d to nready of each CPU p may run on, as p is
+// queued or taken off a queue.
+// The ptable lock must be held.
+static void
+runqcount(struct proc *p, int d)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(p->affinity & (1 << (c - cpus)))
+      c->nready += d;
+}
+
+// Mark p RUNNABLE and append it to the run queue of p->cpu,
+// at its level.  Wake p->cpu if it is idle, or else, if p
+// has to wait its turn, another idle CPU that can steal it.
+// The ptable lock must be held.
+static void
+runqput(struct proc *p)
+{
+  struct runq *rq;
+  struct cpu *c;
+
+  rq = &cpus[p->cpu].rq;
+  p->state = RUNNABLE;
+  p->rqnext = 0;
+  if(rq->tail[p->level])
+    rq->tail[p->level]->rqnext = p;
+  else
+    rq->head[p->level] = p;
+  rq->tail[p->level] = p;
+  rq->n++;
+  runqcount(p, 1);
+  // Make the new counts visible before reading any idle
+  // flag; idle() fences the other way.
+  __sync_synchronize();
+
+  c = &cpus[p->cpu];
+  if(!c->idle && rq->n > 1)
+    for(c = cpus; c < cpus+ncpu; c++)
+      if(c->idle && (p->affinity & (1 << (c - cpus))))
+        break;
+  if(c < cpus+ncpu && c->idle && c != mycpu()){
+    c->idle = 0;
+    lapicwake(c->apicid);
+  }
+}
+
+// Remove and return the first process at the highest
+// level of rq that may run on CPU cpu, or 0.
+// The ptable lock must be held.
+static struct proc*
+runqget(struct runq *rq, int cpu)
+{
+  struct proc *p, *prev;
+  int l;
+
+  for(l = 0; l < NLEVEL; l++){
+    for(prev = 0, p = rq->head[l]; p; prev = p, p = p->rqnext){
+      if((p->affinity & (1 << cpu)) == 0)
+        continue;
+      if(prev)
+        prev->rqnext = p->rqnext;
+      else
+        rq->head[l] = p->rqnext;
+      if(rq->tail[l] == p)
+        rq->tail[l] = prev;
+      p->rqnext = 0;
+      rq->n--;
+      runqcount(p, -1);
+      return p;
+    }
+  }
+  return 0;
+}
+
+// Does rq hold a process above level?
+// Reads without ptable.lock, as a hint.
+static int
+runqabove(struct runq *rq, int level)
+{
+  int l;
+
+  for(l = 0; l < level; l++)
+    if(rq->head[l])
+      return 1;
+  return 0;
+}
+
+// Take a process that may run on c from the busiest other
+// CPU's queue, or failing that from any other, or 0.
+// The ptable lock must be held.
+static struct proc*
+runqsteal(struct cpu *c)
+{
+  struct cpu *c1, *victim;
+  struct proc *p;
+
+  victim = 0;
+  for(c1 = cpus; c1 < cpus+ncpu; c1++){
+    if(c1 == c || c1->rq.n == 0)
+      continue;
+    if(victim == 0 || c1->rq.n > victim->rq.n)
+      victim = c1;
+  }
+  if(victim == 0)
+    return 0;
+  if((p = runqget(&victim->rq, c - cpus)) != 0)
+    return p;
+  for(c1 = cpus; c1 < cpus+ncpu; c1++)
+    if(c1 != c && c1 != victim && c1->rq.n > 0 &&
+       (p = runqget(&c1->rq, c - cpus)) != 0)
+      return p;
+  return 0;
+}
+
+// Is there anything this CPU could run?  Reads its count
+// without ptable.lock, so idle CPUs spin on their own cache
+// lines instead of on the lock.  Processes pinned to other
+// CPUs don't count, so they can't keep this one from idling.
+static int
+runqready(struct cpu *c)
+{
+  return c->nready > 0;
+}
+
+// Halt until an interrupt, unless there is something to
+// run after all.  runqput() clears c->idle and sends an
+// interrupt when it gives c work; interrupts are off from
+// setting the flag until the hlt, so that one can't be lost.
+// x86 lets a load pass an earlier store, so both sides fence
+// between writing their flag or count and reading the other's:
+// either runqput() sees c->idle or runqready() sees the work.
+static void
+idle(struct cpu *c)
+{
+  cli();
+  c->idle = 1;
+  __sync_synchronize();
+  if(runqready(c)){
+    c->idle = 0;
+    sti();
+    return;
+  }
+  if(c != cpus)
+    lapicidle();
+  stihlt();
+  cli();
+  c->idle = 0;
+  if(c != cpus)
+    lapicbusy();
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process to run from this CPU's run queue,
+//    or steal one from another CPU
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
@@ -330,21 +830,28 @@ scheduler(void)
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
+    if(!runqready(c)){
+      idle(c);
+      continue;
+    }
 
+    acquire(&ptable.lock);
+    if((p = runqget(&c->rq, c - cpus)) == 0)
+      p = runqsteal(c);
+    if(p != 0){
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
       c->proc = p;
+      p->cpu = c - cpus;
       switchuvm(p);
       p->state = RUNNING;
 
       swtch(&(c->scheduler), p->context);
-      switchkvm();
+      // Stay on p's page table, unless p has exited and its
+      // memory can be freed once the CPU lets go of it.
+      if(p->state == ZOMBIE)
+        releaseuvm();
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
@@ -381,12 +888,151 @@ sched(void)
   mycpu()->intena = intena;
 }
 
+// Charge the running process for a timer tick, and give up
+// the CPU if it has used up its quantum, dropping a level,
+// or if something of higher priority is waiting.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+
+  p->ticks++;
+  if(++p->slice < QUANTUM(p->level) &&
+     !runqabove(&mycpu()->rq, p->level))
+    return;
+  if(p->slice >= QUANTUM(p->level)){
+    p->slice = 0;
+    if(p->level < NLEVEL-1)
+      p->level++;
+  }
+  yield();
+}
+
+// Put every process back at level 0, keeping the order of
+// each run queue, highest levels first.  Called every
+// BOOSTTICKS ticks.
+void
+schedboost(void)
+{
+  struct proc *p, *head, *tail;
+  struct cpu *c;
+  int l;
+
+  if(NLEVEL == 1)
+    return;
+  acquire(&ptable.lock);
+  for(p = ptable.all; p; p = p->allnext){
+    p->level = 0;
+    p->slice = 0;
+  }
+  for(c = cpus; c < cpus+ncpu; c++){
+    head = tail = 0;
+    for(l = 0; l < NLEVEL; l++){
+      if(c->rq.head[l] == 0)
+        continue;
+      if(tail)
+        tail->rqnext = c->rq.head[l];
+      else
+        head = c->rq.head[l];
+      tail = c->rq.tail[l];
+      c->rq.head[l] = c->rq.tail[l] = 0;
+    }
+    c->rq.head[0] = head;
+    c->rq.tail[0] = tail;
+  }
+  release(&ptable.lock);
+}
+
+// Where swapvictim()'s clock hand stopped: the process, by
+// pid, and the next address in it.  Protected by ptable.lock.
+static struct {
+  int pid;
+  uint va;
+} hand;
+
+// May p lose pages to swap now?  See swap.c.
+static int
+canswap(struct proc *p, struct proc *self)
+{
+  if(p->pgdir == 0 || p->sz == 0 || krefcnt((char*)p->pgdir) > 1)
+    return 0;
+  return p == self || (p->state == RUNNABLE && p->upreempt);
+}
+
+// Choose a page of user memory for swapout() by the clock
+// algorithm, and replace its PTE with one naming swap slot s.
+// The hand sweeps the pages of each process that may lose
+// pages, taking the first page not used since the hand last
+// passed it.  Returns the page, or 0 if two sweeps found none.
+char*
+swapvictim(struct proc *self, uint s)
+{
+  struct proc *p;
+  char *mem;
+  int n;
+
+  acquire(&ptable.lock);
+  for(p = ptable.all; p && p->pid != hand.pid; p = p->allnext)
+    ;
+  if(p == 0){
+    p = ptable.all;
+    hand.va = 0;
+  }
+  // The first time round may only clear accessed bits.
+  for(n = 0; n <= 2*ptable.nproc; n++){
+    if(canswap(p, self)){
+      mem = clockuvm(p->pgdir, &hand.va, p->sz, s);
+      // Reload the changed PTEs before p next runs.
+      if(p == self)
+        lcr3(rcr3());
+      else
+        p->ran = 0;
+      if(mem){
+        hand.pid = p->pid;
+        release(&ptable.lock);
+        return mem;
+      }
+    }
+    p = p->allnext ? p->allnext : ptable.all;
+    hand.pid = p->pid;
+    hand.va = 0;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Let the current process run only on the CPUs in mask,
+// moving it to the first of them if it is on another.
+// Returns -1 if mask names no CPU.
+int
+setaffinity(uint mask)
+{
+  struct proc *p = myproc();
+  int i;
+
+  if(ncpu < 32)
+    mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+  acquire(&ptable.lock);
+  p->affinity = mask;
+  if((mask & (1 << p->cpu)) == 0){
+    for(i = 0; (mask & (1 << i)) == 0; i++)
+      ;
+    p->cpu = i;
+    runqput(p);
+    sched();
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  runqput(myproc());
   sched();
   release(&ptable.lock);
 }
@@ -407,11 +1053,56 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit();
+    trieload();
+    historyload();
+    consolestart();
   }
 
   // Return to "caller", actually trapret (see allocproc).
 }
 
+//PAGEBREAK: 30
+// Sleep queues.
+// Sleeping processes are kept in lists hashed by the channel
+// they sleep on, so wakeup() looks only at the processes that
+// might be waiting for it, rather than at every process.
+// The ptable lock must be held for all of these.
+
+static struct proc**
+sleepq(void *chan)
+{
+  uint h;
+
+  h = (uint)chan;
+  h ^= h >> 6 ^ h >> 12;
+  return &ptable.sleepq[h & (NSLEEPQ-1)];
+}
+
+static void
+sqput(struct proc *p)
+{
+  struct proc **pp;
+
+  pp = sleepq(p->chan);
+  p->sqnext = *pp;
+  *pp = p;
+}
+
+static void
+sqremove(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = sleepq(p->chan); *pp; pp = &(*pp)->sqnext){
+    if(*pp == p){
+      *pp = p->sqnext;
+      return;
+    }
+  }
+  panic("sqremove");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -438,6 +1129,7 @@ sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  sqput(p);
 
   sched();
 
@@ -457,11 +1149,16 @@ sleep(void *chan, struct spinlock *lk)
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  struct proc *p, **pp;
+
+  pp = sleepq(chan);
+  while((p = *pp) != 0){
+    if(p->chan == chan){
+      *pp = p->sqnext;
+      runqput(p);
+    } else
+      pp = &p->sqnext;
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -482,18 +1179,42 @@ kill(int pid)
   struct proc *p;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING){
+    sqremove(p);
+    runqput(p);
   }
   release(&ptable.lock);
-  return -1;
+  return 0;
+}
+
+// Describe up to n processes in ps, for top.
+// Returns how many there were.
+int
+procstat(struct procstat *ps, int n)
+{
+  struct proc *p;
+  int i;
+
+  i = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.all; p && i < n; p = p->allnext){
+    if(p->state == UNUSED)
+      continue;
+    ps[i].pid = p->pid;
+    ps[i].state = p->state;
+    ps[i].sz = p->sz;
+    ps[i].ticks = p->ticks;
+    safestrcpy(ps[i].name, p->name, sizeof(ps[i].name));
+    i++;
+  }
+  release(&ptable.lock);
+  return i;
 }
 
 //PAGEBREAK: 36
@@ -516,14 +1237,15 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.all; p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s %s %d ticks level %d cpu %d", p->pid, state, p->name,
+            p->ticks, p->level, p->cpu);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -1,3 +1,22 @@
+// Priority levels of the multi-level feedback queue.
+// With MLFQ off there is one level and every process runs
+// for one tick at a time: round robin.
+#if MLFQ
+#define NLEVEL 3
+#else
+#define NLEVEL 1
+#endif
+
+// Queues of RUNNABLE processes, one per priority level,
+// linked through proc->rqnext; level 0 runs first.
+// Protected by ptable.lock; n may be read without the lock
+// as a hint that there is something to run.
+struct runq {
+  struct proc *head[NLEVEL];
+  struct proc *tail[NLEVEL];
+  volatile int n;              // Number of queued processes
+};
+
 // Per-CPU state
 struct cpu {
   uchar apicid;                // Local APIC ID
@@ -8,6 +27,13 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  struct runq rq;              // Processes waiting to run on this cpu
+  volatile int nready;         // Queued processes, on any cpu, that may run here
+  volatile int idle;           // Halted, waiting for something to run
+  pde_t *pgdir;                // Page table in %cr3, or 0 for kpgdir
+  int pgdirdead;               // freevm() has left pgdir to this CPU
+  int tss;                     // Has ltr loaded the TSS?
+  uint nintr[NIRQ];            // Interrupts taken, by IRQ
 };
 
 extern struct cpu cpus[NCPU];
@@ -35,6 +61,37 @@ struct context {
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
+// A demand-loaded part of an exec()ed program: user addresses
+// [va, va+filesz) hold bytes [off, off+filesz) of proc's exe.
+// pagein() reads them in on first touch.  A text segment is
+// read-only and page-aligned in the file, so its pages come
+// from the page cache, shared by every process running proc's
+// exe.
+struct seg {
+  uint va;
+  uint off;
+  uint filesz;
+  int text;
+};
+
+#define NSEG 4  // loadable ELF segments per program
+
+// A file mapped by mmap() at user addresses [start, start+len),
+// starting at page-aligned offset off.  Its pages are brought
+// in by mmapfault() on first touch.  Or, if shm is set, a shared
+// memory segment, whose pages are all mapped; see shm.c.
+struct vma {
+  uint start;         // 0 if the slot is unused
+  uint len;
+  int prot;           // PROT_ bits
+  int flags;          // MAP_SHARED or MAP_PRIVATE
+  struct file *f;
+  uint off;
+  struct shm *shm;
+};
+
+#define NVMA 8  // mappings per process
+
 struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
@@ -48,7 +105,27 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Program file backing seg[]
+  int nseg;
+  struct seg seg[NSEG];        // Parts of memory not yet read from exe
+  struct vma vma[NVMA];        // Mapped files
   char name[16];               // Process name (debugging)
+  int cpu;                     // CPU whose run queue to join
+  struct cpu *ran;             // CPU that last loaded its page table
+  int upreempt;                // Preempted in user space; see swap.c
+  uint affinity;               // Bit i set if may run on CPU i
+  struct proc *rqnext;         // Next process in run queue
+  struct proc *sqnext;         // Next process in sleep queue
+  int level;                   // Priority level, 0 highest
+  int slice;                   // Ticks used at this level
+  uint ticks;                  // Timer ticks spent running
+  int trace;                   // Log system calls; see trace.c
+  char *ustack;                // User stack of a thread, for join()
+  struct proc *children;       // First child, for wait()
+  struct proc *sibling;        // Next child of the same parent
+  struct proc *hnext;          // Next in pid hash chain
+  struct proc *allnext;        // List of all procs
+  struct proc *allprev;
 };
 
 // Process memory is laid out contiguously, low addresses first:
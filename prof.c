@@ -0,0 +1,231 @@
+// prof: run a command under the sampling profiler and
+// report where its time went.
+//
+//   prof cmd [args...]
+//
+// Samples of the kernel are resolved against kernel.sym and
+// samples of cmd against cmd.sym, both of which the build
+// places in the root directory.  Kernel samples count whatever
+// process was running; user samples of other processes, and
+// samples of idle CPUs, are counted but not broken down.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "ioctl.h"
+#include "prof.h"
+
+#define KERNBASE 0x80000000
+#define NTOP     20
+
+struct sym {
+  uint addr;
+  char *name;
+  int count;
+};
+
+struct symtab {
+  struct sym *s;
+  int n;
+};
+
+struct symtab ksyms, usyms;
+struct sample buf[256];
+
+static uint
+hex(char *p, char **end)
+{
+  uint v;
+
+  v = 0;
+  for(;; p++){
+    if(*p >= '0' && *p <= '9')
+      v = v*16 + *p - '0';
+    else if(*p >= 'a' && *p <= 'f')
+      v = v*16 + *p - 'a' + 10;
+    else
+      break;
+  }
+  *end = p;
+  return v;
+}
+
+// Read whole file into a nul-terminated malloc'd buffer.
+static char*
+slurp(char *path)
+{
+  struct stat st;
+  char *p;
+  int fd, n, m;
+
+  if((fd = open(path, O_RDONLY)) < 0)
+    return 0;
+  if(fstat(fd, &st) < 0 || (p = malloc(st.size + 1)) == 0){
+    close(fd);
+    return 0;
+  }
+  for(n = 0; n < st.size; n += m)
+    if((m = read(fd, p + n, st.size - n)) <= 0)
+      break;
+  p[n] = 0;
+  close(fd);
+  return p;
+}
+
+// Load "addr name" lines from path, sorted by address.
+// File names and section symbols, at address 0, are skipped.
+static void
+loadsyms(struct symtab *t, char *path)
+{
+  char *p, *q;
+  struct sym s;
+  int i, j, n;
+
+  if((p = slurp(path)) == 0){
+    printf(2, "prof: cannot read %s\n", path);
+    return;
+  }
+  n = 0;
+  for(q = p; *q; q++)
+    if(*q == '\n')
+      n++;
+  if((t->s = malloc(n * sizeof(struct sym))) == 0)
+    return;
+  t->n = 0;
+  while(*p && t->n < n){
+    s.addr = hex(p, &p);
+    if(*p == ' ')
+      p++;
+    s.name = p;
+    s.count = 0;
+    while(*p && *p != '\n')
+      p++;
+    if(*p)
+      *p++ = 0;
+    if(s.addr == 0 || s.name[0] == '.')
+      continue;
+    for(i = t->n++; i > 0 && t->s[i-1].addr > s.addr; i--)
+      t->s[i] = t->s[i-1];
+    t->s[i] = s;
+  }
+  // Keep one name per address.
+  for(i = j = 0; i < t->n; i++)
+    if(j == 0 || t->s[j-1].addr != t->s[i].addr)
+      t->s[j++] = t->s[i];
+  t->n = j;
+}
+
+// Return the symbol containing pc, or 0.
+static struct sym*
+lookup(struct symtab *t, uint pc)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = t->n;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(t->s[mid].addr <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if(lo == 0)
+    return 0;
+  return &t->s[lo-1];
+}
+
+// Print the NTOP symbols of t with the most samples.
+static void
+top(struct symtab *t, char *what, int total)
+{
+  struct sym *best;
+  int i, k;
+
+  for(k = 0; k < NTOP; k++){
+    best = 0;
+    for(i = 0; i < t->n; i++)
+      if(t->s[i].count > 0 && (best == 0 || t->s[i].count > best->count))
+        best = &t->s[i];
+    if(best == 0)
+      break;
+    printf(1, "%d\t%d%%\t%s %s\n", best->count,
+           best->count * 100 / total, what, best->name);
+    best->count = -best->count;
+  }
+  for(i = 0; i < t->n; i++)
+    if(t->s[i].count < 0)
+      t->s[i].count = -t->s[i].count;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, pid, i, n, ndrop, total, nidle, nother, nunknown;
+  char path[32];
+  struct sym *s;
+
+  if(argc < 2){
+    printf(2, "usage: prof cmd [args...]\n");
+    exit();
+  }
+  if((fd = open("prof", O_RDONLY)) < 0){
+    printf(2, "prof: cannot open prof\n");
+    exit();
+  }
+
+  ioctl(fd, PROFON, 0);
+  pid = fork();
+  if(pid == 0){
+    close(fd);
+    exec(argv[1], argv+1);
+    printf(2, "prof: exec %s failed\n", argv[1]);
+    exit();
+  }
+  if(pid > 0)
+    wait();
+  ndrop = ioctl(fd, PROFOFF, 0);
+
+  loadsyms(&ksyms, "kernel.sym");
+  if(strlen(argv[1]) + 5 <= sizeof(path)){
+    strcpy(path, argv[1]);
+    strcpy(path + strlen(path), ".sym");
+    loadsyms(&usyms, path);
+  }
+
+  total = nidle = nother = nunknown = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    for(i = 0; i < n / sizeof(struct sample); i++){
+      total++;
+      if(buf[i].pid == 0){
+        nidle++;
+        continue;
+      }
+      if(buf[i].pc >= KERNBASE)
+        s = lookup(&ksyms, buf[i].pc);
+      else if(buf[i].pid == pid)
+        s = lookup(&usyms, buf[i].pc);
+      else {
+        nother++;
+        continue;
+      }
+      if(s)
+        s->count++;
+      else
+        nunknown++;
+    }
+  }
+  close(fd);
+
+  printf(1, "%d samples, %d dropped\n", total, ndrop);
+  if(total == 0)
+    exit();
+  top(&ksyms, "kernel", total);
+  top(&usyms, argv[1], total);
+  printf(1, "%d\t%d%%\tidle\n", nidle, nidle * 100 / total);
+  printf(1, "%d\t%d%%\tother processes\n", nother, nother * 100 / total);
+  if(nunknown)
+    printf(1, "%d\t%d%%\tunknown\n", nunknown, nunknown * 100 / total);
+  exit();
+}
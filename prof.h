@@ -0,0 +1,7 @@
+// A sample of the sampling profiler, as read from the prof
+// device: the interrupted pc, and the process running, or 0
+// if the CPU was idle.  Kernel pcs are at or above KERNBASE.
+struct sample {
+  uint pc;
+  int pid;
+};
@@ -0,0 +1,122 @@
+// Sampling profiler.
+//
+// While profiling is on, each CPU's timer interrupt records
+// the pc it interrupted, user or kernel, in that CPU's sample
+// buffer.  The prof device hands out the samples: read()
+// moves as many as fit out of the buffers, and ioctl()
+// PROFON and PROFOFF start and stop sampling.  A full buffer
+// drops new samples until it is read.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "ioctl.h"
+#include "prof.h"
+
+#define NSAMPLE 1024  // samples buffered per CPU
+
+struct {
+  int on;
+  struct {
+    struct spinlock lock;
+    int n;
+    int ndrop;
+    struct sample s[NSAMPLE];
+  } cpu[NCPU];
+} prof;
+
+// Record the pc that the timer interrupt in tf interrupted.
+// Called on each CPU's timer interrupt.
+void
+profsample(struct trapframe *tf)
+{
+  struct proc *p;
+  int c;
+
+  if(!prof.on)
+    return;
+  c = cpuid();
+  p = myproc();
+  acquire(&prof.cpu[c].lock);
+  if(prof.cpu[c].n < NSAMPLE){
+    prof.cpu[c].s[prof.cpu[c].n].pc = tf->eip;
+    prof.cpu[c].s[prof.cpu[c].n].pid = p ? p->pid : 0;
+    prof.cpu[c].n++;
+  } else
+    prof.cpu[c].ndrop++;
+  release(&prof.cpu[c].lock);
+}
+
+// Move up to n bytes of samples, from all CPUs, to dst.
+static int
+profread(struct inode *ip, char *dst, int n)
+{
+  int c, m, tot;
+
+  tot = 0;
+  for(c = 0; c < ncpu; c++){
+    acquire(&prof.cpu[c].lock);
+    m = prof.cpu[c].n;
+    if(m > (n - tot) / sizeof(struct sample))
+      m = (n - tot) / sizeof(struct sample);
+    memmove(dst + tot, prof.cpu[c].s, m * sizeof(struct sample));
+    memmove(prof.cpu[c].s, prof.cpu[c].s + m,
+            (prof.cpu[c].n - m) * sizeof(struct sample));
+    prof.cpu[c].n -= m;
+    tot += m * sizeof(struct sample);
+    release(&prof.cpu[c].lock);
+  }
+  return tot;
+}
+
+static int
+profwrite(struct inode *ip, char *src, int n)
+{
+  return -1;
+}
+
+// PROFON discards old samples and starts sampling;
+// PROFOFF stops it, reporting how many samples were dropped.
+static int
+profioctl(struct inode *ip, int req, int arg)
+{
+  int c, ndrop;
+
+  switch(req){
+  case PROFON:
+    for(c = 0; c < ncpu; c++){
+      acquire(&prof.cpu[c].lock);
+      prof.cpu[c].n = 0;
+      prof.cpu[c].ndrop = 0;
+      release(&prof.cpu[c].lock);
+    }
+    prof.on = 1;
+    return 0;
+  case PROFOFF:
+    prof.on = 0;
+    ndrop = 0;
+    for(c = 0; c < ncpu; c++)
+      ndrop += prof.cpu[c].ndrop;
+    return ndrop;
+  }
+  return -1;
+}
+
+void
+profinit(void)
+{
+  int c;
+
+  for(c = 0; c < NCPU; c++)
+    initlock(&prof.cpu[c].lock, "prof");
+  devsw[PROF].read = profread;
+  devsw[PROF].write = profwrite;
+  devsw[PROF].ioctl = profioctl;
+}
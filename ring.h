@@ -0,0 +1,37 @@
+// A byte queue with one producer, a device's interrupt handler,
+// and one consumer, consd (see console.c).  Only the producer
+// writes w and only the consumer writes r, so neither needs a
+// lock; the barriers order each byte against its index.
+#define RINGSIZE 1024
+
+struct ring {
+  uchar buf[RINGSIZE];
+  volatile uint r;     // next byte to take
+  volatile uint w;     // next free slot
+};
+
+// Queue c, or drop it if the ring is full.
+static inline void
+ringput(struct ring *rg, int c)
+{
+  if(rg->w - rg->r == RINGSIZE)
+    return;
+  rg->buf[rg->w % RINGSIZE] = c;
+  __sync_synchronize();
+  rg->w++;
+}
+
+// Take the next byte, or return -1 if there is none.
+static inline int
+ringget(struct ring *rg)
+{
+  int c;
+
+  if(rg->r == rg->w)
+    return -1;
+  __sync_synchronize();
+  c = rg->buf[rg->r % RINGSIZE];
+  __sync_synchronize();
+  rg->r++;
+  return c;
+}
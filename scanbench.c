@@ -0,0 +1,166 @@
+// Time the word-at-a-time scanning routines in ulib.c against
+// the byte-at-a-time tests find_sum and wc used before, over a
+// generated file of numbers and words, in bytes per cycle.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define SIZE  (512*1024)
+#define ROUNDS 4
+
+char *data;
+uint seed = 1;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+static inline uint
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return lo;
+}
+
+// Write a file of lines of words of letters or digits, and read
+// it back into data.
+void
+generate(void)
+{
+  char *p, *e;
+  int fd, i, n;
+
+  p = data;
+  e = data + SIZE;
+  while(p < e){
+    n = 1 + rand() % 12;
+    for(i = 0; i < n && p < e; i++)
+      *p++ = rand() % 3 ? '0' + rand() % 10 : 'a' + rand() % 26;
+    if(p < e)
+      *p++ = rand() % 8 ? ' ' : '\n';
+  }
+
+  fd = open("scanbench.dat", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, data, SIZE) != SIZE){
+    printf(2, "scanbench: cannot write scanbench.dat\n");
+    exit();
+  }
+  close(fd);
+  memset(data, 0, SIZE);
+  fd = open("scanbench.dat", O_RDONLY);
+  for(i = 0; i < SIZE; i += n)
+    if((n = read(fd, data + i, SIZE - i)) <= 0){
+      printf(2, "scanbench: cannot read scanbench.dat\n");
+      exit();
+    }
+  close(fd);
+  unlink("scanbench.dat");
+}
+
+int
+digitsbytes(void)
+{
+  int i, runs;
+
+  runs = 0;
+  for(i = 0; i < SIZE; i++)
+    if(data[i] >= '0' && data[i] <= '9' &&
+       (i == 0 || data[i-1] < '0' || data[i-1] > '9'))
+      runs++;
+  return runs;
+}
+
+int
+digitsspan(void)
+{
+  char *p, *e;
+  int runs;
+
+  runs = 0;
+  for(p = data, e = data + SIZE; p < e; ){
+    p += spannondigit(p, e - p);
+    if(p < e){
+      runs++;
+      p += spandigit(p, e - p);
+    }
+  }
+  return runs;
+}
+
+int
+wordsbytes(void)
+{
+  int i, words, inword;
+
+  words = inword = 0;
+  for(i = 0; i < SIZE; i++){
+    if(strchr(" \r\t\n\v", data[i]))
+      inword = 0;
+    else if(!inword){
+      words++;
+      inword = 1;
+    }
+  }
+  return words;
+}
+
+int
+wordsspan(void)
+{
+  char *p, *e;
+  int words;
+
+  words = 0;
+  for(p = data, e = data + SIZE; p < e; ){
+    if(isspace(*p))
+      p++;
+    else {
+      words++;
+      p += spanword(p, e - p);
+    }
+  }
+  return words;
+}
+
+// Print how many bytes per cycle f scans, to three places.
+void
+run(char *name, int (*f)(void))
+{
+  uint t, best, r;
+  int i, n;
+
+  best = 0;
+  n = 0;
+  for(i = 0; i < ROUNDS; i++){
+    t = rdtsc();
+    n = f();
+    t = rdtsc() - t;
+    if(best == 0 || t < best)
+      best = t;
+  }
+  r = (uint)SIZE * 1000 / best;
+  printf(1, "%s: %d runs, %d.%d%d%d bytes/cycle\n", name, n,
+         r / 1000, r / 100 % 10, r / 10 % 10, r % 10);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if((data = malloc(SIZE)) == 0){
+    printf(2, "scanbench: out of memory\n");
+    exit();
+  }
+  generate();
+  run("digits, bytewise", digitsbytes);
+  run("digits, spandigit", digitsspan);
+  run("words, bytewise", wordsbytes);
+  run("words, spanword", wordsspan);
+  exit();
+}
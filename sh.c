@@ -1,8 +1,12 @@
 // Shell.
 
 #include "types.h"
+#include "stat.h"
 #include "user.h"
 #include "fcntl.h"
+#include "fs.h"
+#include "spawn.h"
+#include "wait.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +56,9 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+char *lookup(char*);
+void waitfg(int);
+void forget(char*);
 
 // Execute cmd.  Never returns.
 void
@@ -75,7 +82,7 @@ runcmd(struct cmd *cmd)
     ecmd = (struct execcmd*)cmd;
     if(ecmd->argv[0] == 0)
       exit();
-    exec(ecmd->argv[0], ecmd->argv);
+    exec(lookup(ecmd->argv[0]), ecmd->argv);
     printf(2, "exec %s failed\n", ecmd->argv[0]);
     break;
 
@@ -130,9 +137,184 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Return how many spawn() file actions the programs of cmd
+// need at most, or -1 if cmd is not just programs, redirections
+// and pipes, and so needs runcmd() in a copy of the shell.
+int
+spawnacts(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+  int l, r;
+
+  switch(cmd->type){
+  case EXEC:
+    return 0;
+  case REDIR:
+    if((l = spawnacts(((struct redircmd*)cmd)->cmd)) < 0)
+      return -1;
+    return l + 1;
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if((l = spawnacts(pcmd->left)) < 0 || (r = spawnacts(pcmd->right)) < 0)
+      return -1;
+    return 3 + (l > r ? l : r);
+  }
+  return -1;
+}
+
+// Start the programs of cmd with spawn(), each with the file
+// actions act[0..nact) and those of its redirections and pipes,
+// which are appended to act.  Returns how many were started.
+int
+spawntree(struct cmd *cmd, struct spawnact *act, int nact)
+{
+  int p[2], n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+  struct spawnact *a;
+
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(lookup(ecmd->argv[0]), ecmd->argv, act, nact) < 0){
+      forget(ecmd->argv[0]);
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    a = &act[nact];
+    a->op = SPAWN_OPEN;
+    a->fd = rcmd->fd;
+    a->arg = rcmd->mode;
+    a->path = rcmd->file;
+    return spawntree(rcmd->cmd, act, nact+1);
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0)
+      panic("pipe");
+    a = &act[nact];
+    a[0].op = SPAWN_DUP;
+    a[0].fd = 1;
+    a[0].arg = p[1];
+    a[1].op = SPAWN_CLOSE;
+    a[1].fd = p[0];
+    a[2].op = SPAWN_CLOSE;
+    a[2].fd = p[1];
+    n = spawntree(pcmd->left, act, nact+3);
+    a[0].fd = 0;
+    a[0].arg = p[0];
+    n += spawntree(pcmd->right, act, nact+3);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  panic("spawntree");
+  return 0;
+}
+
+// Run cmd in children spawn()ed straight from their programs,
+// skipping the copy of the shell that fork() would make, and
+// wait for them.  Children do not get the history file histfd.
+// Returns 0 if cmd needs a forked shell instead.
+int
+spawncmd(struct cmd *cmd, int histfd)
+{
+  struct spawnact act[NSPAWNACT];
+  int n, nact;
+
+  nact = histfd >= 0;
+  if((n = spawnacts(cmd)) < 0 || nact + n > NSPAWNACT)
+    return 0;
+  if(histfd >= 0){
+    act[0].op = SPAWN_CLOSE;
+    act[0].fd = histfd;
+  }
+  waitfg(spawntree(cmd, act, nact));
+  return 1;
+}
+
+//PAGEBREAK!
+// Background jobs: lines ending in &, which the shell starts
+// and reaps without waiting for them.
+
+#define NJOB 16
+
+struct job {
+  int pid;         // 0 if the slot is free
+  char line[100];
+} job[NJOB];
+
+// Start cmd, the command of line before its &, as a job.
+void
+startjob(struct cmd *cmd, char *line, int histfd)
+{
+  int i, pid;
+
+  for(i = 0; i < NJOB && job[i].pid; i++)
+    ;
+  if(i == NJOB){
+    printf(2, "too many jobs\n");
+    return;
+  }
+  if((pid = fork1()) == 0){
+    if(histfd >= 0)
+      close(histfd);
+    runcmd(cmd);
+  }
+  job[i].pid = pid;
+  strcpy(job[i].line, line);
+  printf(2, "[%d] %d\n", i+1, pid);
+}
+
+// Note that child pid has exited.  Return 0 if it was not a job.
+int
+jobdone(int pid)
+{
+  int i;
+
+  for(i = 0; i < NJOB; i++){
+    if(job[i].pid == pid){
+      printf(2, "[%d] done  %s", i+1, job[i].line);
+      job[i].pid = 0;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Wait for n children that are not jobs, reaping
+// any jobs that finish meanwhile.
+void
+waitfg(int n)
+{
+  int pid;
+
+  while(n > 0 && (pid = wait()) >= 0)
+    if(!jobdone(pid))
+      n--;
+}
+
+// Reap the jobs that have finished, without waiting.
+void
+reapjobs(void)
+{
+  int pid;
+
+  while((pid = waitpid(-1, WNOHANG)) > 0)
+    jobdone(pid);
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
+  reapjobs();
   printf(2, "$ ");
   memset(buf, 0, nbuf);
   gets(buf, nbuf);
@@ -141,11 +323,228 @@ getcmd(char *buf, int nbuf)
   return 0;
 }
 
+// Open the history file, where commands typed at the console
+// are saved for the console to recall after the next boot, and
+// move to its end.  Return -1 if input is not the console.
+int
+openhistory(void)
+{
+  struct stat st;
+  char buf[512];
+  int fd;
+
+  if(fstat(0, &st) < 0 || st.type != T_DEV)
+    return -1;
+  if((fd = open("/.history", O_CREATE|O_RDWR)) < 0)
+    return -1;
+  while(read(fd, buf, sizeof(buf)) > 0)
+    ;
+  return fd;
+}
+
+//PAGEBREAK!
+// Built-in commands, which run in the shell without a child.
+
+#define NHIST 16   // lines history remembers
+
+char hist[NHIST][100];
+int nhist;           // lines typed so far
+char cwd[128] = "/"; // the current directory, as cd has moved it
+
+// Move cwd along path, as chdir(path) just did.
+void
+movecwd(char *path)
+{
+  char *s, *e, *end;
+  int n;
+
+  if(*path == '/')
+    cwd[1] = 0;
+  for(s = path; *s; s = e){
+    while(*s == '/')
+      s++;
+    for(e = s; *e && *e != '/'; e++)
+      ;
+    n = e - s;
+    end = cwd + strlen(cwd);
+    if(n == 0 || (n == 1 && s[0] == '.'))
+      continue;
+    if(n == 2 && s[0] == '.' && s[1] == '.'){
+      while(end > cwd+1 && end[-1] != '/')
+        end--;
+      if(end > cwd+1)
+        end--;
+      *end = 0;
+      continue;
+    }
+    if(end - cwd + n + 2 > sizeof(cwd))
+      return;
+    if(end > cwd+1)
+      *end++ = '/';
+    memmove(end, s, n);
+    end[n] = 0;
+  }
+}
+
+void
+cd(char **argv)
+{
+  char *dir;
+
+  dir = argv[1] ? argv[1] : "/";
+  if(chdir(dir) < 0){
+    printf(2, "cannot cd %s\n", dir);
+    return;
+  }
+  movecwd(dir);
+  forget(0);   // programs may now be found elsewhere
+}
+
+void
+echo(char **argv)
+{
+  int i;
+
+  for(i = 1; argv[i]; i++)
+    printf(1, "%s%s", argv[i], argv[i+1] ? " " : "\n");
+  if(i == 1)
+    printf(1, "\n");
+}
+
+void
+pwd(char **argv)
+{
+  printf(1, "%s\n", cwd);
+}
+
+void
+history(char **argv)
+{
+  int i;
+
+  for(i = nhist > NHIST ? nhist - NHIST : 0; i < nhist; i++)
+    printf(1, "%d %s", i + 1, hist[i % NHIST]);
+}
+
+void
+jobs(char **argv)
+{
+  int i;
+
+  for(i = 0; i < NJOB; i++)
+    if(job[i].pid)
+      printf(1, "[%d] %d  %s", i+1, job[i].pid, job[i].line);
+}
+
+// wait [n]: wait for job n, or for all jobs.
+void
+waitjobs(char **argv)
+{
+  int i, pid;
+
+  if(argv[1]){
+    i = atoi(argv[1]) - 1;
+    if(i < 0 || i >= NJOB || job[i].pid == 0){
+      printf(2, "wait: no job %s\n", argv[1]);
+      return;
+    }
+    if(waitpid(job[i].pid, 0) > 0)
+      jobdone(job[i].pid);
+    return;
+  }
+  while((pid = waitpid(-1, 0)) > 0)
+    jobdone(pid);
+}
+
+struct builtin {
+  char *name;
+  void (*fn)(char**);
+} builtins[] = {
+  { "cd", cd },
+  { "echo", echo },
+  { "history", history },
+  { "jobs", jobs },
+  { "pwd", pwd },
+  { "wait", waitjobs },
+};
+
+// Run cmd in the shell if it is a built-in command without
+// redirections.  Returns 0 if it is not.
+int
+runbuiltin(struct cmd *cmd)
+{
+  struct execcmd *ecmd;
+  int i;
+
+  if(cmd->type != EXEC)
+    return 0;
+  ecmd = (struct execcmd*)cmd;
+  if(ecmd->argv[0] == 0)
+    return 1;
+  for(i = 0; i < sizeof(builtins)/sizeof(builtins[0]); i++){
+    if(strcmp(ecmd->argv[0], builtins[i].name) == 0){
+      builtins[i].fn(ecmd->argv);
+      fflush(1);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Where the programs that commands name were found: in the
+// current directory, or else in /.  cd empties the cache, and
+// a program that fails to run is dropped from it.
+
+#define NLOOKUP 16
+
+struct {
+  char name[DIRSIZ+1];
+  char path[DIRSIZ+2];   // name or /name
+} found[NLOOKUP];
+int nextfound;           // slot to replace next
+
+// Return the path of the program called name.
+char*
+lookup(char *name)
+{
+  static char root[DIRSIZ+2];
+  struct stat st;
+  int i;
+
+  if(strchr(name, '/') || strlen(name) > DIRSIZ)
+    return name;
+  for(i = 0; i < NLOOKUP; i++)
+    if(found[i].name[0] && strcmp(found[i].name, name) == 0)
+      return found[i].path;
+  root[0] = '/';
+  strcpy(root+1, name);
+  if(stat(name, &st) >= 0)
+    strcpy(root, name);
+  else if(stat(root, &st) < 0)
+    return name;
+  i = nextfound++ % NLOOKUP;
+  strcpy(found[i].name, name);
+  strcpy(found[i].path, root);
+  return found[i].path;
+}
+
+// Drop name from the cache, or everything if name is 0.
+void
+forget(char *name)
+{
+  int i;
+
+  for(i = 0; i < NLOOKUP; i++)
+    if(name == 0 || strcmp(found[i].name, name) == 0)
+      found[i].name[0] = 0;
+}
+
 int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, histfd, pid;
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -155,18 +554,30 @@ main(void)
     }
   }
 
+  histfd = openhistory();
+
   // Read and run input commands.
   while(getcmd(buf, sizeof(buf)) >= 0){
-    if(buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' '){
-      // Chdir must be called by the parent, not the child.
-      buf[strlen(buf)-1] = 0;  // chop \n
-      if(chdir(buf+3) < 0)
-        printf(2, "cannot cd %s\n", buf+3);
+    if(buf[0] != '\n'){
+      if(histfd >= 0)
+        write(histfd, buf, strlen(buf));
+      strcpy(hist[nhist++ % NHIST], buf);
+    }
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(cmd->type == BACK){
+      // hist keeps the line whole; parsecmd has cut up buf.
+      startjob(((struct backcmd*)cmd)->cmd, hist[(nhist-1) % NHIST], histfd);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if(runbuiltin(cmd) || spawncmd(cmd, histfd))
+      continue;
+    if((pid = fork1()) == 0){
+      if(histfd >= 0)
+        close(histfd);
+      runcmd(cmd);
+    }
+    waitpid(pid, 0);
   }
   exit();
 }
@@ -192,13 +603,32 @@ fork1(void)
 //PAGEBREAK!
 // Constructors
 
+// A line's nodes come from arena, which parsecmd empties before
+// parsing the next line; a line of at most 100 characters
+// cannot need more.
+char arena[16384];
+uint arenaused;
+
+void*
+alloccmd(uint n)
+{
+  void *p;
+
+  n = (n + 3) & ~3;
+  if(arenaused + n > sizeof(arena))
+    panic("arena");
+  p = arena + arenaused;
+  arenaused += n;
+  memset(p, 0, n);
+  return p;
+}
+
 struct cmd*
 execcmd(void)
 {
   struct execcmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
-  memset(cmd, 0, sizeof(*cmd));
+  cmd = alloccmd(sizeof(*cmd));
   cmd->type = EXEC;
   return (struct cmd*)cmd;
 }
@@ -208,8 +638,7 @@ redircmd(struct cmd *subcmd, char *file, char *efile, int mode, int fd)
 {
   struct redircmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
-  memset(cmd, 0, sizeof(*cmd));
+  cmd = alloccmd(sizeof(*cmd));
   cmd->type = REDIR;
   cmd->cmd = subcmd;
   cmd->file = file;
@@ -224,8 +653,7 @@ pipecmd(struct cmd *left, struct cmd *right)
 {
   struct pipecmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
-  memset(cmd, 0, sizeof(*cmd));
+  cmd = alloccmd(sizeof(*cmd));
   cmd->type = PIPE;
   cmd->left = left;
   cmd->right = right;
@@ -237,8 +665,7 @@ listcmd(struct cmd *left, struct cmd *right)
 {
   struct listcmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
-  memset(cmd, 0, sizeof(*cmd));
+  cmd = alloccmd(sizeof(*cmd));
   cmd->type = LIST;
   cmd->left = left;
   cmd->right = right;
@@ -250,8 +677,7 @@ backcmd(struct cmd *subcmd)
 {
   struct backcmd *cmd;
 
-  cmd = malloc(sizeof(*cmd));
-  memset(cmd, 0, sizeof(*cmd));
+  cmd = alloccmd(sizeof(*cmd));
   cmd->type = BACK;
   cmd->cmd = subcmd;
   return (struct cmd*)cmd;
@@ -324,19 +750,36 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The shell itself parses commands, so a syntax error must not
+// exit: it is reported, and parsing winds up as best it can.
+int parseerr;
+
+void
+syntax(char *msg)
+{
+  if(!parseerr)
+    printf(2, "%s\n", msg);
+  parseerr = 1;
+}
+
+// Parse the command line s, or return 0 if it is malformed.
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
+  arenaused = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
   }
+  if(parseerr)
+    return 0;
   nulterminate(cmd);
   return cmd;
 }
@@ -379,8 +822,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +850,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +878,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc == MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -0,0 +1,163 @@
+// Named shared memory segments.
+//
+// A segment is a set of zeroed physical pages with a name.
+// shmcreate() makes one and maps it into the caller, and
+// shmattach() maps an existing one; every process that attaches
+// it maps the same pages, writable, so data written by one is
+// seen by all without copying.  The mappings are vmas, like
+// those of mmap(), whose pages are mapped when attached and
+// are inherited by fork() without copy-on-write (see PTE_SHARED
+// in sharepage()).  The segment holds a reference to each of
+// its pages, as does each mapping; the segment is freed when
+// the last process detaches, by shmdetach(), exit() or exec().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "shm.h"
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+static struct shm*
+shmlookup(char *name)
+{
+  struct shm *s;
+
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++)
+    if(s->ref > 0 && strncmp(s->name, name, SHMNAME) == 0)
+      return s;
+  return 0;
+}
+
+// Find the segment called name, or with npage > 0 make it.
+// Returns the segment with a reference for the caller,
+// or 0 if it does not exist, or already does when npage > 0.
+static struct shm*
+shmget(char *name, int npage)
+{
+  struct shm *s;
+  int i;
+
+  acquire(&shmtab.lock);
+  s = shmlookup(name);
+  if(npage == 0){
+    if(s)
+      s->ref++;
+    release(&shmtab.lock);
+    return s;
+  }
+  if(s){
+    release(&shmtab.lock);
+    return 0;
+  }
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++)
+    if(s->ref == 0)
+      break;
+  if(s == &shmtab.shm[NSHM]){
+    release(&shmtab.lock);
+    return 0;
+  }
+  for(i = 0; i < npage; i++){
+    if((s->page[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(s->page[i]);
+      release(&shmtab.lock);
+      return 0;
+    }
+    memset(s->page[i], 0, PGSIZE);
+  }
+  safestrcpy(s->name, name, SHMNAME);
+  s->npage = npage;
+  s->ref = 1;
+  release(&shmtab.lock);
+  return s;
+}
+
+// Take another reference to s, for a forked child.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop a reference to s, freeing it with the last.
+void
+shmput(struct shm *s)
+{
+  int i;
+
+  acquire(&shmtab.lock);
+  if(--s->ref == 0){
+    for(i = 0; i < s->npage; i++)
+      kfree(s->page[i]);
+    s->npage = 0;
+    s->name[0] = 0;
+  }
+  release(&shmtab.lock);
+}
+
+// Map s into the current process, handing it the caller's
+// reference.  Returns the address, or -1.
+static int
+shmattach(struct shm *s)
+{
+  int va;
+
+  if((va = mmapshm(s)) < 0)
+    shmput(s);
+  return va;
+}
+
+int
+sys_shmcreate(void)
+{
+  char *name;
+  int size;
+  struct shm *s;
+
+  if(argstr(0, &name) < 0 || argint(1, &size) < 0)
+    return -1;
+  if(size <= 0 || size > SHMMAX*PGSIZE)
+    return -1;
+  if((s = shmget(name, PGROUNDUP(size) / PGSIZE)) == 0)
+    return -1;
+  return shmattach(s);
+}
+
+int
+sys_shmattach(void)
+{
+  char *name;
+  struct shm *s;
+
+  if(argstr(0, &name) < 0)
+    return -1;
+  if((s = shmget(name, 0)) == 0)
+    return -1;
+  return shmattach(s);
+}
+
+int
+sys_shmdetach(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return munmapshm(addr);
+}
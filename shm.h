@@ -0,0 +1,10 @@
+#define NSHM     16    // shared memory segments
+#define SHMMAX   256   // pages per segment
+#define SHMNAME  16    // bytes of a segment's name, with the nul
+
+struct shm {
+  char name[SHMNAME];
+  int npage;
+  char *page[SHMMAX];
+  int ref;             // mappings, 0 if the slot is unused
+};
@@ -0,0 +1,229 @@
+// Slab allocator for small fixed-size kernel objects,
+// built on kalloc().
+//
+// A cache hands out objects of one size, carved from slabs:
+// pages that start with a struct slab header, followed by as
+// many objects as fit.  Each CPU keeps a magazine of free
+// objects for each cache, which it allocates from and frees to
+// with interrupts off and no lock; only when its magazine is
+// empty or full does it move a batch of KMBATCH objects to or
+// from the slabs under the cache's lock.  A slab whose objects
+// are all free goes back to kfree(), unless it is the cache's
+// last one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NKMCACHE  8    // maximum number of caches
+#define KMAG      16   // max objects in a per-CPU magazine
+#define KMBATCH   8    // objects moved between a magazine and the slabs
+
+struct obj {
+  struct obj *next;
+};
+
+struct slab {
+  struct kmcache *cache;
+  struct slab *next;   // list of slabs with free objects
+  struct slab *prev;
+  struct obj *free;    // free objects in this slab
+  int inuse;           // objects out of the slab
+};
+
+// Objects start past the header, 8-byte aligned.
+#define SLABHDR  ((sizeof(struct slab) + 7) & ~7)
+
+struct magazine {
+  int n;
+  void *obj[KMAG];
+};
+
+struct kmcache {
+  struct spinlock lock;
+  char *name;
+  uint size;           // bytes per object
+  int perslab;         // objects per slab
+  struct slab *partial;  // slabs with free objects
+  int nslab;
+  int nout;            // objects out of slabs, incl. magazines
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmcache cache[NKMCACHE];
+  int n;
+} kmtab;
+
+void
+kminit(void)
+{
+  initlock(&kmtab.lock, "kmtab");
+}
+
+// Make a cache of size-byte objects.  Caches are never destroyed.
+struct kmcache*
+kmcreate(char *name, uint size)
+{
+  struct kmcache *c;
+
+  size = (size + 7) & ~7;
+  if(size < sizeof(struct obj) || size > PGSIZE - SLABHDR)
+    panic("kmcreate: size");
+  acquire(&kmtab.lock);
+  if(kmtab.n == NKMCACHE)
+    panic("kmcreate: too many caches");
+  c = &kmtab.cache[kmtab.n++];
+  release(&kmtab.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  return c;
+}
+
+static void
+unlinkslab(struct kmcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+linkslab(struct kmcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Take an object from c's slabs, making a new slab if need be.
+// Caller must hold c->lock.
+static void*
+slaballoc(struct kmcache *c)
+{
+  struct slab *s;
+  struct obj *o;
+  char *p;
+  int i;
+
+  if((s = c->partial) == 0){
+    if((s = (struct slab*)kalloc()) == 0)
+      return 0;
+    s->cache = c;
+    s->free = 0;
+    s->inuse = 0;
+    p = (char*)s + SLABHDR;
+    for(i = 0; i < c->perslab; i++, p += c->size){
+      o = (struct obj*)p;
+      o->next = s->free;
+      s->free = o;
+    }
+    linkslab(c, s);
+    c->nslab++;
+  }
+  o = s->free;
+  s->free = o->next;
+  s->inuse++;
+  if(s->free == 0)
+    unlinkslab(c, s);
+  c->nout++;
+  return o;
+}
+
+// Put object v back in its slab.  Caller must hold c->lock.
+static void
+slabfree(struct kmcache *c, void *v)
+{
+  struct slab *s;
+  struct obj *o;
+
+  s = (struct slab*)PGROUNDDOWN((uint)v);
+  if(s->cache != c)
+    panic("kmfree: wrong cache");
+  if(s->free == 0)
+    linkslab(c, s);
+  o = (struct obj*)v;
+  o->next = s->free;
+  s->free = o;
+  s->inuse--;
+  c->nout--;
+  if(s->inuse == 0 && c->nslab > 1){
+    unlinkslab(c, s);
+    c->nslab--;
+    kfree((char*)s);
+  }
+}
+
+// Allocate a zeroed object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+kmalloc(struct kmcache *c)
+{
+  struct magazine *m;
+  void *v;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < KMBATCH && (v = slaballoc(c)) != 0)
+      m->obj[m->n++] = v;
+    release(&c->lock);
+  }
+  v = 0;
+  if(m->n > 0)
+    v = m->obj[--m->n];
+  popcli();
+  if(v)
+    memset(v, 0, c->size);
+  return v;
+}
+
+// Free object v, which kmalloc(c) returned.
+void
+kmfree(struct kmcache *c, void *v)
+{
+  struct magazine *m;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == KMAG){
+    acquire(&c->lock);
+    while(m->n > KMAG - KMBATCH)
+      slabfree(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = v;
+  popcli();
+}
+
+// Print each cache's slabs and objects in use.
+// Runs when user types ^P on console.
+// No lock to avoid wedging a stuck machine further.
+void
+kmdump(void)
+{
+  struct kmcache *c;
+  int i, inuse;
+
+  for(c = kmtab.cache; c < &kmtab.cache[kmtab.n]; c++){
+    inuse = c->nout;
+    for(i = 0; i < ncpu; i++)
+      inuse -= c->mag[i].n;
+    cprintf("%s: %d-byte objects, %d in use, %d slabs of %d\n",
+            c->name, c->size, inuse, c->nslab, c->perslab);
+  }
+}
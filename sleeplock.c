@@ -1,4 +1,10 @@
 // Sleeping locks
+//
+// A process that finds the lock held spins for a while, rather
+// than sleeping, if the holder is running on another CPU: buffer
+// and inode locks are mostly held for a few microseconds of
+// copying, less than a sleep and a wakeup cost.  It sleeps once
+// the holder blocks or is preempted, or after SPINCYCLES.
 
 #include "types.h"
 #include "defs.h"
@@ -10,32 +16,85 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 
+#define SPINCYCLES 20000  // TSC cycles to spin at most, ~10us
+
+// Wait, without lk->lk, while lk is held by a process running on
+// another CPU.  The owner may release the lock and exit as we
+// look; the locked test keeps a stale owner from counting for
+// more than one turn.  Returns the number of turns.
+static uint
+spinwait(struct sleeplock *lk)
+{
+  struct proc *owner;
+  uint t0, spins;
+
+  t0 = rdtsc();
+  for(spins = 0; *(volatile uint*)&lk->locked; spins++){
+    owner = *(struct proc* volatile*)&lk->owner;
+    if(owner == 0 || *(volatile enum procstate*)&owner->state != RUNNING)
+      break;
+    if(rdtsc() - t0 >= SPINCYCLES)
+      break;
+    pause();
+  }
+  return spins;
+}
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
+  lk->stat = findstat(name);
+  lk->stat->sleep = 1;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint spins;
+  int waited, slept;
+
+  spins = 0;
+  waited = slept = 0;
+  if(lk->locked){
+    waited = 1;
+    spins = spinwait(lk);
+  }
   acquire(&lk->lk);
   while (lk->locked) {
+    waited = slept = 1;
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
+
+  xadd(&lk->stat->nacquire, 1);
+  if(waited){
+    xadd(&lk->stat->ncontend, 1);
+    xadd(&lk->stat->nspin, spins);
+    xadd(slept ? &lk->stat->nslept : &lk->stat->nspun, 1);
+  }
+  lk->tacquire = rdtsc();
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
+  uint t;
+
+  t = rdtsc() - lk->tacquire;
+  if(t > lk->stat->maxhold)
+    lk->stat->maxhold = t;
+
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
   wakeup(lk);
   release(&lk->lk);
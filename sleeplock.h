@@ -2,9 +2,14 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
-  
+  struct proc *owner; // Process holding lock, for acquiresleep's spin
+
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For contention statistics:
+  struct lockstat *stat;  // Counters shared by locks of this name.
+  uint tacquire;     // Low 32 bits of the TSC when acquired.
 };
 
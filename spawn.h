@@ -0,0 +1,14 @@
+// spawn() file actions, applied in order to the child's copy
+// of the caller's open files before its program starts.
+#define SPAWN_OPEN   1   // open path with mode arg as fd
+#define SPAWN_DUP    2   // make fd a copy of fd arg
+#define SPAWN_CLOSE  3   // close fd
+
+#define NSPAWNACT    16  // actions per spawn()
+
+struct spawnact {
+  int op;
+  int fd;
+  int arg;
+  char *path;
+};
@@ -9,12 +9,55 @@
 #include "proc.h"
 #include "spinlock.h"
 
+// Contention statistics, one entry per lock name, so that
+// the locks of every pipe or buffer are counted together.
+// Entries are never freed; names past NLOCKSTAT-1 share the
+// last entry.  The counters are bumped with locked adds, but
+// maxhold is kept without a lock and may miss a racing update.
+struct {
+  uint lock;         // xchg spin lock; initlock can't use acquire
+  struct lockstat stat[NLOCKSTAT];
+  int n;
+} locks;
+
+// Not pushcli(): initlock() runs before mpinit() has found
+// the CPUs, when mycpu() would panic.
+struct lockstat*
+findstat(char *name)
+{
+  struct lockstat *s;
+  uint eflags;
+
+  eflags = readeflags();
+  cli();
+  while(xchg(&locks.lock, 1) != 0)
+    ;
+  for(s = locks.stat; s < &locks.stat[locks.n]; s++)
+    if(strncmp(s->name, name, 16) == 0)
+      goto found;
+  if(locks.n < NLOCKSTAT){
+    s = &locks.stat[locks.n++];
+    s->name = name;
+  } else {
+    s = &locks.stat[NLOCKSTAT-1];
+    s->name = "(other)";
+  }
+found:
+  xchg(&locks.lock, 0);
+  if(eflags & FL_IF)
+    sti();
+  return s;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->stat = findstat(name);
 }
 
 // Acquire the lock.
@@ -24,13 +67,34 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint spins;
+#if TICKETLOCK
+  uint ticket;
+#endif
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
+#if TICKETLOCK
+  // Take a ticket and wait for it to be served, so CPUs get
+  // the lock in the order they asked, and waiters only read
+  // the lock's cache line until it is their turn.
+  spins = 0;
+  ticket = xadd(&lk->next, 1);
+  while(*(volatile uint*)&lk->owner != ticket){
+    pause();
+    spins++;
+  }
+  lk->locked = 1;
+#else
   // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  spins = 0;
+  while(xchg(&lk->locked, 1) != 0){
+    pause();
+    spins++;
+  }
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,15 +104,30 @@ acquire(struct spinlock *lk)
   // Record info about lock acquisition for debugging.
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+
+  if(lk->stat){
+    xadd(&lk->stat->nacquire, 1);
+    if(spins){
+      xadd(&lk->stat->ncontend, 1);
+      xadd(&lk->stat->nspin, spins);
+    }
+  }
+  lk->tacquire = rdtsc();
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint t;
+
   if(!holding(lk))
     panic("release");
 
+  t = rdtsc() - lk->tacquire;
+  if(lk->stat && t > lk->stat->maxhold)
+    lk->stat->maxhold = t;
+
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
@@ -63,10 +142,39 @@ release(struct spinlock *lk)
   // This code can't use a C assignment, since it might
   // not be atomic. A real OS would use C atomics here.
   asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+#if TICKETLOCK
+  // Only the holder writes owner, so a plain add serves
+  // the next ticket.
+  asm volatile("incl %0" : "+m" (lk->owner) : );
+#endif
 
   popcli();
 }
 
+// Print each lock name's counters.
+// Runs when user types ^P on console.
+// No lock to avoid wedging a stuck machine further.
+void
+lockdump(void)
+{
+  struct lockstat *s;
+  uint mhz;
+
+  // Show hold times in microseconds once the TSC's rate is known.
+  mhz = tsckhz / 1000;
+  cprintf("lock: acquired contended spins maxhold(%s) [spun slept]\n",
+          mhz ? "us" : "cycles");
+  for(s = locks.stat; s < &locks.stat[locks.n]; s++){
+    if(s->nacquire == 0)
+      continue;
+    cprintf("%s: %d %d %d %d", s->name, s->nacquire,
+            s->ncontend, s->nspin, mhz ? s->maxhold / mhz : s->maxhold);
+    if(s->sleep)
+      cprintf(" %d %d", s->nspun, s->nslept);
+    cprintf("\n");
+  }
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint pcs[])
@@ -1,11 +1,28 @@
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out (TICKETLOCK)
+  uint owner;        // Ticket now being served (TICKETLOCK)
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+
+  // For contention statistics:
+  struct lockstat *stat;  // Counters shared by locks of this name.
+  uint tacquire;     // Low 32 bits of the TSC when acquired.
 };
 
+// Counters for all the locks that share a name.
+struct lockstat {
+  char *name;
+  uint nacquire;     // Acquisitions
+  uint ncontend;     // Acquisitions that had to wait
+  uint nspin;        // Times round the wait loop
+  uint maxhold;      // Longest hold, in TSC cycles
+  int sleep;         // Counts sleep-locks, whose waits end in one of:
+  uint nspun;        //   spinning while the holder ran on another CPU
+  uint nslept;       //   sleeping until the holder released the lock
+};
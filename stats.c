@@ -0,0 +1,41 @@
+// The stats device: a snapshot of the memory and cache counters
+// in struct sysstat, gathered from the modules that keep them.
+// See top.c.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stats.h"
+
+static int
+statsread(struct inode *ip, char *dst, int n)
+{
+  struct sysstat st;
+
+  if(n < sizeof(st))
+    return -1;
+  memset(&st, 0, sizeof(st));
+  kallocstat(&st);
+  bstat(&st);
+  logstat(&st);
+  istat(&st);
+  memmove(dst, &st, sizeof(st));
+  return sizeof(st);
+}
+
+static int
+statswrite(struct inode *ip, char *src, int n)
+{
+  return -1;
+}
+
+void
+statsinit(void)
+{
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
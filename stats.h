@@ -0,0 +1,30 @@
+// Memory and cache counters, read from the stats device, for
+// sizing NBUF, LOGSIZE and NINODE from a real workload.
+// Counts of events are since boot.
+struct sysstat {
+  uint npage;        // pages kalloc() manages
+  uint nfree;        // of which free
+  uint nreserved;    // promised by kreserve(), not yet allocated
+  uint nbuf;         // buffer cache size, NBUF
+  uint bhit;         // bget()s that found the block cached
+  uint bmiss;        // bget()s that recycled a buffer
+  uint logsize;      // log data blocks
+  uint logused;      // of which holding logged blocks now
+  uint logmax;       // most ever holding logged blocks
+  uint ncommit;      // transactions committed
+  uint ncheckpoint;  // checkpoints, which empty the log
+  uint nlogwait;     // begin_op()s that waited for log space
+  uint ninode;       // inode cache target size, NINODE
+  uint icached;      // inodes cached now
+  uint ihit;         // iget()s that found the inode cached
+  uint imiss;        // iget()s that made or recycled an entry
+};
+
+// A process, as procstat() reports it.
+struct procstat {
+  int pid;
+  int state;         // enum procstate in proc.h; 0 if unused
+  uint sz;           // bytes of user memory
+  uint ticks;        // clock ticks spent running
+  char name[16];
+};
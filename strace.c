@@ -0,0 +1,181 @@
+// strace: report system call counts and latencies.
+//
+//   strace             statistics of all calls since the last reset
+//   strace cmd [args]  run cmd, list the calls it makes, then
+//                      the statistics of the calls made meanwhile
+//
+// The kernel keeps only the latest events of each CPU, so a
+// long-running cmd loses its early calls from the list.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "syscall.h"
+#include "trace.h"
+
+static char *names[NSYSCALL] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_splice]  "splice",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_ioctl]   "ioctl",
+[SYS_getdents] "getdents",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_setaffinity] "setaffinity",
+[SYS_nanotime] "nanotime",
+[SYS_trace]   "trace",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futex]   "futex",
+[SYS_shmcreate] "shmcreate",
+[SYS_shmattach] "shmattach",
+[SYS_shmdetach] "shmdetach",
+[SYS_spawn]   "spawn",
+[SYS_waitpid] "waitpid",
+[SYS_mount]   "mount",
+[SYS_procstat] "procstat",
+};
+
+#define NEVENT  (NCPU*512)
+
+struct scstat st[NSYSCALL];
+
+static char*
+name(int num)
+{
+  if(num < 0 || num >= NSYSCALL || names[num] == 0)
+    return "?";
+  return names[num];
+}
+
+// Mean of n calls taking cycles in total, without
+// 64-bit division, which user programs lack.
+static uint
+mean(uint64 cycles, uint n)
+{
+  int shift;
+
+  for(shift = 0; (cycles >> shift) > 0xffffffff; shift++)
+    ;
+  return (uint)(cycles >> shift) / n << shift;
+}
+
+// Upper bound, in cycles, of the histogram bucket that holds
+// the call at fraction pct/100 of s's calls.
+static uint
+percentile(struct scstat *s, int pct)
+{
+  uint want, seen;
+  int b;
+
+  want = (s->n * pct + 99) / 100;
+  seen = 0;
+  for(b = 0; b < NSCHIST-1; b++){
+    seen += s->hist[b];
+    if(seen >= want)
+      break;
+  }
+  return 1 << (b+9);
+}
+
+static void
+printstats(void)
+{
+  int num;
+
+  if(trace(TRACESTAT, 0, st, 0) < 0){
+    printf(2, "strace: TRACESTAT failed\n");
+    exit();
+  }
+  printf(1, "%s\tcalls\tmean\tp50<\tp99<\tmax\t(cycles)\n", "syscall");
+  for(num = 0; num < NSYSCALL; num++){
+    if(st[num].n == 0)
+      continue;
+    printf(1, "%s\t%d\t%d\t%d\t%d\t%d\n", name(num), st[num].n,
+           mean(st[num].cycles, st[num].n), percentile(&st[num], 50),
+           percentile(&st[num], 99), st[num].max);
+  }
+}
+
+static void
+printevents(void)
+{
+  struct scevent *ev, e;
+  int i, j, n;
+
+  if((ev = malloc(NEVENT * sizeof(struct scevent))) == 0){
+    printf(2, "strace: out of memory\n");
+    return;
+  }
+  n = trace(TRACEREAD, 0, ev, NEVENT * sizeof(struct scevent));
+  if(n < 0){
+    printf(2, "strace: TRACEREAD failed\n");
+    return;
+  }
+  n /= sizeof(struct scevent);
+
+  // Each CPU's events are in order; merge them by time.
+  for(i = 1; i < n; i++){
+    e = ev[i];
+    for(j = i; j > 0 && ev[j-1].tsc > e.tsc; j--)
+      ev[j] = ev[j-1];
+    ev[j] = e;
+  }
+  for(i = 0; i < n; i++)
+    printf(1, "%d %s(0x%x, 0x%x, 0x%x) = %d\t%d cycles\n", ev[i].pid,
+           name(ev[i].num), ev[i].arg[0], ev[i].arg[1], ev[i].arg[2],
+           ev[i].ret, ev[i].cycles);
+  free(ev);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pid;
+
+  if(argc < 2){
+    printstats();
+    exit();
+  }
+
+  trace(TRACERESET, 0, 0, 0);
+  pid = fork();
+  if(pid < 0){
+    printf(2, "strace: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    trace(TRACEPROC, 1, 0, 0);
+    exec(argv[1], argv+1);
+    printf(2, "strace: exec %s failed\n", argv[1]);
+    exit();
+  }
+  wait();
+  printevents();
+  printstats();
+  exit();
+}
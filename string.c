@@ -41,9 +41,11 @@ memmove(void *dst, const void *src, uint n)
     d += n;
     while(n-- > 0)
       *--d = *--s;
+  } else if(((uint)s | (uint)d) % 4 == 0){
+    movsl(d, s, n/4);
+    movsb(d + (n & ~3), s + (n & ~3), n%4);
   } else
-    while(n-- > 0)
-      *d++ = *s++;
+    movsb(d, s, n);
 
   return dst;
 }
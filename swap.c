@@ -0,0 +1,279 @@
+// Swap space, so that user memory can exceed physical memory.
+//
+// mkfs leaves a swap area on the root disk, between the free
+// bit map and the data blocks, which is divided into slots of
+// one page each.  When memory runs short, swapout() takes a
+// page of user memory, chosen by the clock algorithm in
+// swapvictim(), writes it to a free slot, and frees it.  The
+// page's PTE becomes a PTE_LAZY entry naming the slot, and
+// pagein() calls swapin() to read the page back on its next
+// touch.  A slot's blocks go to the disk as one batch through
+// iderwv(), so the driver moves a page in a single command.
+//
+// Only private pages of a single-threaded process are taken,
+// and only from a process that is preempted in user space, or
+// from the current one while it handles its own page fault
+// from user space: at those points the kernel holds no pointer
+// into the process's memory.  fork() shares a swapped page by
+// giving the child the same slot, so slots are counted.
+//
+// The swapd thread keeps at least SWAPLOW pages free, so that
+// the kernel's own allocations rarely find memory exhausted,
+// and reservations of lazily allocated memory count free slots
+// as well as free pages (see kreserve()).
+//
+// swap.iolock serializes swap I/O and owns swap.buf; holding
+// it also keeps a PTE that names a slot from changing, since
+// only swapout() and swapin() make or undo those.  swap.lock
+// protects the slot counts.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+#include "swap.h"
+
+#define SLOTBLOCKS (PGSIZE/BSIZE)    // blocks per slot
+#define NSLOT      (FSSIZE/SLOTBLOCKS)
+#define SWAPLOW    512               // free pages swapd keeps
+#define SWAPHIGH   1024              // free pages swapd stops at
+
+struct {
+  struct spinlock lock;
+  uint start;               // first block of slot 0
+  int nslot;
+  int nused;
+  int next;                 // slot to try allocating next
+  ushort ref[NSLOT];        // PTEs naming each slot
+  uint nin;
+  uint nout;
+  struct sleeplock iolock;
+  struct buf buf[SLOTBLOCKS];
+} swap;
+
+// Take a free slot, with one reference.
+// Slot 0 is never used, so that no slot PTE is a plain
+// PTE_LAZY one.  Returns 0 if the swap area is full.
+static uint
+slotalloc(void)
+{
+  int i, s;
+
+  acquire(&swap.lock);
+  s = swap.next;
+  for(i = 1; i < swap.nslot; i++, s++){
+    if(s >= swap.nslot)
+      s = 1;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.nused++;
+      swap.next = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return 0;
+}
+
+// Add a reference to slot s, for fork().
+void
+swapdup(uint s)
+{
+  acquire(&swap.lock);
+  if(s == 0 || s >= swap.nslot || swap.ref[s] == 0)
+    panic("swapdup");
+  swap.ref[s]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot s, freeing it with the last one.
+void
+swapput(uint s)
+{
+  acquire(&swap.lock);
+  if(s == 0 || s >= swap.nslot || swap.ref[s] == 0)
+    panic("swapput");
+  if(--swap.ref[s] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Number of free slots, for kreserve().
+int
+swapfree(void)
+{
+  return swap.nslot > 0 ? swap.nslot - 1 - swap.nused : 0;
+}
+
+// Write the page at mem to slot s, or, if write is 0, read
+// slot s into mem.  Caller holds swap.iolock.
+static void
+swapio(uint s, char *mem, int write)
+{
+  struct buf *bp[SLOTBLOCKS];
+  int i;
+
+  for(i = 0; i < SLOTBLOCKS; i++){
+    bp[i] = &swap.buf[i];
+    acquiresleep(&bp[i]->lock);
+    bp[i]->dev = ROOTDEV;
+    bp[i]->blockno = swap.start + s*SLOTBLOCKS + i;
+    if(write){
+      memmove(bp[i]->data, mem + i*BSIZE, BSIZE);
+      bp[i]->flags = B_DIRTY;
+    } else
+      bp[i]->flags = 0;
+  }
+  iderwv(bp, SLOTBLOCKS);
+  for(i = 0; i < SLOTBLOCKS; i++){
+    if(!write)
+      memmove(mem + i*BSIZE, bp[i]->data, BSIZE);
+    releasesleep(&bp[i]->lock);
+  }
+}
+
+// Free a page of memory by writing a page of user memory to
+// swap.  self, if not 0, is the current process, which is
+// handling a page fault from user space and can lose pages
+// itself.  Returns 0 on success, -1 if no page could be taken.
+// The caller must be able to sleep.
+int
+swapout(struct proc *self)
+{
+  uint s;
+  char *mem;
+
+  if(swap.nslot == 0)
+    return -1;
+  acquiresleep(&swap.iolock);
+  if((s = slotalloc()) == 0){
+    releasesleep(&swap.iolock);
+    return -1;
+  }
+  // The page is out of its page table now, but a fault on it
+  // waits in swapin() for swap.iolock, so for the write.
+  if((mem = swapvictim(self, s)) == 0){
+    swapput(s);
+    releasesleep(&swap.iolock);
+    return -1;
+  }
+  swapio(s, mem, 1);
+  swap.nout++;
+  releasesleep(&swap.iolock);
+  kfree(mem);
+  return 0;
+}
+
+// Read back the page that *pte, whose value was old, has
+// swapped out, and map it writable.  Returns 0 on success,
+// or -1 if memory ran out.
+int
+swapin(pte_t *pte, uint old)
+{
+  char *mem;
+  uint s;
+
+  if((mem = swapkalloc()) == 0)
+    return -1;
+  s = PTE_SLOT(old);
+  acquiresleep(&swap.iolock);
+  if(*pte != old){
+    // Another thread sharing the page table got here first.
+    releasesleep(&swap.iolock);
+    kfree(mem);
+    return 0;
+  }
+  swapio(s, mem, 0);
+  *pte = V2P(mem) | PTE_W | PTE_U | PTE_P;
+  swap.nin++;
+  releasesleep(&swap.iolock);
+  swapput(s);
+  return 0;
+}
+
+// kalloc() a page, swapping out pages of processes other
+// than the caller to make room if memory has run out.
+// Caller must be able to sleep.
+char*
+swapkalloc(void)
+{
+  char *mem;
+
+  while((mem = kalloc()) == 0)
+    if(swapout(0) < 0)
+      return 0;
+  return mem;
+}
+
+// Keep SWAPLOW pages of memory free, checking each tick.
+static void
+swapd(void)
+{
+  for(;;){
+    if(kfreepages() < SWAPLOW)
+      while(kfreepages() < SWAPHIGH && swapout(0) == 0)
+        ;
+    tsleep(1);
+  }
+}
+
+static int
+swapread(struct inode *ip, char *dst, int n)
+{
+  struct swapstat st;
+
+  if(n < sizeof(st))
+    return -1;
+  st.nslot = swap.nslot > 0 ? swap.nslot - 1 : 0;
+  st.nused = swap.nused;
+  st.nin = swap.nin;
+  st.nout = swap.nout;
+  st.nfree = kfreepages();
+  memmove(dst, &st, sizeof(st));
+  return sizeof(st);
+}
+
+static int
+swapwrite(struct inode *ip, char *src, int n)
+{
+  return -1;
+}
+
+// Find the root disk's swap area and start swapd, if there
+// is swap.  Called in process context, once the file system
+// is up.
+void
+swapinit(void)
+{
+  struct superblock sb;
+  int i;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  for(i = 0; i < SLOTBLOCKS; i++)
+    initsleeplock(&swap.buf[i].lock, "swapbuf");
+  devsw[SWAP].read = swapread;
+  devsw[SWAP].write = swapwrite;
+
+  readsb(ROOTDEV, &sb);
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+  swap.next = 1;
+  if(swap.nslot < 2){
+    swap.nslot = 0;
+    return;
+  }
+  cprintf("swap: %d pages at block %d\n", swap.nslot - 1, swap.start);
+  kthread("swapd", swapd);
+}
@@ -0,0 +1,10 @@
+// Swap statistics, as read from the swap device.  Counts
+// are in pages; nin and nout are totals since boot, so a
+// reader takes rates from the difference of two reads.
+struct swapstat {
+  uint nslot;    // pages of swap space, 0 if there is none
+  uint nused;    // of those, holding a page
+  uint nin;      // pages read back in
+  uint nout;     // pages written out
+  uint nfree;    // free pages of memory
+};
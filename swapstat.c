@@ -0,0 +1,53 @@
+// swapstat: report swap space use and paging.
+//
+//   swapstat      totals since boot
+//   swapstat n    then, every n seconds, pages swapped in
+//                 and out per second since the line before
+//
+// Each line gives pages of swap used and in all, pages swapped
+// in and out, and pages of memory free.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "param.h"
+#include "swap.h"
+
+static void
+get(int fd, struct swapstat *st)
+{
+  if(read(fd, st, sizeof(*st)) != sizeof(*st)){
+    printf(2, "swapstat: read failed\n");
+    exit();
+  }
+}
+
+static void
+show(struct swapstat *st, uint in, uint out)
+{
+  printf(1, "%d\t%d\t%d\t%d\t%d\n", st->nused, st->nslot, in, out, st->nfree);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct swapstat st, last;
+  int fd, n;
+
+  if((fd = open("/swap", O_RDONLY)) < 0){
+    printf(2, "swapstat: cannot open /swap\n");
+    exit();
+  }
+  n = argc > 1 ? atoi(argv[1]) : 0;
+  printf(1, "# used\tslots\tin\tout\tfree\n");
+  get(fd, &st);
+  show(&st, st.nin, st.nout);
+  while(n > 0){
+    last = st;
+    sleep(n * HZ);
+    get(fd, &st);
+    show(&st, (st.nin - last.nin) / n, (st.nout - last.nout) / n);
+  }
+  exit();
+}
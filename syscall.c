@@ -6,6 +6,8 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "mman.h"
+#include "trace.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -21,6 +23,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(prefault(addr, 4) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +43,8 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault((uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -52,27 +58,60 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// Check that the size bytes at addr lie within the current
+// process's address space, in memory that allows prot, and
+// fault them in.
 int
-argptr(int n, char **pp, int size)
+checkuser(uint addr, int size, int prot)
 {
-  int i;
   struct proc *curproc = myproc();
- 
+
+  if(size < 0)
+    return -1;
+  if((addr >= curproc->sz || addr+size > curproc->sz) &&
+     !mmapcovers(curproc, addr, size, prot))
+    return -1;
+  if((prot & PROT_WRITE) && textoverlaps(curproc, addr, size))
+    return -1;
+  if(prefault(addr, size) < 0)
+    return -1;
+  return 0;
+}
+
+static int
+uptr(int n, char **pp, int size, int prot)
+{
+  int i;
+
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(checkuser(i, size, prot) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space.
+int
+argptr(int n, char **pp, int size)
+{
+  return uptr(n, pp, size, PROT_READ);
+}
+
+// Like argptr, for a block the system call will write to,
+// which must not be in a read-only mapping.
+int
+argwptr(int n, char **pp, int size)
+{
+  return uptr(n, pp, size, PROT_READ|PROT_WRITE);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (Threads share writable memory, so another thread could
+// still change the string after this check.)
 int
 argstr(int n, char **pp)
 {
@@ -103,8 +142,30 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_splice(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_ioctl(void);
+extern int sys_getdents(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_setaffinity(void);
+extern int sys_nanotime(void);
+extern int sys_trace(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex(void);
+extern int sys_shmcreate(void);
+extern int sys_shmattach(void);
+extern int sys_shmdetach(void);
+extern int sys_spawn(void);
+extern int sys_waitpid(void);
+extern int sys_mount(void);
+extern int sys_procstat(void);
 
-static int (*syscalls[])(void) = {
+static int (*syscalls[NSYSCALL])(void) = {
 [SYS_fork]    sys_fork,
 [SYS_exit]    sys_exit,
 [SYS_wait]    sys_wait,
@@ -126,17 +187,48 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_splice]  sys_splice,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_ioctl]   sys_ioctl,
+[SYS_getdents] sys_getdents,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_nanotime] sys_nanotime,
+[SYS_trace]   sys_trace,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_shmcreate] sys_shmcreate,
+[SYS_shmattach] sys_shmattach,
+[SYS_shmdetach] sys_shmdetach,
+[SYS_spawn]   sys_spawn,
+[SYS_waitpid] sys_waitpid,
+[SYS_mount]   sys_mount,
+[SYS_procstat] sys_procstat,
 };
 
 void
 syscall(void)
 {
-  int num;
+  int num, i, args[3];
+  uint64 t0, t1;
   struct proc *curproc = myproc();
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    // Fetch the arguments before the call; exec replaces them.
+    if(curproc->trace)
+      for(i = 0; i < 3; i++)
+        if(argint(i, &args[i]) < 0)
+          args[i] = 0;
+    t0 = rdtsc64();
     curproc->tf->eax = syscalls[num]();
+    t1 = rdtsc64();
+    tracesyscall(curproc, num, args, curproc->tf->eax, t1, t1 - t0);
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
@@ -20,3 +20,25 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_splice 22
+#define SYS_mmap   23
+#define SYS_munmap 24
+#define SYS_ioctl  25
+#define SYS_getdents 26
+#define SYS_pread  27
+#define SYS_pwrite 28
+#define SYS_readv  29
+#define SYS_writev 30
+#define SYS_setaffinity 31
+#define SYS_nanotime 32
+#define SYS_trace  33
+#define SYS_clone  34
+#define SYS_join   35
+#define SYS_futex  36
+#define SYS_shmcreate 37
+#define SYS_shmattach 38
+#define SYS_shmdetach 39
+#define SYS_spawn  40
+#define SYS_waitpid 41
+#define SYS_mount  42
+#define SYS_procstat 43
@@ -15,6 +15,9 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
+#include "uio.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -66,6 +69,67 @@ sys_dup(void)
   return fd;
 }
 
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// The address argument is a hint this kernel ignores.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int len, prot, flags, off;
+
+  if(argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0)
+    return -1;
+  return mmap(f, len, prot, flags, off);
+}
+
+int
+sys_ioctl(void)
+{
+  struct file *f;
+  int req, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &req) < 0 || argint(2, &arg) < 0)
+    return -1;
+  return fileioctl(f, req, arg);
+}
+
+int
+sys_getdents(void)
+{
+  struct file *f;
+  int n;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
+    return -1;
+  return filegetdents(f, p, n);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  if(len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
 int
 sys_read(void)
 {
@@ -73,7 +137,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -90,6 +154,93 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Copy the array of iovecs given by arguments 1 and 2 into
+// iov, checking that each buffer allows prot.
+// Returns the number of iovecs.
+static int
+argiov(struct iovec *iov, int prot)
+{
+  struct iovec *uiov;
+  int i, n;
+
+  if(argint(2, &n) < 0 || n < 0 || n > IOV_MAX)
+    return -1;
+  if(argptr(1, (char**)&uiov, n*sizeof(*uiov)) < 0)
+    return -1;
+  memmove(iov, uiov, n*sizeof(*uiov));
+  for(i = 0; i < n; i++)
+    if(checkuser((uint)iov[i].base, iov[i].len, prot) < 0)
+      return -1;
+  return n;
+}
+
+// Like read, into each buffer in turn, stopping early
+// at a short read.
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int i, n, r, tot;
+
+  if(argfd(0, 0, &f) < 0 || (n = argiov(iov, PROT_READ|PROT_WRITE)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < n; i++){
+    if((r = fileread(f, iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(r < iov[i].len)
+      break;
+  }
+  return tot;
+}
+
+// Like write, from each buffer in turn.
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int i, n, r, tot;
+
+  if(argfd(0, 0, &f) < 0 || (n = argiov(iov, PROT_READ)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < n; i++){
+    if((r = filewrite(f, iov[i].base, iov[i].len)) < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+  }
+  return tot;
+}
+
 int
 sys_close(void)
 {
@@ -109,7 +260,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argwptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -206,6 +357,10 @@ sys_unlink(void)
 
   if((ip = dirlookup(dp, name, &off)) == 0)
     goto bad;
+  if(ismount(ip)){
+    iput(ip);
+    goto bad;
+  }
   ilock(ip);
 
   if(ip->nlink < 1)
@@ -218,6 +373,9 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcremove(dp, name);
+  if(dp->dev == ROOTDEV && dp->inum == ROOTINO)
+    triedel(name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -257,8 +415,11 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  // Only the tmpfs runs out of inodes without panicking.
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -282,44 +443,39 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-int
-sys_open(void)
+// Open the file at path with mode omode, as open() does,
+// but without giving it a descriptor.
+struct file*
+fileopen(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
   begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
   iunlock(ip);
   end_op();
@@ -329,6 +485,24 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  return f;
+}
+
+int
+sys_open(void)
+{
+  char *path;
+  int fd, omode;
+  struct file *f;
+
+  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+    return -1;
+  if((f = fileopen(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -393,19 +567,42 @@ sys_chdir(void)
   return 0;
 }
 
+// Mount the file system of device dev, a disk or TMPDEV,
+// on the directory path.
 int
-sys_exec(void)
+sys_mount(void)
+{
+  char *path;
+  struct inode *ip;
+  int dev, r;
+
+  if(argint(1, &dev) < 0)
+    return -1;
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  r = mount(ip, dev);
+  iunlockput(ip);
+  end_op();
+  return r;
+}
+
+// Fetch the nth system call argument as a null-terminated
+// array of at most MAXARG-1 strings, stored in argv.
+static int
+argargv(int n, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argint(n, (int*)&uargv) < 0)
     return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -416,9 +613,40 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+
+  if(argstr(0, &path) < 0 || argargv(1, argv) < 0){
+    return -1;
+  }
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG], *p;
+  struct spawnact act[NSPAWNACT];
+  int i, nact;
+
+  if(argstr(0, &path) < 0 || argargv(1, argv) < 0 || argint(3, &nact) < 0)
+    return -1;
+  if(nact < 0 || nact > NSPAWNACT ||
+     argptr(2, &p, nact*sizeof(act[0])) < 0)
+    return -1;
+  memmove(act, p, nact*sizeof(act[0]));
+  for(i = 0; i < nact; i++)
+    if(act[i].op == SPAWN_OPEN &&
+       fetchstr((uint)act[i].path, &act[i].path) < 0)
+      return -1;
+  return spawn(path, argv, act, nact);
+}
+
 int
 sys_pipe(void)
 {
@@ -426,7 +654,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argwptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
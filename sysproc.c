@@ -6,6 +6,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "stats.h"
 
 int
 sys_fork(void)
@@ -26,6 +27,41 @@ sys_wait(void)
   return wait();
 }
 
+int
+sys_waitpid(void)
+{
+  int pid, options;
+
+  if(argint(0, &pid) < 0 || argint(1, &options) < 0)
+    return -1;
+  return waitpid(pid, options);
+}
+
+int
+sys_clone(void)
+{
+  int fn, arg;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 ||
+     argwptr(2, &stack, PGSIZE) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+int
+sys_join(void)
+{
+  char *p, *stack;
+  int pid;
+
+  if(argwptr(0, &p, sizeof(char*)) < 0)
+    return -1;
+  if((pid = join(&stack)) >= 0)
+    *(char**)p = stack;
+  return pid;
+}
+
 int
 sys_kill(void)
 {
@@ -36,6 +72,28 @@ sys_kill(void)
   return kill(pid);
 }
 
+int
+sys_setaffinity(void)
+{
+  int mask;
+
+  if(argint(0, &mask) < 0)
+    return -1;
+  return setaffinity(mask);
+}
+
+// Store the nanoseconds since boot in *ns.
+int
+sys_nanotime(void)
+{
+  char *p;
+
+  if(argwptr(0, &p, sizeof(uint64)) < 0)
+    return -1;
+  *(uint64*)p = nanotime();
+  return 0;
+}
+
 int
 sys_getpid(void)
 {
@@ -60,21 +118,10 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return tsleep(n);
 }
 
 // return how many clock tick interrupts have occurred
@@ -89,3 +136,16 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// procstat(ps, n): describe up to n processes in ps.
+int
+sys_procstat(void)
+{
+  char *ps;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NPROC ||
+     argwptr(0, &ps, n * sizeof(struct procstat)) < 0)
+    return -1;
+  return procstat((struct procstat*)ps, n);
+}
@@ -0,0 +1,240 @@
+// In-memory file system for scratch files, mounted by mount().
+//
+// Its inodes are on device TMPDEV, and fs.c hands their
+// storage to the functions here instead of to the disk.  A
+// tnode from a slab cache stands in for each dinode, and file
+// data lives in kalloc()ed pages listed in a page-sized index,
+// so nothing goes through the buffer cache or the log, and
+// nothing survives a reboot.  Directories hold dirents, as on
+// disk, so fs.c's directory code works unchanged.
+//
+// Callers hold the inode's sleep-lock, which protects its
+// tnode; tmpfs.lock protects the table of tnodes.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NTMPINODE 512                   // inode numbers, less 0
+#define TMPNPAGE  (PGSIZE / sizeof(char*)) // pages per file
+#define TMPMAXFILE (TMPNPAGE * PGSIZE)
+
+struct tnode {
+  short type;
+  short major;
+  short minor;
+  short nlink;
+  uint size;
+  char **page;         // TMPNPAGE data pages, or 0 if none yet
+};
+
+struct {
+  struct spinlock lock;
+  struct kmcache *cache;
+  struct tnode *node[NTMPINODE];  // by inum; 0 if free
+  int next;                       // inum to try allocating next
+} tmpfs;
+
+static int tnwrite(struct tnode *tn, char *src, uint off, uint n);
+
+// Make the file system's root directory.
+void
+tmpinit(void)
+{
+  struct tnode *tn;
+  struct dirent de[2];
+
+  initlock(&tmpfs.lock, "tmpfs");
+  tmpfs.cache = kmcreate("tnode", sizeof(struct tnode));
+  if((tn = kmalloc(tmpfs.cache)) == 0)
+    panic("tmpinit");
+  memset(tn, 0, sizeof(*tn));
+  tn->type = T_DIR;
+  tn->nlink = 1;
+  // As on disk, the root is its own parent; namex() leaves
+  // through the directory it is mounted on instead.
+  memset(de, 0, sizeof(de));
+  de[0].inum = de[1].inum = ROOTINO;
+  safestrcpy(de[0].name, ".", DIRSIZ);
+  safestrcpy(de[1].name, "..", DIRSIZ);
+  if(tnwrite(tn, (char*)de, 0, sizeof(de)) != sizeof(de))
+    panic("tmpinit: root");
+  tmpfs.node[ROOTINO] = tn;
+  tmpfs.next = ROOTINO + 1;
+}
+
+// Allocate a tnode of the given type.
+// Return its inum, or 0 if there are none left.
+uint
+tmpialloc(short type)
+{
+  struct tnode *tn;
+  int i, inum;
+
+  if((tn = kmalloc(tmpfs.cache)) == 0)
+    return 0;
+  memset(tn, 0, sizeof(*tn));
+  tn->type = type;
+  acquire(&tmpfs.lock);
+  inum = tmpfs.next;
+  for(i = 1; i < NTMPINODE; i++, inum++){
+    if(inum >= NTMPINODE)
+      inum = 1;
+    if(tmpfs.node[inum] == 0){
+      tmpfs.node[inum] = tn;
+      tmpfs.next = inum + 1;
+      release(&tmpfs.lock);
+      return inum;
+    }
+  }
+  release(&tmpfs.lock);
+  kmfree(tmpfs.cache, tn);
+  return 0;
+}
+
+// Fill in ip from its tnode, as ilock() does from disk.
+void
+tmpiload(struct inode *ip)
+{
+  struct tnode *tn;
+
+  tn = tmpfs.node[ip->inum];
+  ip->type = tn->type;
+  ip->major = tn->major;
+  ip->minor = tn->minor;
+  ip->nlink = tn->nlink;
+  ip->size = tn->size;
+}
+
+// Copy ip to its tnode, as iupdate() does to disk.
+// A type of 0 frees the tnode, which must have no pages.
+void
+tmpiupdate(struct inode *ip)
+{
+  struct tnode *tn;
+
+  tn = tmpfs.node[ip->inum];
+  if(ip->type == 0){
+    acquire(&tmpfs.lock);
+    tmpfs.node[ip->inum] = 0;
+    release(&tmpfs.lock);
+    kmfree(tmpfs.cache, tn);
+    return;
+  }
+  tn->type = ip->type;
+  tn->major = ip->major;
+  tn->minor = ip->minor;
+  tn->nlink = ip->nlink;
+  tn->size = ip->size;
+}
+
+// Free ip's pages.
+void
+tmptrunc(struct inode *ip)
+{
+  struct tnode *tn;
+  int i;
+
+  tn = tmpfs.node[ip->inum];
+  if(tn->page){
+    for(i = 0; i < TMPNPAGE; i++)
+      if(tn->page[i])
+        kfree(tn->page[i]);
+    kfree((char*)tn->page);
+    tn->page = 0;
+  }
+  ip->size = 0;
+  tmpiupdate(ip);
+}
+
+// Type and size of inode inum, for dirread().
+void
+tmpstat(uint inum, short *type, uint *size)
+{
+  struct tnode *tn;
+
+  acquire(&tmpfs.lock);
+  if(inum < NTMPINODE && (tn = tmpfs.node[inum]) != 0){
+    *type = tn->type;
+    *size = tn->size;
+  } else {
+    *type = 0;
+    *size = 0;
+  }
+  release(&tmpfs.lock);
+}
+
+// Read n bytes at off, which readi() has checked against
+// the size.  Pages never written read as zeros.
+int
+tmpread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct tnode *tn;
+  uint tot, m;
+  char *pg;
+
+  tn = tmpfs.node[ip->inum];
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    pg = tn->page ? tn->page[off/PGSIZE] : 0;
+    if(pg)
+      memmove(dst, pg + off%PGSIZE, m);
+    else
+      memset(dst, 0, m);
+  }
+  return n;
+}
+
+// Write n bytes to tn at off, allocating pages as needed.
+// Returns the number of bytes written, which is short only
+// if memory runs out, or -1 if none were.
+static int
+tnwrite(struct tnode *tn, char *src, uint off, uint n)
+{
+  uint tot, m;
+  char **pg;
+
+  if(off + n > TMPMAXFILE)
+    return -1;
+  if(tn->page == 0 && n > 0){
+    if((tn->page = (char**)kalloc()) == 0)
+      return -1;
+    memset(tn->page, 0, PGSIZE);
+  }
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    pg = &tn->page[off/PGSIZE];
+    if(*pg == 0){
+      if((*pg = kalloc()) == 0)
+        break;
+      if(m != PGSIZE)
+        memset(*pg, 0, PGSIZE);
+    }
+    memmove(*pg + off%PGSIZE, src, m);
+  }
+  if(off > tn->size)
+    tn->size = off;
+  return tot > 0 || n == 0 ? tot : -1;
+}
+
+// Write n bytes at off, which writei() has checked is
+// within the file or at its end.
+int
+tmpwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  int r;
+
+  if((r = tnwrite(tmpfs.node[ip->inum], src, off, n)) > 0){
+    pcwrite(ip, off, src, r);
+    ip->size = tmpfs.node[ip->inum]->size;
+  }
+  return r;
+}
@@ -0,0 +1,96 @@
+// top: report memory, cache and log use, and the processes.
+//
+//   top      once
+//   top n    again every n seconds
+//
+// The first lines give pages of memory free and reserved, and
+// the hit rates of the buffer and inode caches, with the log's
+// use and how often begin_op() waited for it: the numbers for
+// sizing NBUF, NINODE and LOGSIZE.  A line per process follows,
+// with its memory in bytes and clock ticks spent running.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "param.h"
+#include "stats.h"
+
+static char *states[] = {
+[0]  "unused",
+[1]  "embryo",
+[2]  "sleep",
+[3]  "runble",
+[4]  "run",
+[5]  "zombie",
+};
+
+// Percent of hit in hit+miss.
+static uint
+pct(uint hit, uint miss)
+{
+  while(hit > 0xffffffff / 100){
+    hit /= 2;
+    miss /= 2;
+  }
+  if(hit + miss == 0)
+    return 0;
+  return hit * 100 / (hit + miss);
+}
+
+static void
+show(int fd, struct procstat *ps)
+{
+  struct sysstat st;
+  char *state;
+  int i, n;
+
+  if(read(fd, &st, sizeof(st)) != sizeof(st)){
+    printf(2, "top: read failed\n");
+    exit();
+  }
+  printf(1, "mem: %d pages, %d free, %d reserved\n",
+         st.npage, st.nfree, st.nreserved);
+  printf(1, "bcache: %d bufs, %d hits %d misses, %d%% hit\n",
+         st.nbuf, st.bhit, st.bmiss, pct(st.bhit, st.bmiss));
+  printf(1, "log: %d blocks, %d used, %d max, %d commits %d checkpoints %d waits\n",
+         st.logsize, st.logused, st.logmax, st.ncommit, st.ncheckpoint,
+         st.nlogwait);
+  printf(1, "icache: %d of %d cached, %d hits %d misses, %d%% hit\n",
+         st.icached, st.ninode, st.ihit, st.imiss, pct(st.ihit, st.imiss));
+
+  n = procstat(ps, NPROC);
+  printf(1, "pid\tstate\tsz\tticks\tname\n");
+  for(i = 0; i < n; i++){
+    if(ps[i].state >= 0 && ps[i].state < sizeof(states)/sizeof(states[0]))
+      state = states[ps[i].state];
+    else
+      state = "?";
+    printf(1, "%d\t%s\t%d\t%d\t%s\n", ps[i].pid, state, ps[i].sz,
+           ps[i].ticks, ps[i].name);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct procstat *ps;
+  int fd, n;
+
+  if((fd = open("/stats", O_RDONLY)) < 0){
+    printf(2, "top: cannot open /stats\n");
+    exit();
+  }
+  if((ps = malloc(NPROC * sizeof(struct procstat))) == 0){
+    printf(2, "top: out of memory\n");
+    exit();
+  }
+  n = argc > 1 ? atoi(argv[1]) : 0;
+  show(fd, ps);
+  while(n > 0){
+    sleep(n * HZ);
+    printf(1, "\n");
+    show(fd, ps);
+  }
+  exit();
+}
@@ -0,0 +1,183 @@
+// System call statistics and tracing.
+//
+// syscall() times each call with the cycle counter and hands
+// the result to tracesyscall(), which counts it in this CPU's
+// statistics with interrupts off and no lock.  Calls made by
+// processes with p->trace set are also logged as events in a
+// per-CPU ring, which the CPU writes without a lock: each slot
+// carries the sequence number of the event in it, and a reader
+// that finds the number changed after copying the slot knows
+// it was overwritten and drops the event.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "trace.h"
+
+#define NSCEVENT  512  // events buffered per CPU
+
+struct {
+  struct spinlock lock;   // serializes readers
+  struct {
+    struct scstat st[NSYSCALL];
+    uint head;            // events written
+    uint tail;            // events read
+    struct {
+      uint seq;
+      struct scevent e;
+    } ring[NSCEVENT];
+  } cpu[NCPU];
+} sctrace;
+
+void
+traceinit(void)
+{
+  initlock(&sctrace.lock, "sctrace");
+}
+
+static int
+histbucket(uint cycles)
+{
+  int b;
+
+  for(b = 0; b < NSCHIST-1 && (cycles >> (b+9)) != 0; b++)
+    ;
+  return b;
+}
+
+// Record that system call num, made with args by p, returned
+// ret after cycles cycles, at time tsc.
+void
+tracesyscall(struct proc *p, int num, int *args, int ret, uint64 tsc, uint cycles)
+{
+  struct scstat *st;
+  struct scevent *e;
+  uint h;
+  int c;
+
+  pushcli();
+  c = cpuid();
+  st = &sctrace.cpu[c].st[num];
+  st->n++;
+  st->cycles += cycles;
+  if(cycles > st->max)
+    st->max = cycles;
+  st->hist[histbucket(cycles)]++;
+  if(p->trace){
+    h = sctrace.cpu[c].head;
+    sctrace.cpu[c].ring[h % NSCEVENT].seq = ~0;
+    __sync_synchronize();
+    e = &sctrace.cpu[c].ring[h % NSCEVENT].e;
+    e->tsc = tsc;
+    e->pid = p->pid;
+    e->num = num;
+    e->arg[0] = args[0];
+    e->arg[1] = args[1];
+    e->arg[2] = args[2];
+    e->ret = ret;
+    e->cycles = cycles;
+    __sync_synchronize();
+    sctrace.cpu[c].ring[h % NSCEVENT].seq = h;
+    sctrace.cpu[c].head = h + 1;
+  }
+  popcli();
+}
+
+// Copy the statistics, summed over CPUs, to st.
+static void
+tracestat(struct scstat *st)
+{
+  struct scstat s;
+  int num, c, i;
+
+  for(num = 0; num < NSYSCALL; num++){
+    memset(&s, 0, sizeof(s));
+    for(c = 0; c < ncpu; c++){
+      s.n += sctrace.cpu[c].st[num].n;
+      s.cycles += sctrace.cpu[c].st[num].cycles;
+      if(sctrace.cpu[c].st[num].max > s.max)
+        s.max = sctrace.cpu[c].st[num].max;
+      for(i = 0; i < NSCHIST; i++)
+        s.hist[i] += sctrace.cpu[c].st[num].hist[i];
+    }
+    memmove(&st[num], &s, sizeof(s));
+  }
+}
+
+// Zero the statistics of all CPUs.  Calls in progress on other
+// CPUs may still be counted.
+static void
+tracereset(void)
+{
+  int c;
+
+  acquire(&sctrace.lock);
+  for(c = 0; c < ncpu; c++){
+    memset(sctrace.cpu[c].st, 0, sizeof(sctrace.cpu[c].st));
+    sctrace.cpu[c].tail = sctrace.cpu[c].head;
+  }
+  release(&sctrace.lock);
+}
+
+// Move up to n events to dst, oldest first on each CPU.
+// Returns the number of bytes moved.
+static int
+traceread(struct scevent *dst, int n)
+{
+  struct scevent e;
+  uint head, t;
+  int c, tot;
+
+  tot = 0;
+  acquire(&sctrace.lock);
+  for(c = 0; c < ncpu && tot < n; c++){
+    head = sctrace.cpu[c].head;
+    t = sctrace.cpu[c].tail;
+    if(head - t > NSCEVENT)
+      t = head - NSCEVENT;
+    for(; t != head && tot < n; t++){
+      __sync_synchronize();
+      e = sctrace.cpu[c].ring[t % NSCEVENT].e;
+      __sync_synchronize();
+      if(sctrace.cpu[c].ring[t % NSCEVENT].seq != t)
+        continue;   // overwritten while we copied it
+      dst[tot++] = e;
+    }
+    sctrace.cpu[c].tail = t;
+  }
+  release(&sctrace.lock);
+  return tot * sizeof(struct scevent);
+}
+
+int
+sys_trace(void)
+{
+  int op, arg, n;
+  char *buf;
+
+  if(argint(0, &op) < 0 || argint(1, &arg) < 0 || argint(3, &n) < 0)
+    return -1;
+  switch(op){
+  case TRACESTAT:
+    if(argwptr(2, &buf, NSYSCALL*sizeof(struct scstat)) < 0)
+      return -1;
+    tracestat((struct scstat*)buf);
+    return 0;
+  case TRACERESET:
+    tracereset();
+    return 0;
+  case TRACEPROC:
+    myproc()->trace = arg != 0;
+    return 0;
+  case TRACEREAD:
+    if(n < 0 || argwptr(2, &buf, n) < 0)
+      return -1;
+    return traceread((struct scevent*)buf, n / sizeof(struct scevent));
+  }
+  return -1;
+}
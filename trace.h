@@ -0,0 +1,30 @@
+// System call statistics and tracing; see trace.c.
+
+#define NSYSCALL  64   // bound on system call numbers
+#define NSCHIST   16   // latency histogram buckets
+
+// trace() operations.
+#define TRACESTAT   1  // copy struct scstat[NSYSCALL], summed over CPUs, to buf
+#define TRACERESET  2  // zero the statistics and drop buffered events
+#define TRACEPROC   3  // arg 1 traces the caller and its new children, 0 stops
+#define TRACEREAD   4  // move up to n bytes of struct scevent to buf
+
+// Calls of one system call.  hist[i] counts the calls that took
+// from 2^(i+8) to 2^(i+9) cycles; the first and last buckets
+// also take everything faster or slower.
+struct scstat {
+  uint n;
+  uint64 cycles;       // total
+  uint max;
+  uint hist[NSCHIST];
+};
+
+// One system call made by a traced process.
+struct scevent {
+  uint64 tsc;          // when it returned
+  int pid;
+  int num;
+  int arg[3];          // first three argument words
+  int ret;
+  uint cycles;
+};
@@ -14,6 +14,21 @@ extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
 
+// Timer wheel for sleep(): a process sleeping until tick t
+// waits on its own struct timer in slot t % NWHEEL, and the
+// tick handler wakes only the timers due at that tick,
+// instead of every sleeper checking each tick.
+// Protected by tickslock.
+#define NWHEEL 64
+
+struct timer {
+  uint when;           // tick to wake at
+  int fired;
+  struct timer *next;  // in wheel[when % NWHEEL]
+};
+
+static struct timer *wheel[NWHEEL];
+
 void
 tvinit(void)
 {
@@ -26,6 +41,50 @@ tvinit(void)
   initlock(&tickslock, "time");
 }
 
+// Wake the sleepers due at this tick.  Caller holds tickslock.
+static void
+timerfire(void)
+{
+  struct timer **pp, *t;
+
+  for(pp = &wheel[ticks % NWHEEL]; (t = *pp) != 0; ){
+    if(t->when != ticks){
+      pp = &t->next;
+      continue;
+    }
+    *pp = t->next;
+    t->fired = 1;
+    wakeup(t);
+  }
+}
+
+// Sleep for n ticks.  Returns -1 if killed first.
+int
+tsleep(int n)
+{
+  struct timer t, **pp;
+
+  if(n <= 0)
+    return 0;
+  acquire(&tickslock);
+  t.when = ticks + n;
+  t.fired = 0;
+  t.next = wheel[t.when % NWHEEL];
+  wheel[t.when % NWHEEL] = &t;
+  while(!t.fired){
+    if(myproc()->killed){
+      for(pp = &wheel[t.when % NWHEEL]; *pp != &t; pp = &(*pp)->next)
+        ;
+      *pp = t.next;
+      release(&tickslock);
+      return -1;
+    }
+    sleep(&t, &tickslock);
+  }
+  release(&tickslock);
+  return 0;
+}
+
 void
 idtinit(void)
 {
@@ -46,22 +105,36 @@ trap(struct trapframe *tf)
     return;
   }
 
+  if(tf->trapno >= T_IRQ0 && tf->trapno < T_IRQ0 + NIRQ)
+    mycpu()->nintr[tf->trapno - T_IRQ0]++;
+
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
+      uinfotick();
+      timerfire();
       release(&tickslock);
+      if(ticks % BOOSTTICKS == 0)
+        schedboost();
     }
+    profsample(tf);
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_WAKE:
+    // Only wakes the CPU from hlt in idle().
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
-    ideintr();
+    ideintr(0);
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE+1:
-    // Bochs generates spurious IDE1 interrupts.
+    // Bochs generates spurious IDE1 interrupts, which find
+    // no request in progress if there is no second channel.
+    ideintr(1);
+    lapiceoi();
     break;
   case T_IRQ0 + IRQ_KBD:
     kbdintr();
@@ -78,6 +151,29 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // The first touch of a lazily allocated (or loaded) page or
+    // a mapped file's page, or a write to a copy-on-write page;
+    // from user space or from the kernel using a user address.
+    // The kernel must not sleep for a page it touches, which might
+    // be while holding a lock; system calls prefault() the pages
+    // they will use.
+    if(myproc() != 0 && !(tf->err & FEC_PR) &&
+       (pagein(myproc(), rcr2(), (tf->cs&3) == DPL_USER) == 0 ||
+        mmapfault(myproc(), rcr2(), (tf->cs&3) == DPL_USER) == 0))
+      break;
+    if(myproc() != 0 && (tf->err & FEC_WR) &&
+       cowfault(myproc()->pgdir, rcr2()) == 0)
+      break;
+    // Out of memory: swap out a page, perhaps one of this
+    // process's own, and take the fault again.
+    if(myproc() != 0 && (tf->cs&3) == DPL_USER &&
+       wantpage(myproc()->pgdir, rcr2(), tf->err & FEC_WR) &&
+       swapout(myproc()) == 0)
+      break;
+    // Not a fault we can fix: treat like any other trap.
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -100,11 +196,17 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Charge the process for the clock tick; it gives up the
+  // CPU at the end of its quantum.
   // If interrupts were on while locks held, would need to check nlock.
+  // A process preempted in user space may lose pages to swap
+  // until it runs again.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
-    yield();
+     tf->trapno == T_IRQ0+IRQ_TIMER){
+    myproc()->upreempt = (tf->cs&3) == DPL_USER;
+    schedtick();
+    myproc()->upreempt = 0;
+  }
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
@@ -22,6 +22,11 @@
 #define T_MCHK          18      // machine check
 #define T_SIMDERR       19      // SIMD floating point error
 
+// Page fault error code bits.
+#define FEC_PR           0x1    // Fault caused by protection violation
+#define FEC_WR           0x2    // Fault caused by a write
+#define FEC_U            0x4    // Fault occurred in user mode
+
 // These are arbitrarily chosen, but with care not to overlap
 // processor defined exceptions or interrupt vectors.
 #define T_SYSCALL       64      // system call
@@ -34,5 +39,6 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_WAKE        20      // IPI to wake a halted CPU
 #define IRQ_SPURIOUS    31
 
@@ -0,0 +1,252 @@
+// Prefix trie of the names in the root directory, which the
+// console uses to complete commands.  trieload() fills it at
+// boot, and dirlink() and sys_unlink() keep it up to date, so
+// completion follows whatever is on the disk.
+//
+// Each node is one character of a name, and holds a sorted list
+// of the nodes that can follow it.  A node's count is how many
+// names pass through it, so looking up a prefix costs only its
+// length, however many names there are.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+struct tnode {
+  char c;
+  char end;     // a name ends here
+  short count;  // names through this node
+  short child;  // first child, or -1
+  short next;   // next sibling, or next free node
+};
+
+struct {
+  struct spinlock lock;
+  struct tnode node[NTRIE];  // node[0] is the root
+  short free;
+  int nfree;
+} trie;
+
+void
+trieinit(void)
+{
+  int i;
+
+  initlock(&trie.lock, "trie");
+  trie.node[0].child = -1;
+  trie.free = -1;
+  for(i = NTRIE-1; i > 0; i--){
+    trie.node[i].next = trie.free;
+    trie.free = i;
+  }
+  trie.nfree = NTRIE-1;
+}
+
+// Return the child of node n for character c, or -1.
+static int
+childof(int n, int c)
+{
+  int k;
+
+  for(k = trie.node[n].child; k >= 0; k = trie.node[k].next)
+    if(trie.node[k].c == c)
+      return k;
+  return -1;
+}
+
+// Follow s[0..len) down from the root.
+// Return the node reached, or -1.
+static int
+walk(char *s, int len)
+{
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < len && n >= 0; i++)
+    n = childof(n, s[i]);
+  return n;
+}
+
+// Length of a directory entry's name; "." and ".." count as 0,
+// since they are not worth completing.
+static int
+namelen(char *name)
+{
+  int n;
+
+  for(n = 0; n < DIRSIZ && name[n]; n++)
+    ;
+  if(name[0] == '.' && (n == 1 || (n == 2 && name[1] == '.')))
+    return 0;
+  return n;
+}
+
+// Add name, an entry of the root directory.
+void
+trieadd(char *name)
+{
+  struct tnode *t;
+  short *pp;
+  int i, k, n, len;
+
+  if((len = namelen(name)) == 0)
+    return;
+  acquire(&trie.lock);
+  n = walk(name, len);
+  if((n >= 0 && trie.node[n].end) || trie.nfree < len){
+    // Already there, or no room: completion will miss it.
+    release(&trie.lock);
+    return;
+  }
+  n = 0;
+  trie.node[0].count++;
+  for(i = 0; i < len; i++){
+    pp = &trie.node[n].child;
+    while(*pp >= 0 && trie.node[*pp].c < name[i])
+      pp = &trie.node[*pp].next;
+    if(*pp < 0 || trie.node[*pp].c != name[i]){
+      k = trie.free;
+      t = &trie.node[k];
+      trie.free = t->next;
+      trie.nfree--;
+      t->c = name[i];
+      t->end = 0;
+      t->count = 0;
+      t->child = -1;
+      t->next = *pp;
+      *pp = k;
+    }
+    n = *pp;
+    trie.node[n].count++;
+  }
+  trie.node[n].end = 1;
+  release(&trie.lock);
+}
+
+// Remove name, which has been unlinked from the root directory.
+void
+triedel(char *name)
+{
+  short *pp;
+  int i, k, n, len;
+
+  if((len = namelen(name)) == 0)
+    return;
+  acquire(&trie.lock);
+  n = walk(name, len);
+  if(n < 0 || !trie.node[n].end){
+    release(&trie.lock);
+    return;
+  }
+  trie.node[n].end = 0;
+  n = 0;
+  trie.node[0].count--;
+  for(i = 0; i < len; i++){
+    pp = &trie.node[n].child;
+    while(trie.node[*pp].c != name[i])
+      pp = &trie.node[*pp].next;
+    n = *pp;
+    if(--trie.node[n].count == 0){
+      // No other name goes this way: free the rest of the path.
+      *pp = trie.node[n].next;
+      for(; n >= 0; n = k){
+        k = trie.node[n].child;
+        trie.node[n].next = trie.free;
+        trie.free = n;
+        trie.nfree++;
+      }
+      break;
+    }
+  }
+  release(&trie.lock);
+}
+
+// Look up the prefix s[0..len) and return how many names
+// start with it.  Copy to ext the characters that all of them
+// have next, NUL-terminated; ext must hold DIRSIZ+1 bytes.
+int
+triefind(char *s, int len, char *ext)
+{
+  int i, k, n, count;
+
+  acquire(&trie.lock);
+  if((n = walk(s, len)) < 0){
+    release(&trie.lock);
+    ext[0] = 0;
+    return 0;
+  }
+  count = trie.node[n].count;
+  i = 0;
+  while(!trie.node[n].end && (k = trie.node[n].child) >= 0 &&
+        trie.node[k].next < 0 && i < DIRSIZ){
+    ext[i++] = trie.node[k].c;
+    n = k;
+  }
+  ext[i] = 0;
+  release(&trie.lock);
+  return count;
+}
+
+static void
+collect(int n, char *buf, int depth, char *names, int max, int *cnt)
+{
+  char *p;
+  int k;
+
+  if(trie.node[n].end && *cnt < max){
+    p = names + *cnt * (DIRSIZ+1);
+    memmove(p, buf, depth);
+    p[depth] = 0;
+    (*cnt)++;
+  }
+  for(k = trie.node[n].child; k >= 0 && *cnt < max; k = trie.node[k].next){
+    buf[depth] = trie.node[k].c;
+    collect(k, buf, depth+1, names, max, cnt);
+  }
+}
+
+// Copy to names, in order, up to max of the names that start
+// with s[0..len), each NUL-terminated in DIRSIZ+1 bytes of its
+// own.  Return how many were copied.
+int
+trielist(char *s, int len, char *names, int max)
+{
+  char buf[DIRSIZ];
+  int n, cnt;
+
+  cnt = 0;
+  acquire(&trie.lock);
+  if((n = walk(s, len)) >= 0){
+    memmove(buf, s, len);
+    collect(n, buf, len, names, max, &cnt);
+  }
+  release(&trie.lock);
+  return cnt;
+}
+
+// Fill the trie from the root directory.  It reads the disk,
+// so it runs in the first process rather than in main().
+void
+trieload(void)
+{
+  struct inode *dp;
+  struct dirent de;
+  uint off;
+
+  begin_op();
+  if((dp = namei("/")) == 0)
+    panic("trieload");
+  ilock(dp);
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("trieload: readi");
+    if(de.inum != 0)
+      trieadd(de.name);
+  }
+  iunlockput(dp);
+  end_op();
+}
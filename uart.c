@@ -11,18 +11,38 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "ring.h"
 
 #define COM1    0x3f8
+#define TXBUF   512     // bytes of output queued for the port
 
 static int uart;    // is there a uart?
+static int panicking;  // set by panic(); poll from then on
+static struct ring rx;  // input, from uartintr() to uartrecv()
+
+// Output waits in tx until the transmitter can take it.  Each
+// transmit interrupt means its FIFO has emptied, and moves the
+// next 16 bytes along, so writers need not wait on the port.
+// Writers in early boot, before interrupts are first enabled,
+// and in panic(), which halts with them off, would never see
+// that interrupt, so they poll the port and drain tx themselves.
+static struct {
+  struct spinlock lock;
+  char buf[TXBUF];
+  uint r;     // next byte to send
+  uint w;     // next free slot
+} tx;
 
 void
 uartinit(void)
 {
   char *p;
 
-  // Turn off the FIFO
-  outb(COM1+2, 0);
+  initlock(&tx.lock, "uart");
+
+  // Turn on and clear the FIFOs; interrupt once 8 bytes have
+  // arrived, or when input pauses with fewer waiting.
+  outb(COM1+2, 0x87);
 
   // 9600 baud, 8 data bits, 1 stop bit, parity off.
   outb(COM1+3, 0x80);    // Unlock divisor
@@ -30,7 +50,7 @@ uartinit(void)
   outb(COM1+1, 0);
   outb(COM1+3, 0x03);    // Lock divisor, 8 data bits.
   outb(COM1+4, 0);
-  outb(COM1+1, 0x01);    // Enable receive interrupts.
+  outb(COM1+1, 0x03);    // Enable receive and transmit interrupts.
 
   // If status is 0xFF, no serial port.
   if(inb(COM1+5) == 0xFF)
@@ -41,37 +61,137 @@ uartinit(void)
   // enable interrupts.
   inb(COM1+2);
   inb(COM1+0);
-  ioapicenable(IRQ_COM1, 0);
+  ioapicenable(IRQ_COM1, 1);
 
   // Announce that we're here.
   for(p="xv6...\n"; *p; p++)
     uartputc(*p);
 }
 
+// Hand queued bytes to the transmitter if it is idle.
+// Caller must hold tx.lock.
+static void
+uartstart(void)
+{
+  int i;
+
+  if(!(inb(COM1+5) & 0x20))
+    return;
+  for(i = 0; i < 16 && tx.r != tx.w; i++)
+    outb(COM1+0, tx.buf[tx.r++ % TXBUF]);
+}
+
+// Send all of tx, polling for the transmitter to empty.
+// Caller must hold tx.lock.
+static void
+uartflush(void)
+{
+  int i;
+
+  while(tx.r != tx.w){
+    for(i = 0; i < 2000 && !(inb(COM1+5) & 0x20); i++)
+      microdelay(10);
+    if(i == 2000)
+      return;  // the port is stuck; leave the rest queued
+    uartstart();
+  }
+}
+
+// Will no transmit interrupt come to drain tx?  Either panic()
+// has stopped this CPU, or the caller had interrupts off before
+// taking its first lock; holding tx.lock, it has taken one, so
+// intena records that.  panic() may hold other locks, taken
+// with interrupts on, so it needs its own flag.
+static int
+polled(void)
+{
+  return panicking || !mycpu()->intena;
+}
+
+// Called by panic(), with interrupts off for good: write
+// synchronously from now on.
+void
+uartpanic(void)
+{
+  panicking = 1;
+}
+
+// Queue c.  If the queue is full, wait a while for the port to
+// drain it, then give up on c.  Caller must hold tx.lock.
+static void
+txput(int c)
+{
+  int i;
+
+  for(i = 0; i < 128 && tx.w - tx.r == TXBUF; i++){
+    microdelay(10);
+    uartstart();
+  }
+  if(tx.w - tx.r < TXBUF)
+    tx.buf[tx.w++ % TXBUF] = c;
+}
+
 void
 uartputc(int c)
+{
+  if(!uart)
+    return;
+  acquire(&tx.lock);
+  txput(c);
+  if(polled())
+    uartflush();
+  else
+    uartstart();
+  release(&tx.lock);
+}
+
+// Queue the n bytes at s for the port.
+void
+uartwrite(char *s, int n)
 {
   int i;
 
   if(!uart)
     return;
-  for(i = 0; i < 128 && !(inb(COM1+5) & 0x20); i++)
-    microdelay(10);
-  outb(COM1+0, c);
+  acquire(&tx.lock);
+  for(i = 0; i < n; i++)
+    txput(s[i]);
+  if(polled())
+    uartflush();
+  else
+    uartstart();
+  release(&tx.lock);
 }
 
 static int
 uartgetc(void)
 {
-  if(!uart)
-    return -1;
-  if(!(inb(COM1+5) & 0x01))
-    return -1;
-  return inb(COM1+0);
+  return ringget(&rx);
 }
 
+// Hand the input uartintr() queued to the console.
+// Called by its bottom half, consd.
 void
-uartintr(void)
+uartrecv(void)
 {
   consoleintr(uartgetc);
 }
+
+void
+uartintr(void)
+{
+  int n;
+
+  // Reading the interrupt ID clears a transmit interrupt;
+  // reading the input clears a receive one.
+  n = 0;
+  while(!(inb(COM1+2) & 0x01)){
+    acquire(&tx.lock);
+    uartstart();
+    release(&tx.lock);
+    for(; inb(COM1+5) & 0x01; n++)
+      ringput(&rx, inb(COM1+0));
+  }
+  if(n)
+    consolekick();
+}
@@ -0,0 +1,70 @@
+// The pages that let user programs read their pid and the
+// time without a system call; see uinfo.h.
+//
+// Every page table maps the one utime page, which the clock
+// interrupt updates, and a uinfo page of its own, both without
+// PTE_W.  freevm() drops the references along with the rest of
+// user memory, and the utime page keeps the one it was
+// allocated with.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "uinfo.h"
+
+static struct utime *utime;
+
+// Make the utime page, once lapicinit() has measured the TSC.
+void
+uinfoinit(void)
+{
+  if((utime = (struct utime*)kalloc()) == 0)
+    panic("uinfoinit");
+  memset(utime, 0, PGSIZE);
+  utime->tsc0 = tsc0;
+  utime->nspercycle = nspercycle;
+}
+
+// Map a fresh uinfo page for process pid, and the utime page,
+// into pgdir.  On failure the caller's freevm() frees whatever
+// was mapped.
+int
+uinfomap(pde_t *pgdir, int pid)
+{
+  struct uinfo *u;
+
+  if((u = (struct uinfo*)kalloc()) == 0)
+    return -1;
+  memset(u, 0, PGSIZE);
+  u->pid = pid;
+  if(uvmmap(pgdir, UINFO, (char*)u, PTE_U) < 0){
+    kfree((char*)u);
+    return -1;
+  }
+  kincref((char*)utime);
+  if(uvmmap(pgdir, UTIME, (char*)utime, PTE_U) < 0){
+    kfree((char*)utime);
+    return -1;
+  }
+  return 0;
+}
+
+// Threads are about to share pgdir, whose uinfo page can hold
+// only one pid: send getpid() back to the system call.
+void
+uinfoshare(pde_t *pgdir)
+{
+  struct uinfo *u;
+
+  if((u = (struct uinfo*)uva2ka(pgdir, (char*)UINFO)) != 0)
+    u->pid = 0;
+}
+
+// Publish a clock tick.  Caller holds tickslock.
+void
+uinfotick(void)
+{
+  utime->ticks = ticks;
+}
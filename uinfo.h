@@ -0,0 +1,16 @@
+// Pages the kernel maps read-only at the top of each process's
+// memory, just below KERNBASE, so that the ulib.c versions of
+// getpid(), uptime() and nanotime() need no system call.
+
+#define UINFO  (0x80000000 - 2*4096)  // this process's struct uinfo
+#define UTIME  (0x80000000 - 4096)    // struct utime, shared by all
+
+struct uinfo {
+  int pid;                // getpid(), or 0 if threads share the page
+};
+
+struct utime {
+  volatile uint ticks;    // uptime()
+  uint nspercycle;        // ns per TSC cycle in 4.28 fixed point, or 0
+  uint64 tsc0;            // TSC when nanotime() was 0
+};
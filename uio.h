@@ -0,0 +1,7 @@
+// Scatter-gather I/O for readv() and writev().
+struct iovec {
+  void *base;  // buffer
+  int len;     // its length in bytes
+};
+
+#define IOV_MAX  16  // most iovecs per call
@@ -3,6 +3,82 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "uinfo.h"
+
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
+int _exec(char*, char**);
+int _close(int);
+int _getpid(void);
+int _nanotime(uint64*);
+
+// printf.c sets outflush when it first buffers output.
+// outflush(fd) flushes fd, which is about to be closed;
+// outflush(-1) flushes every fd.
+void (*outflush)(int);
+
+int
+fork(void)
+{
+  if(outflush)
+    outflush(-1);
+  return _fork();
+}
+
+int
+exit(void)
+{
+  if(outflush)
+    outflush(-1);
+  _exit();
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(outflush)
+    outflush(-1);
+  return _exec(path, argv);
+}
+
+int
+close(int fd)
+{
+  if(outflush)
+    outflush(fd);
+  return _close(fd);
+}
+
+int
+getpid(void)
+{
+  int pid;
+
+  if((pid = ((struct uinfo*)UINFO)->pid) != 0)
+    return pid;
+  return _getpid();
+}
+
+int
+uptime(void)
+{
+  return ((struct utime*)UTIME)->ticks;
+}
+
+// As the kernel's nanotime() computes it.
+int
+nanotime(uint64 *ns)
+{
+  struct utime *t = (struct utime*)UTIME;
+  uint64 c;
+
+  if(t->nspercycle == 0)
+    return _nanotime(ns);
+  c = rdtsc64() - t->tsc0;
+  *ns = ((uint64)(uint)(c >> 32) * t->nspercycle << 4) +
+        ((uint64)(uint)c * t->nspercycle >> 28);
+  return 0;
+}
 
 char*
 strcpy(char *s, const char *t)
@@ -104,3 +180,98 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Character classes for isdigit() and isspace() in user.h.
+uchar ctype[256] = {
+  ['0' ... '9'] = CT_DIGIT,
+  [' '] = CT_SPACE, ['\t'] = CT_SPACE, ['\n'] = CT_SPACE,
+  ['\v'] = CT_SPACE, ['\r'] = CT_SPACE,
+};
+
+// The span routines look at four bytes at a time as a 32-bit
+// word, and use ctype[] only for the bytes of the word where a
+// run ends.
+#define ONES   0x01010101
+#define HIGHS  0x80808080
+// Is some byte of x less than n, for n <= 128?
+#define HASLESS(x, n)  (((x) - ONES*(n)) & ~(x) & HIGHS)
+
+// Return the length of the run of digits that starts p[0..n).
+int
+spandigit(const char *p, int n)
+{
+  const char *s, *e;
+  uint x;
+
+  e = p + n;
+  for(s = p; e - s >= 4; s += 4){
+    // All four bytes are 0x30-0x39 if every high nibble is 3
+    // and stays 3 when 6 is added to each byte.
+    x = *(uint*)s;
+    if((x & 0xF0F0F0F0) != 0x30303030 ||
+       ((x + 0x06060606) & 0xF0F0F0F0) != 0x30303030)
+      break;
+  }
+  while(s < e && isdigit(*s))
+    s++;
+  return s - p;
+}
+
+// Return the length of the run of non-digits that starts p[0..n).
+int
+spannondigit(const char *p, int n)
+{
+  const char *s, *e;
+  uint x;
+
+  e = p + n;
+  for(s = p; e - s >= 4; s += 4){
+    // Only a digit becomes less than 10 when xor'ed with '0'.
+    x = *(uint*)s ^ 0x30303030;
+    if(HASLESS(x, 10))
+      break;
+  }
+  while(s < e && !isdigit(*s))
+    s++;
+  return s - p;
+}
+
+// Return the length of the run of non-blanks that starts p[0..n).
+int
+spanword(const char *p, int n)
+{
+  const char *s, *e;
+  uint x;
+
+  e = p + n;
+  for(s = p; e - s >= 4; s += 4){
+    // Every blank is less than 0x21.
+    x = *(uint*)s;
+    if(HASLESS(x, 0x21))
+      break;
+  }
+  while(s < e && !isspace(*s))
+    s++;
+  return s - p;
+}
+
+// Return the first c in p[0..n), or 0.
+void*
+memchr(const void *p, int c, uint n)
+{
+  const char *s, *e;
+  uint x, cc;
+
+  cc = (uchar)c * ONES;
+  e = (const char*)p + n;
+  for(s = p; e - s >= 4; s += 4){
+    // A byte equal to c becomes 0 when xor'ed with it.
+    x = *(uint*)s ^ cc;
+    if(HASLESS(x, 1))
+      break;
+  }
+  for(; s < e; s++)
+    if(*s == (char)c)
+      return (void*)s;
+  return 0;
+}
@@ -3,30 +3,47 @@
 #include "user.h"
 #include "param.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator.
+//
+// Small requests are served from size classes: blocks of 16,
+// 32, ... 2048 bytes, header included.  Each class keeps a list
+// of free blocks, and new blocks are cut from an arena that
+// grows by ARENA bytes of sbrk() at a time, so a small malloc()
+// or free() does a constant amount of work.  Small blocks are
+// reused only for their own class.
+//
+// Larger requests use the allocator by Kernighan and Ritchie,
+// The C programming Language, 2nd ed.  Section 8.7, which
+// coalesces free neighbours so big blocks can be reassembled.
 
 typedef long Align;
 
 union header {
   struct {
     union header *ptr;
-    uint size;
+    uint size;         // in Header units, or class of a small block
   } s;
   Align x;
 };
 
 typedef union header Header;
 
+#define NCLASS  8
+#define CLASSSIZE(c)  (16 << (c))  // bytes per block of class c
+#define ARENA   (32*1024)          // bytes of sbrk() per arena refill
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+static Header *classfree[NCLASS];
+static char *arena;     // next free byte of the arena
+static char *arenaend;
+
+static void
+bigfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -43,6 +60,20 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  Header *bp;
+
+  bp = (Header*)ap - 1;
+  if(bp->s.size < NCLASS){
+    bp->s.ptr = classfree[bp->s.size];
+    classfree[bp->s.size] = bp;
+    return;
+  }
+  bigfree(bp);
+}
+
 static Header*
 morecore(uint nu)
 {
@@ -56,12 +87,12 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  bigfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+bigalloc(uint nbytes)
 {
   Header *p, *prevp;
   uint nunits;
@@ -88,3 +119,33 @@ malloc(uint nbytes)
         return 0;
   }
 }
+
+void*
+malloc(uint nbytes)
+{
+  Header *bp;
+  char *p;
+  int c;
+
+  if(nbytes > CLASSSIZE(NCLASS-1) - sizeof(Header))
+    return bigalloc(nbytes);
+  for(c = 0; CLASSSIZE(c) - sizeof(Header) < nbytes; c++)
+    ;
+  if((bp = classfree[c]) != 0){
+    classfree[c] = bp->s.ptr;
+    return (void*)(bp + 1);
+  }
+  if(arenaend - arena < CLASSSIZE(c)){
+    // Grow the arena; what is left of the old one is lost
+    // unless the new memory follows it.
+    if((p = sbrk(ARENA)) == (char*)-1)
+      return 0;
+    if(p != arenaend)
+      arena = p;
+    arenaend = p + ARENA;
+  }
+  bp = (Header*)arena;
+  arena += CLASSSIZE(c);
+  bp->s.size = c;
+  return (void*)(bp + 1);
+}
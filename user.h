@@ -1,5 +1,9 @@
 struct stat;
+struct dirstat;
+struct iovec;
+struct spawnact;
 struct rtcdate;
+struct procstat;
 
 // system calls
 int fork(void);
@@ -23,6 +27,28 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int splice(int, int, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int ioctl(int, int, int);
+int getdents(int, struct dirstat*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int setaffinity(uint);
+int nanotime(uint64*);
+int trace(int, int, void*, int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex(uint*, int, int);
+void* shmcreate(const char*, int);
+void* shmattach(const char*);
+int shmdetach(void*);
+int spawn(const char*, char**, struct spawnact*, int);
+int waitpid(int, int);
+int mount(const char*, int);
+int procstat(struct procstat*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -31,9 +57,44 @@ void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void printf(int, const char*, ...);
+void fflush(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int spandigit(const char*, int);
+int spannondigit(const char*, int);
+int spanword(const char*, int);
+void* memchr(const void*, int, uint);
+
+// uthread.c
+struct lock {
+  uint locked;
+};
+void lock_init(struct lock*);
+void lock_acquire(struct lock*);
+void lock_release(struct lock*);
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
+struct mutex {
+  uint state;
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+struct cond {
+  uint seq;
+};
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+// Character classes; see ulib.c.
+#define CT_DIGIT  0x01
+#define CT_SPACE  0x02   // blanks between words
+extern uchar ctype[];
+#define isdigit(c)  (ctype[(uchar)(c)] & CT_DIGIT)
+#define isspace(c)  (ctype[(uchar)(c)] & CT_SPACE)
@@ -4,9 +4,20 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "mman.h"
+#include "ioctl.h"
+#include "uio.h"
+#include "prof.h"
+#include "trace.h"
+#include "futex.h"
+#include "spawn.h"
+#include "wait.h"
 #include "syscall.h"
 #include "traps.h"
+#include "swap.h"
 #include "memlayout.h"
+#include "uinfo.h"
+#include "stats.h"
 
 char buf[8192];
 char name[3];
@@ -457,8 +468,137 @@ mem(void)
   }
 }
 
+// fork shares pages copy-on-write; writes by the child,
+// from user space or by the kernel in read(), must not be
+// visible to the parent, and vice versa.
+void
+cowtest(void)
+{
+  char *p;
+  int i, n, pid, fds[2];
+
+  printf(1, "cow test\n");
+  n = 16*4096;
+  p = sbrk(n);
+  if(p == (char*)-1){
+    printf(1, "cow sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++)
+    p[i] = i;
+  if(pipe(fds) != 0){
+    printf(1, "cow pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "cow fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < n; i += 2)
+      p[i] = 0;
+    // the kernel writes into a shared page here
+    read(fds[0], p + 4096 + 1, 5);
+    for(i = 0; i < n; i += 2){
+      if(p[i] != 0){
+        printf(1, "cow child lost a write\n");
+        exit();
+      }
+    }
+    if(p[4096+1] != 'x'){
+      printf(1, "cow child read failed\n");
+      exit();
+    }
+    exit();
+  }
+  // parent's writes are private too
+  p[n-1] = 'p';
+  write(fds[1], "xxxxx", 5);
+  wait();
+  for(i = 0; i < n-1; i++){
+    if(p[i] != (char)i){
+      printf(1, "cow parent saw child's write at %d\n", i);
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  // many children share many pages without running out of memory
+  for(i = 0; i < 20; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "cow fork %d failed\n", i);
+      exit();
+    }
+    if(pid == 0){
+      p[i*4096] = 'c';
+      exit();
+    }
+    wait();
+  }
+  if(sbrk(-n) == (char*)-1){
+    printf(1, "cow sbrk dealloc failed\n");
+    exit();
+  }
+  printf(1, "cow ok\n");
+}
+
 // More file system tests
 
+// more open files, across processes, than the old
+// fixed-size file table held
+void
+manyfiles(void)
+{
+  enum { NCHILD = 10, NOPEN = 11 };
+  int i, j, pid, ready[2], hold[2];
+  char c;
+
+  printf(1, "manyfiles test\n");
+  if(pipe(ready) != 0 || pipe(hold) != 0){
+    printf(1, "manyfiles pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "manyfiles fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(hold[1]);
+      for(j = 0; j < NOPEN; j++){
+        if(open("README", 0) < 0){
+          printf(1, "manyfiles open failed\n");
+          c = 'x';
+          write(ready[1], &c, 1);
+          exit();
+        }
+      }
+      c = 'y';
+      write(ready[1], &c, 1);
+      read(hold[0], &c, 1);
+      exit();
+    }
+  }
+  close(hold[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1 || c != 'y'){
+      printf(1, "manyfiles: a child could not open its files\n");
+      exit();
+    }
+  }
+  close(hold[1]);
+  for(i = 0; i < NCHILD; i++)
+    wait();
+  close(ready[0]);
+  close(ready[1]);
+  printf(1, "manyfiles ok\n");
+}
+
 // two processes write to the same file descriptor
 // is the offset shared? does inode locking work?
 void
@@ -512,6 +652,53 @@ sharedfd(void)
   }
 }
 
+// four processes rewrite and check their own quarter of one
+// block at the same time, waiting on its buffer and inode locks.
+void
+sleeplocktest(void)
+{
+  int fd, pid, i, j, k;
+  char buf[128], got[128];
+
+  printf(1, "sleeplock test\n");
+  unlink("sleeplk");
+  if((fd = open("sleeplk", O_CREATE|O_RDWR)) < 0){
+    printf(1, "create sleeplk failed\n");
+    exit();
+  }
+  memset(buf, 0, sizeof(buf));
+  for(k = 0; k < 4; k++)
+    write(fd, buf, sizeof(buf));
+  for(k = 0; k < 4; k++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(i = 0; i < 500; i++){
+        memset(buf, 'a' + k*8 + i%8, sizeof(buf));
+        if(pwrite(fd, buf, sizeof(buf), k*sizeof(buf)) != sizeof(buf) ||
+           pread(fd, got, sizeof(got), k*sizeof(got)) != sizeof(got)){
+          printf(1, "sleeplk i/o failed\n");
+          exit();
+        }
+        for(j = 0; j < sizeof(got); j++)
+          if(got[j] != buf[j]){
+            printf(1, "sleeplk read %c, wrote %c\n", got[j], buf[j]);
+            exit();
+          }
+      }
+      exit();
+    }
+  }
+  for(k = 0; k < 4; k++)
+    wait();
+  close(fd);
+  unlink("sleeplk");
+  printf(1, "sleeplock ok\n");
+}
+
 // four processes write different files at the same
 // time, to test block allocation.
 void
@@ -1373,6 +1560,1242 @@ iref(void)
   printf(1, "empty file name OK\n");
 }
 
+// sbrk'd pages are allocated on first touch, by user code,
+// by the kernel, or in a forked child
+void
+lazytest(void)
+{
+  char *p, *q;
+  int i, fd, n, pid;
+
+  printf(1, "lazy test\n");
+  n = 32*1024*1024;
+  p = sbrk(n);
+  if(p == (char*)-1){
+    printf(1, "lazy sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i += 1024*1024){
+    if(p[i] != 0){
+      printf(1, "lazy page not zero\n");
+      exit();
+    }
+  }
+  // the kernel fills an untouched page
+  fd = open("README", 0);
+  q = p + n - 4096 - 100;
+  if(fd < 0 || read(fd, q, 200) != 200){
+    printf(1, "lazy read into untouched page failed\n");
+    exit();
+  }
+  close(fd);
+  pid = fork();
+  if(pid < 0){
+    printf(1, "lazy fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 512*1024; i < n; i += 1024*1024)
+      p[i] = 'c';
+    exit();
+  }
+  wait();
+  for(i = 512*1024; i < n; i += 1024*1024){
+    if(p[i] != 0){
+      printf(1, "lazy child's write visible to parent\n");
+      exit();
+    }
+  }
+  if(sbrk(-n) == (char*)-1){
+    printf(1, "lazy sbrk shrink failed\n");
+    exit();
+  }
+  printf(1, "lazy ok\n");
+}
+
+// map a file, share it with a child, see writes through it
+void
+mmaptest(void)
+{
+  char *p, *q;
+  int fd, i, pid;
+
+  printf(1, "mmap test\n");
+  unlink("mmapf");
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  for(i = 0; i < 3; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+
+  fd = open("mmapf", O_RDWR);
+  p = mmap(0, 3*sizeof(buf), PROT_READ, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(1, "mmap failed\n");
+    exit();
+  }
+  if(mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != MAP_FAILED){
+    printf(1, "mmap writable shared mapping succeeded\n");
+    exit();
+  }
+  for(i = 0; i < 3*sizeof(buf); i++){
+    if(p[i] != 'a' + i % sizeof(buf) % 26){
+      printf(1, "mmap wrong content\n");
+      exit();
+    }
+  }
+  // write() is seen through the mapping, by the child too
+  write(fd, "XY", 2);
+  pid = fork();
+  if(pid < 0){
+    printf(1, "mmap fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(p[0] != 'X' || p[1] != 'Y')
+      printf(1, "mmap child sees wrong content\n");
+    exit();
+  }
+  wait();
+  if(p[0] != 'X' || p[1] != 'Y'){
+    printf(1, "mmap write not seen\n");
+    exit();
+  }
+  if(read(fd, p, 10) != -1){
+    printf(1, "mmap read into read-only mapping succeeded\n");
+    exit();
+  }
+
+  // private writes stay private
+  q = mmap(0, 3*sizeof(buf), PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(q == MAP_FAILED){
+    printf(1, "mmap private failed\n");
+    exit();
+  }
+  q[0] = 'Z';
+  if(p[0] != 'X' || q[1] != 'Y'){
+    printf(1, "mmap private write leaked\n");
+    exit();
+  }
+  close(fd);
+  if(munmap(q, 3*sizeof(buf)) < 0 || munmap(p, 4096) < 0){
+    printf(1, "munmap failed\n");
+    exit();
+  }
+  if(p[4096] != 'a' + 4096 % sizeof(buf) % 26){
+    printf(1, "mmap tail lost\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    printf(1, "munmap page still mapped %x\n", p[0]);
+    exit();
+  }
+  wait();
+  munmap(p + 4096, 3*sizeof(buf) - 4096);
+  unlink("mmapf");
+  printf(1, "mmap ok\n");
+}
+
+// report how fast data moves between user and kernel buffers
+// through a pipe and out of cached file blocks
+void
+copybench(void)
+{
+  int fd, fds[2], i, n, pid, t, tot;
+
+  printf(1, "copy bench\n");
+  if(pipe(fds) != 0){
+    printf(1, "copy bench pipe failed\n");
+    exit();
+  }
+  t = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf(1, "copy bench fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(i = 0; i < 512; i++)
+      write(fds[1], buf, sizeof(buf));
+    exit();
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    tot += n;
+  close(fds[0]);
+  wait();
+  t = uptime() - t;
+  printf(1, "pipe: %d bytes in %d ticks, %d KB/s\n",
+         tot, t, t ? tot / 10 / t : 0);
+
+  unlink("copyf");
+  fd = open("copyf", O_CREATE|O_RDWR);
+  for(i = 0; i < 8; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+  t = uptime();
+  tot = 0;
+  for(i = 0; i < 32; i++){
+    fd = open("copyf", 0);
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      tot += n;
+    close(fd);
+  }
+  t = uptime() - t;
+  unlink("copyf");
+  printf(1, "file: %d bytes in %d ticks, %d KB/s\n",
+         tot, t, t ? tot / 10 / t : 0);
+  printf(1, "copy bench ok\n");
+}
+
+// ioctl() reaches the console, and only devices.
+void
+ioctltest(void)
+{
+  int fd;
+
+  printf(1, "ioctl test\n");
+  fd = open("console", O_RDWR);
+  if(fd < 0){
+    printf(1, "ioctl open console failed\n");
+    exit();
+  }
+  if(ioctl(fd, CONSRAW, 1) != 0 || ioctl(fd, CONSRAW, 0) != 0){
+    printf(1, "ioctl CONSRAW failed\n");
+    exit();
+  }
+  if(ioctl(fd, -1, 0) != -1){
+    printf(1, "ioctl bad request succeeded\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("ioctlf", O_CREATE|O_RDWR);
+  if(ioctl(fd, CONSRAW, 1) != -1){
+    printf(1, "ioctl on a file succeeded\n");
+    exit();
+  }
+  close(fd);
+  unlink("ioctlf");
+  printf(1, "ioctl ok\n");
+}
+
+// getdents() returns every entry, with the right type and
+// size, across several calls with a small buffer.
+void
+getdentstest(void)
+{
+  struct dirstat ds[3];
+  char name[2];
+  int fd, i, n, seen;
+
+  printf(1, "getdents test\n");
+  if(mkdir("gdd") != 0 || chdir("gdd") != 0){
+    printf(1, "getdents mkdir failed\n");
+    exit();
+  }
+  name[1] = 0;
+  for(i = 0; i < 10; i++){
+    name[0] = 'a' + i;
+    fd = open(name, O_CREATE|O_RDWR);
+    write(fd, buf, 10*i);
+    close(fd);
+  }
+  mkdir("k");
+
+  fd = open(".", 0);
+  seen = 0;
+  while((n = getdents(fd, ds, sizeof(ds))) > 0){
+    for(i = 0; i < n / sizeof(ds[0]); i++){
+      if(strcmp(ds[i].name, ".") == 0 || strcmp(ds[i].name, "..") == 0 ||
+         strcmp(ds[i].name, "k") == 0){
+        if(ds[i].type != T_DIR){
+          printf(1, "getdents %s not a directory\n", ds[i].name);
+          exit();
+        }
+      } else if(ds[i].type != T_FILE ||
+                ds[i].size != 10*(ds[i].name[0] - 'a')){
+        printf(1, "getdents %s wrong type or size\n", ds[i].name);
+        exit();
+      }
+      seen++;
+    }
+  }
+  close(fd);
+  if(n < 0 || seen != 13){
+    printf(1, "getdents saw %d entries\n", seen);
+    exit();
+  }
+
+  fd = open("a", 0);
+  if(getdents(fd, ds, sizeof(ds)) != -1){
+    printf(1, "getdents on a file succeeded\n");
+    exit();
+  }
+  close(fd);
+
+  for(i = 0; i < 10; i++){
+    name[0] = 'a' + i;
+    unlink(name);
+  }
+  unlink("k");
+  chdir("..");
+  unlink("gdd");
+  printf(1, "getdents ok\n");
+}
+
+// pread() and pwrite() leave the file offset alone;
+// readv() and writev() fill and drain buffers in order.
+void
+pvtest(void)
+{
+  struct iovec iov[3];
+  char a[10], b[20], c[30];
+  int fd, i;
+
+  printf(1, "pread/readv test\n");
+  unlink("pvf");
+  fd = open("pvf", O_CREATE|O_RDWR);
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i;
+  if(write(fd, buf, 1000) != 1000 || pwrite(fd, "xyz", 3, 500) != 3){
+    printf(1, "pwrite failed\n");
+    exit();
+  }
+  if(pread(fd, a, 10, 498) != 10 || a[0] != (char)498 || a[2] != 'x' ||
+     a[4] != 'z' || a[5] != (char)503){
+    printf(1, "pread wrong data\n");
+    exit();
+  }
+  if(pread(fd, a, 10, 995) != 5 || pread(fd, a, 10, 2000) != 0){
+    printf(1, "pread past the end\n");
+    exit();
+  }
+  // Neither moved the offset, which is still at 1000.
+  if(write(fd, "end", 3) != 3 || pread(fd, a, 3, 1000) != 3 ||
+     a[0] != 'e' || a[2] != 'd'){
+    printf(1, "pread/pwrite moved the offset\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("pvf", O_RDWR);
+  iov[0].base = a; iov[0].len = 10;
+  iov[1].base = b; iov[1].len = 20;
+  iov[2].base = c; iov[2].len = 30;
+  if(readv(fd, iov, 3) != 60 || a[9] != 9 || b[0] != 10 || c[29] != 59){
+    printf(1, "readv failed\n");
+    exit();
+  }
+  iov[0].base = "ab"; iov[0].len = 2;
+  iov[1].base = "cde"; iov[1].len = 3;
+  if(writev(fd, iov, 2) != 5 || pread(fd, a, 5, 60) != 5 ||
+     a[0] != 'a' || a[4] != 'e'){
+    printf(1, "writev failed\n");
+    exit();
+  }
+  iov[0].base = (char*)0xfffff000;
+  if(readv(fd, iov, 1) != -1 || readv(fd, iov, IOV_MAX+1) != -1){
+    printf(1, "readv took a bad iovec\n");
+    exit();
+  }
+  close(fd);
+  unlink("pvf");
+  printf(1, "pread/readv ok\n");
+}
+
+// setaffinity() rejects an empty mask, and pinned processes
+// and their children still run.
+void
+affinitytest(void)
+{
+  int i, pid;
+
+  printf(1, "affinity test\n");
+  if(setaffinity(0) != -1){
+    printf(1, "setaffinity(0) succeeded\n");
+    exit();
+  }
+  if(setaffinity(1) != 0){
+    printf(1, "setaffinity(1) failed\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      sleep(1);
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++)
+    wait();
+  setaffinity(~0);
+  printf(1, "affinity ok\n");
+}
+
+// sleep() lasts about as long as asked, by nanotime(),
+// which never goes backwards.
+void
+timetest(void)
+{
+  uint64 t0, t1, t2;
+  uint ms;
+
+  printf(1, "time test\n");
+  if(nanotime(&t0) != 0 || nanotime(&t1) != 0 || t1 < t0){
+    printf(1, "nanotime failed\n");
+    exit();
+  }
+  if(sleep(10) != 0 || nanotime(&t2) != 0){
+    printf(1, "sleep failed\n");
+    exit();
+  }
+  ms = (uint)((t2 - t1) >> 20);  // about milliseconds
+  if(ms < 9*1000/HZ/2 || ms > 10*1000/HZ*20){
+    printf(1, "sleep(10) took %d ms\n", ms);
+    exit();
+  }
+  printf(1, "time ok\n");
+}
+
+// the profiler catches this process spinning in user space
+void
+proftest(void)
+{
+  struct sample s[64];
+  int fd, i, n, mine, t;
+
+  printf(1, "prof test\n");
+  if((fd = open("prof", O_RDONLY)) < 0){
+    printf(1, "open prof failed\n");
+    exit();
+  }
+  if(ioctl(fd, PROFON, 0) != 0){
+    printf(1, "PROFON failed\n");
+    exit();
+  }
+  for(t = uptime(); uptime() < t + 5; )
+    ;
+  if(ioctl(fd, PROFOFF, 0) < 0){
+    printf(1, "PROFOFF failed\n");
+    exit();
+  }
+  mine = 0;
+  while((n = read(fd, s, sizeof(s))) > 0)
+    for(i = 0; i < n / sizeof(s[0]); i++)
+      if(s[i].pid == getpid() && s[i].pc < KERNBASE)
+        mine++;
+  close(fd);
+  if(mine == 0){
+    printf(1, "no user samples\n");
+    exit();
+  }
+  printf(1, "prof ok\n");
+}
+
+// text is read-only and shared: system calls refuse to write
+// it, and a process that stores to it is killed
+void
+texttest(void)
+{
+  int fds[2], pid;
+  char c;
+
+  printf(1, "text test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], (char*)texttest, 1) != -1){
+    printf(1, "read into text succeeded\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    *(volatile char*)texttest = 0;
+    write(fds[1], "y", 1);
+    exit();
+  }
+  wait();
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1 || c != 'x' || read(fds[0], &c, 1) != 0){
+    printf(1, "store to text succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  printf(1, "text ok\n");
+}
+
+// the swap device reports sane counts
+void
+swaptest(void)
+{
+  struct swapstat st;
+  int fd;
+
+  printf(1, "swap test\n");
+  if((fd = open("/swap", O_RDONLY)) < 0){
+    printf(1, "open swap failed\n");
+    exit();
+  }
+  if(read(fd, &st, sizeof(st)) != sizeof(st)){
+    printf(1, "read swap failed\n");
+    exit();
+  }
+  close(fd);
+  if(st.nused > st.nslot || st.nfree == 0){
+    printf(1, "bad swap counts %d of %d, %d free\n", st.nused, st.nslot, st.nfree);
+    exit();
+  }
+  printf(1, "swap ok\n");
+}
+
+// the stats device and procstat() report sane counts,
+// and procstat() finds the caller
+void
+statstest(void)
+{
+  static struct procstat ps[NPROC];
+  struct sysstat st;
+  int fd, i, n, pid;
+
+  printf(1, "stats test\n");
+  if((fd = open("/stats", O_RDONLY)) < 0){
+    printf(1, "open stats failed\n");
+    exit();
+  }
+  if(read(fd, &st, sizeof(st)) != sizeof(st)){
+    printf(1, "read stats failed\n");
+    exit();
+  }
+  close(fd);
+  if(st.npage == 0 || st.nfree > st.npage || st.bhit + st.bmiss == 0 ||
+     st.logsize == 0 || st.logused > st.logsize || st.ninode == 0){
+    printf(1, "bad stats counts\n");
+    exit();
+  }
+  if(procstat(ps, -1) != -1){
+    printf(1, "procstat took a negative count\n");
+    exit();
+  }
+  pid = getpid();
+  n = procstat(ps, NPROC);
+  for(i = 0; i < n; i++)
+    if(ps[i].pid == pid)
+      break;
+  if(i == n || ps[i].sz == 0 || strcmp(ps[i].name, "usertests") != 0){
+    printf(1, "procstat did not find usertests\n");
+    exit();
+  }
+  printf(1, "stats ok\n");
+}
+
+// every CPU counts its clock interrupts, and only enabled
+// interrupts can be routed, to CPUs that exist
+void
+intrtest(void)
+{
+  static uint count[NCPU][NIRQ];
+  int fd, c, n, all;
+
+  printf(1, "intr test\n");
+  if((fd = open("/interrupts", O_RDONLY)) < 0){
+    printf(1, "open interrupts failed\n");
+    exit();
+  }
+  n = read(fd, count, sizeof(count)) / sizeof(count[0]);
+  if(n <= 0){
+    printf(1, "read interrupts failed\n");
+    exit();
+  }
+  for(c = 0; c < n; c++){
+    if(count[c][IRQ_TIMER] == 0){
+      printf(1, "cpu%d took no clock interrupts\n", c);
+      exit();
+    }
+  }
+  if(ioctl(fd, INTRROUTE, IRQ_TIMER | 1 << 8) != -1){
+    printf(1, "routed a disabled irq\n");
+    exit();
+  }
+  if(ioctl(fd, INTRROUTE, IRQ_IDE | 1 << (n + 8)) != -1){
+    printf(1, "routed to a missing cpu\n");
+    exit();
+  }
+  all = (1 << n) - 1;
+  if(ioctl(fd, INTRROUTE, IRQ_IDE | 1 << 8) != 0 ||
+     ioctl(fd, INTRROUTE, IRQ_IDE | (n > 1 ? all & ~1 : all) << 8) != 0){
+    printf(1, "routing ide failed\n");
+    exit();
+  }
+  close(fd);
+  printf(1, "intr ok\n");
+}
+
+// The system calls behind ulib's getpid() and uptime(),
+// which usually read the uinfo.h pages instead.
+int _getpid(void);
+int _uptime(void);
+
+// getpid() and uptime() from the uinfo pages agree with the
+// system calls, in forked children too, and the pages are
+// read-only
+void
+uinfotest(void)
+{
+  int fds[2], pid, cpid, t;
+
+  printf(1, "uinfo test\n");
+  if(getpid() != _getpid()){
+    printf(1, "getpid %d, system call says %d\n", getpid(), _getpid());
+    exit();
+  }
+  t = uptime();
+  sleep(2);
+  if(uptime() < t + 2 || uptime() > _uptime()){
+    printf(1, "uptime did not advance with the clock\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    cpid = getpid();
+    write(fds[1], &cpid, sizeof(cpid));
+    *(volatile int*)UINFO = 1;
+    write(fds[1], &cpid, sizeof(cpid));
+    exit();
+  }
+  wait();
+  close(fds[1]);
+  if(read(fds[0], &cpid, sizeof(cpid)) != sizeof(cpid) || cpid != pid){
+    printf(1, "child's getpid was not %d\n", pid);
+    exit();
+  }
+  if(read(fds[0], &cpid, sizeof(cpid)) != 0){
+    printf(1, "store to uinfo succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  printf(1, "uinfo ok\n");
+}
+
+// system calls are counted, and logged while tracing is on
+void
+tracetest(void)
+{
+  static struct scstat st[NSYSCALL];
+  struct scevent ev[64];
+  int i, n, found;
+
+  printf(1, "trace test\n");
+  if(trace(TRACERESET, 0, 0, 0) != 0){
+    printf(1, "TRACERESET failed\n");
+    exit();
+  }
+  for(i = 0; i < 10; i++)
+    _getpid();
+  if(trace(TRACESTAT, 0, st, 0) != 0 || st[SYS_getpid].n < 10 ||
+     st[SYS_getpid].cycles == 0){
+    printf(1, "getpid not counted\n");
+    exit();
+  }
+  if(trace(TRACESTAT, 0, (void*)KERNBASE, 0) != -1){
+    printf(1, "TRACESTAT to kernel memory succeeded\n");
+    exit();
+  }
+
+  trace(TRACEPROC, 1, 0, 0);
+  _uptime();
+  trace(TRACEPROC, 0, 0, 0);
+  found = 0;
+  while((n = trace(TRACEREAD, 0, ev, sizeof(ev))) > 0)
+    for(i = 0; i < n / sizeof(ev[0]); i++)
+      if(ev[i].pid == getpid() && ev[i].num == SYS_uptime)
+        found = 1;
+  if(!found){
+    printf(1, "uptime not traced\n");
+    exit();
+  }
+  printf(1, "trace ok\n");
+}
+
+struct lock tlock;
+int tcount;
+char *tmem;
+
+void
+threadcount(void *arg)
+{
+  int i;
+
+  for(i = 0; i < (int)arg; i++){
+    lock_acquire(&tlock);
+    tcount++;
+    lock_release(&tlock);
+  }
+  exit();
+}
+
+void
+threadsbrk(void *arg)
+{
+  tmem = sbrk(4096);
+  if(tmem != (char*)-1)
+    tmem[4095] = 'x';
+  exit();
+}
+
+// threads share memory, including memory one of them sbrk()s
+void
+threadtest(void)
+{
+  int i, pid;
+
+  printf(1, "thread test\n");
+  lock_init(&tlock);
+  tcount = 0;
+  for(i = 0; i < 4; i++){
+    if(thread_create(threadcount, (void*)1000) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(thread_join() < 0){
+      printf(1, "thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1){
+    printf(1, "thread_join with no threads succeeded\n");
+    exit();
+  }
+  if(tcount != 4000){
+    printf(1, "threads counted %d, not 4000\n", tcount);
+    exit();
+  }
+
+  if((pid = thread_create(threadsbrk, 0)) < 0 || thread_join() != pid){
+    printf(1, "sbrk thread failed\n");
+    exit();
+  }
+  if(tmem == (char*)-1 || tmem[4095] != 'x' || sbrk(0) != tmem + 4096){
+    printf(1, "thread's sbrk not shared\n");
+    exit();
+  }
+  printf(1, "thread ok\n");
+}
+
+struct mutex fmutex;
+struct cond fcond;
+int fturn;
+
+void
+futexcount(void *arg)
+{
+  int i;
+
+  for(i = 0; i < (int)arg; i++){
+    mutex_lock(&fmutex);
+    tcount++;
+    mutex_unlock(&fmutex);
+  }
+  exit();
+}
+
+// take turns with the main thread, fturn saying whose turn
+void
+futexpingpong(void *arg)
+{
+  int i;
+
+  for(i = 0; i < (int)arg; i++){
+    mutex_lock(&fmutex);
+    while(fturn != 1)
+      cond_wait(&fcond, &fmutex);
+    fturn = 0;
+    cond_signal(&fcond);
+    mutex_unlock(&fmutex);
+  }
+  exit();
+}
+
+// mutexes and condition variables built on futex()
+void
+futextest(void)
+{
+  uint word;
+  int i;
+
+  printf(1, "futex test\n");
+  word = 1;
+  if(futex(&word, FUTEX_WAIT, 2) != 0 || futex(&word, FUTEX_WAKE, 1) != 0){
+    printf(1, "futex on a free word failed\n");
+    exit();
+  }
+  if(futex((uint*)KERNBASE, FUTEX_WAKE, 1) != -1 ||
+     futex((uint*)((char*)&word + 1), FUTEX_WAKE, 1) != -1){
+    printf(1, "futex on a bad address succeeded\n");
+    exit();
+  }
+
+  mutex_init(&fmutex);
+  tcount = 0;
+  for(i = 0; i < 4; i++)
+    if(thread_create(futexcount, (void*)1000) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  for(i = 0; i < 4; i++)
+    thread_join();
+  if(tcount != 4000){
+    printf(1, "mutex counted %d, not 4000\n", tcount);
+    exit();
+  }
+
+  cond_init(&fcond);
+  fturn = 0;
+  if(thread_create(futexpingpong, (void*)100) < 0){
+    printf(1, "thread_create failed\n");
+    exit();
+  }
+  for(i = 0; i < 100; i++){
+    mutex_lock(&fmutex);
+    while(fturn != 0)
+      cond_wait(&fcond, &fmutex);
+    fturn = 1;
+    cond_signal(&fcond);
+    mutex_unlock(&fmutex);
+  }
+  thread_join();
+  if(fturn != 0){
+    printf(1, "ping-pong ended on the wrong turn\n");
+    exit();
+  }
+  printf(1, "futex ok\n");
+}
+
+// processes see each other's writes to a shared memory segment
+void
+shmtest(void)
+{
+  char *a, *b;
+  int pid;
+
+  printf(1, "shm test\n");
+  if((a = shmcreate("shmtest", 8192)) == (char*)-1){
+    printf(1, "shmcreate failed\n");
+    exit();
+  }
+  if(shmcreate("shmtest", 4096) != (char*)-1){
+    printf(1, "shmcreate of an existing segment succeeded\n");
+    exit();
+  }
+  if(a[0] != 0 || a[8191] != 0){
+    printf(1, "new segment not zeroed\n");
+    exit();
+  }
+  a[8191] = 'a';
+
+  // A forked child shares the segment, without copy-on-write;
+  // one that attaches by name sees the same pages.
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    a[0] = 'c';
+    if((b = shmattach("shmtest")) == (char*)-1 || b == a || b[8191] != 'a'){
+      printf(1, "shmattach in child failed\n");
+      exit();
+    }
+    b[1] = 'd';
+    if(shmdetach(b) != 0 || shmdetach(b) != -1){
+      printf(1, "shmdetach in child failed\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+  if(a[0] != 'c' || a[1] != 'd'){
+    printf(1, "child's writes not shared\n");
+    exit();
+  }
+  if(munmap(a, 4096) != -1){
+    printf(1, "munmap of part of a segment succeeded\n");
+    exit();
+  }
+  if(shmdetach(a) != 0){
+    printf(1, "shmdetach failed\n");
+    exit();
+  }
+  if(shmattach("shmtest") != (char*)-1){
+    printf(1, "segment outlived its last detach\n");
+    exit();
+  }
+  printf(1, "shm ok\n");
+}
+
+// spawn() a program with its input and output redirected
+void
+spawntest(void)
+{
+  struct spawnact act[3];
+  char *argv[] = { "cat", 0 };
+  int fd, n;
+
+  printf(1, "spawn test\n");
+  unlink("spawnin");
+  unlink("spawnout");
+  fd = open("spawnin", O_CREATE|O_WRONLY);
+  write(fd, "spawned\n", 8);
+  close(fd);
+
+  act[0].op = SPAWN_OPEN;
+  act[0].fd = 0;
+  act[0].arg = O_RDONLY;
+  act[0].path = "spawnin";
+  act[1].op = SPAWN_OPEN;
+  act[1].fd = 3;
+  act[1].arg = O_CREATE|O_WRONLY;
+  act[1].path = "spawnout";
+  act[2].op = SPAWN_DUP;
+  act[2].fd = 1;
+  act[2].arg = 3;
+  if(spawn("cat", argv, act, 3) < 0 || wait() < 0){
+    printf(1, "spawn cat failed\n");
+    exit();
+  }
+  fd = open("spawnout", O_RDONLY);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  buf[n > 0 ? n : 0] = 0;
+  if(n != 8 || strcmp(buf, "spawned\n") != 0){
+    printf(1, "spawned cat wrote %d bytes\n", n);
+    exit();
+  }
+
+  if(spawn("nosuchprogram", argv, 0, 0) != -1){
+    printf(1, "spawn of a missing program succeeded\n");
+    exit();
+  }
+  act[0].op = SPAWN_DUP;
+  act[0].fd = 1;
+  act[0].arg = NOFILE-1;
+  if(spawn("cat", argv, act, 1) != -1){
+    printf(1, "spawn with a bad action succeeded\n");
+    exit();
+  }
+  unlink("spawnin");
+  unlink("spawnout");
+  printf(1, "spawn ok\n");
+}
+
+// waitpid() for a particular child, and without waiting
+void
+waitpidtest(void)
+{
+  int fds[3][2], pid[3], i;
+  char c;
+
+  printf(1, "waitpid test\n");
+  for(i = 0; i < 3; i++){
+    if(pipe(fds[i]) < 0){
+      printf(1, "pipe failed\n");
+      exit();
+    }
+    if((pid[i] = fork()) == 0){
+      // Exit once the parent writes or closes.
+      close(fds[i][1]);
+      read(fds[i][0], &c, 1);
+      exit();
+    }
+    close(fds[i][0]);
+  }
+
+  if(waitpid(-1, WNOHANG) != 0){
+    printf(1, "waitpid WNOHANG did not return 0\n");
+    exit();
+  }
+  if(waitpid(getpid(), 0) != -1){
+    printf(1, "waitpid of a non-child succeeded\n");
+    exit();
+  }
+  close(fds[1][1]);
+  if(waitpid(pid[1], 0) != pid[1]){
+    printf(1, "waitpid of the middle child failed\n");
+    exit();
+  }
+  close(fds[0][1]);
+  close(fds[2][1]);
+  if(waitpid(pid[2], 0) != pid[2] || wait() != pid[0] || wait() != -1){
+    printf(1, "waitpid reaped the wrong child\n");
+    exit();
+  }
+  printf(1, "waitpid ok\n");
+}
+
+// files in the in-memory file system at /tmp
+void
+tmpfstest(void)
+{
+  struct stat st;
+  int fd, i, n;
+
+  printf(1, "tmpfs test\n");
+  if(mkdir("/tmp/td") < 0){
+    printf(1, "mkdir /tmp/td failed\n");
+    exit();
+  }
+  if((fd = open("/tmp/td/f", O_CREATE|O_RDWR)) < 0){
+    printf(1, "create /tmp/td/f failed\n");
+    exit();
+  }
+  // Span several pages, partly written.
+  for(i = 0; i < 10; i++){
+    memset(buf, 'a'+i, 1000);
+    if(write(fd, buf, 1000) != 1000){
+      printf(1, "tmpfs write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  fd = open("/tmp/td/f", O_RDONLY);
+  for(i = 0; i < 10; i++){
+    if((n = read(fd, buf, 1000)) != 1000 || buf[0] != 'a'+i ||
+       buf[999] != 'a'+i){
+      printf(1, "tmpfs read back failed\n");
+      exit();
+    }
+  }
+  if(read(fd, buf, 1) != 0 || fstat(fd, &st) < 0 ||
+     st.dev != TMPDEV || st.size != 10000){
+    printf(1, "tmpfs file has the wrong size or device\n");
+    exit();
+  }
+  close(fd);
+
+  if(stat("/tmp/td/../..", &st) < 0 || st.dev != ROOTDEV ||
+     st.ino != ROOTINO){
+    printf(1, "/tmp/.. is not the root\n");
+    exit();
+  }
+  if(link("/tmp/td/f", "tdlink") == 0 || unlink("/tmp") == 0){
+    printf(1, "link across, or unlink of, the mount succeeded\n");
+    exit();
+  }
+  if(mount("/tmp/td", TMPDEV) == 0 || mount("/tmp/td", ROOTDEV) == 0 ||
+     mount("/tmp/td/f", 3) == 0){
+    printf(1, "bad mount succeeded\n");
+    exit();
+  }
+  if(unlink("/tmp/td") == 0 || unlink("/tmp/td/f") < 0 ||
+     unlink("/tmp/td") < 0 || open("/tmp/td", O_RDONLY) >= 0){
+    printf(1, "tmpfs unlink failed\n");
+    exit();
+  }
+  printf(1, "tmpfs ok\n");
+}
+
+#define NMANYPROC 100
+
+// many live processes at once, each of which kill() finds by pid
+void
+manyproctest(void)
+{
+  int pid[NMANYPROC], fds[2], i, n;
+  char c;
+
+  printf(1, "manyproc test\n");
+  if(pipe(fds) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  for(n = 0; n < NMANYPROC; n++){
+    if((pid[n] = fork()) < 0)
+      break;
+    if(pid[n] == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit();
+    }
+  }
+  close(fds[0]);
+  if(n < NMANYPROC){
+    printf(1, "only %d processes forked\n", n);
+    exit();
+  }
+  for(i = 0; i < n; i += 2)
+    if(kill(pid[i]) < 0){
+      printf(1, "kill %d failed\n", pid[i]);
+      exit();
+    }
+  close(fds[1]);
+  for(i = 0; i < n; i++)
+    if(wait() < 0){
+      printf(1, "wait lost a child\n");
+      exit();
+    }
+  if(wait() != -1 || kill(pid[0]) != -1){
+    printf(1, "reaped process still found\n");
+    exit();
+  }
+  printf(1, "manyproc ok\n");
+}
+
+// move a file through a pipe into another file with splice
+void
+splicetest(void)
+{
+  int fd, fd1, fds[2], i, n, tot;
+
+  printf(1, "splice test\n");
+  unlink("splicea");
+  unlink("spliceb");
+  fd = open("splicea", O_CREATE|O_RDWR);
+  for(i = 0; i < 10; i++){
+    memset(buf, 'a'+i, 1000);
+    if(write(fd, buf, 1000) != 1000){
+      printf(1, "splice write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf(1, "splice pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    close(fds[0]);
+    fd = open("splicea", 0);
+    while((n = splice(fd, fds[1], 3000)) > 0)
+      ;
+    if(n < 0){
+      printf(1, "splice file to pipe failed\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[1]);
+  fd1 = open("spliceb", O_CREATE|O_RDWR);
+  tot = 0;
+  while((n = splice(fds[0], fd1, 2500)) > 0)
+    tot += n;
+  wait();
+  close(fds[0]);
+  close(fd1);
+  if(n < 0 || tot != 10000){
+    printf(1, "splice pipe to file moved %d\n", tot);
+    exit();
+  }
+
+  fd1 = open("spliceb", 0);
+  for(i = 0; i < 10; i++){
+    if(read(fd1, buf, 1000) != 1000){
+      printf(1, "splice read failed\n");
+      exit();
+    }
+    for(n = 0; n < 1000; n++){
+      if(buf[n] != 'a'+i){
+        printf(1, "splice wrong data\n");
+        exit();
+      }
+    }
+  }
+  close(fd1);
+  if(splice(0, 1, 10) >= 0){
+    printf(1, "splice without a pipe succeeded\n");
+    exit();
+  }
+  unlink("splicea");
+  unlink("spliceb");
+  printf(1, "splice ok\n");
+}
+
+// names cached by the kernel must not outlive
+// their directory entries or their directories
+void
+dcachetest(void)
+{
+  int i, j, fd;
+
+  printf(1, "dcache test\n");
+
+  for(i = 0; i < 10; i++){
+    if(mkdir("dcd") != 0){
+      printf(1, "dcache mkdir dcd failed\n");
+      exit();
+    }
+    fd = open("dcd/f", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf(1, "dcache create dcd/f failed\n");
+      exit();
+    }
+    close(fd);
+    // the second open should hit the cache
+    for(j = 0; j < 2; j++){
+      if((fd = open("dcd/f", 0)) < 0){
+        printf(1, "dcache open dcd/f failed\n");
+        exit();
+      }
+      close(fd);
+    }
+    if(unlink("dcd/f") != 0){
+      printf(1, "dcache unlink dcd/f failed\n");
+      exit();
+    }
+    if(open("dcd/f", 0) >= 0){
+      printf(1, "dcache opened unlinked dcd/f\n");
+      exit();
+    }
+    fd = open("dcd/f", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf(1, "dcache recreate dcd/f failed\n");
+      exit();
+    }
+    close(fd);
+    unlink("dcd/f");
+    if(unlink("dcd") != 0){
+      printf(1, "dcache unlink dcd failed\n");
+      exit();
+    }
+    // a new directory may reuse dcd's inode
+    if(mkdir("dce") != 0){
+      printf(1, "dcache mkdir dce failed\n");
+      exit();
+    }
+    if(open("dce/f", 0) >= 0){
+      printf(1, "dcache found f in a new directory\n");
+      exit();
+    }
+    unlink("dce");
+  }
+
+  printf(1, "dcache ok\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -1762,6 +3185,8 @@ main(int argc, char *argv[])
   concreate();
   fourfiles();
   sharedfd();
+  sleeplocktest();
+  manyfiles();
 
   bigargtest();
   bigwrite();
@@ -1780,7 +3205,31 @@ main(int argc, char *argv[])
   iputtest();
 
   mem();
+  cowtest();
+  lazytest();
+  mmaptest();
   pipe1();
+  splicetest();
+  copybench();
+  ioctltest();
+  getdentstest();
+  pvtest();
+  affinitytest();
+  timetest();
+  proftest();
+  texttest();
+  swaptest();
+  statstest();
+  intrtest();
+  uinfotest();
+  tracetest();
+  threadtest();
+  futextest();
+  shmtest();
+  spawntest();
+  waitpidtest();
+  manyproctest();
+  tmpfstest();
   preempt();
   exitwait();
 
@@ -1792,6 +3241,7 @@ main(int argc, char *argv[])
   unlinkread();
   dirfile();
   iref();
+  dcachetest();
   forktest();
   bigdir(); // slow
 
@@ -0,0 +1,130 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "x86.h"
+#include "futex.h"
+
+// Threads share the memory of the process that made them,
+// but are otherwise separate processes: each has its pid and
+// its own copies of the open files.  malloc() and printf()
+// are not safe to call from several threads at once; guard
+// them with a lock.  A thread ends by calling exit().
+
+#define THREADSTACK 4096  // the page clone() wants
+
+void
+lock_init(struct lock *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(struct lock *lk)
+{
+  while(xchg(&lk->locked, 1) != 0)
+    ;
+}
+
+void
+lock_release(struct lock *lk)
+{
+  xchg(&lk->locked, 0);
+}
+
+// Start a thread running fn(arg).  Returns its pid, or -1.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  void *stack;
+  int pid;
+
+  if((stack = malloc(THREADSTACK)) == 0)
+    return -1;
+  if((pid = clone(fn, arg, stack)) < 0)
+    free(stack);
+  return pid;
+}
+
+// Wait for a thread to exit and free its stack.
+// Returns its pid, or -1 if there are no threads.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(stack);
+  return pid;
+}
+
+// Mutexes and condition variables sleep in futex() instead of
+// spinning.  A mutex's state is 0 if it is free, 1 if it is
+// held, and 2 if it is held and threads may be waiting, so
+// unlocking an uncontended mutex makes no system call.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  uint s;
+
+  if((s = cmpxchg(&m->state, 0, 1)) == 0)
+    return;
+  if(s != 2)
+    s = xchg(&m->state, 2);
+  while(s != 0){
+    futex(&m->state, FUTEX_WAIT, 2);
+    s = xchg(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(xadd(&m->state, -1) != 1){
+    m->state = 0;
+    futex(&m->state, FUTEX_WAKE, 1);
+  }
+}
+
+// A condition variable's sequence number changes with each
+// signal, so a waiter that released the mutex just before a
+// signal does not sleep through it.
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex(&c->seq, FUTEX_WAIT, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  xadd(&c->seq, 1);
+  futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  xadd(&c->seq, 1);
+  futex(&c->seq, FUTEX_WAKE, NPROC);
+}
@@ -6,10 +6,19 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "uinfo.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// Threads share a page table, counting their references to
+// it in the reference count of its page; pgdirlock makes
+// dropping one and freeing the table on the last atomic.
+static struct spinlock pgdirlock;
+
+static void freepgdir(pde_t*);
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -87,8 +96,9 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //
 // setupkvm() and exec() set up every page table like this:
 //
-//   0..KERNBASE: user memory (text+data+stack+heap), mapped to
+//   0..UINFO: user memory (text+data+stack+heap), mapped to
 //                phys memory allocated by the kernel
+//   UINFO..KERNBASE: read-only pid and clock pages (see uinfo.c)
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
@@ -96,6 +106,13 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// The first 4 Mbytes above KERNBASE, which hold the kernel and so
+// need 4-Kbyte pages to keep its text read-only, have a page table
+// of their own; the rest of the kernel's mappings are 4-Mbyte
+// superpages, which fill fewer TLB entries.  kvmalloc() builds the
+// kernel's part once, and every page table points to the same
+// kernel page table.
+//
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
@@ -114,33 +131,72 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Like mappages, for the kernel's part of the address space:
+// map the aligned 4-Mbyte stretches of [va, va+size) with single
+// PTE_PS entries in pgdir, so they need no page table.
+static int
+mapkpages(pde_t *pgdir, char *va, uint size, uint pa, int perm)
+{
+  pde_t *pde;
+  uint n;
+
+  while(size > 0){
+    if((uint)va % SPGSIZE == 0 && pa % SPGSIZE == 0 && size >= SPGSIZE){
+      pde = &pgdir[PDX(va)];
+      if(*pde & PTE_P)
+        panic("remap");
+      *pde = pa | perm | PTE_P | PTE_PS;
+      n = SPGSIZE;
+    } else {
+      n = SPGSIZE - (uint)va % SPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table.  Every page table
+// shares the kernel page tables built by kvmalloc(): copying
+// kpgdir's kernel directory entries is all it takes.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
   memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes, and build the kernel mappings
+// that setupkvm() shares with every process.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  initlock(&pgdirlock, "pgdir");
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  // The kernel's mappings are the same in every page table,
+  // so they can be global and survive switches between them.
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkpages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm | PTE_G) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -152,10 +208,63 @@ switchkvm(void)
   lcr3(V2P(kpgdir));   // switch to the kernel page table
 }
 
+// Record that c now has pgdir loaded, instead of the page
+// table it had, and return that one if it must now be freed:
+// freevm() leaves a page table that a CPU has loaded for the
+// last CPU that lets go of it.  Caller must hold pgdirlock.
+static pde_t*
+loaded(struct cpu *c, pde_t *pgdir)
+{
+  struct cpu *o;
+  pde_t *old;
+
+  old = c->pgdir;
+  c->pgdir = pgdir;
+  if(!c->pgdirdead)
+    return 0;
+  c->pgdirdead = 0;
+  for(o = cpus; o < cpus+ncpu; o++)
+    if(o->pgdir == old)
+      return 0;
+  return old;
+}
+
+// Switch from the page table switchuvm() left loaded, if any,
+// to kpgdir.
+void
+releaseuvm(void)
+{
+  struct cpu *c;
+  pde_t *old;
+
+  pushcli();
+  c = mycpu();
+  old = 0;
+  if(c->pgdir){
+    switchkvm();
+    acquire(&pgdirlock);
+    old = loaded(c, 0);
+    release(&pgdirlock);
+  }
+  popcli();
+  if(old)
+    freepgdir(old);
+}
+
 // Switch TSS and h/w page table to correspond to process p.
+// The scheduler does not switch back to kpgdir between
+// processes: a CPU keeps the last page table it loaded, and
+// reloads %cr3 only for another page table, or for one whose
+// process has since run on another CPU, which may have changed
+// its mappings.  Since the kernel mappings are global, even a
+// reload leaves them in the TLB.  The TSS is loaded once;
+// after that only the stack pointer it holds changes.
 void
 switchuvm(struct proc *p)
 {
+  struct cpu *c;
+  pde_t *old;
+
   if(p == 0)
     panic("switchuvm: no process");
   if(p->kstack == 0)
@@ -164,17 +273,31 @@ switchuvm(struct proc *p)
     panic("switchuvm: no pgdir");
 
   pushcli();
-  mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
-                                sizeof(mycpu()->ts)-1, 0);
-  mycpu()->gdt[SEG_TSS].s = 0;
-  mycpu()->ts.ss0 = SEG_KDATA << 3;
-  mycpu()->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
-  // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
-  // forbids I/O instructions (e.g., inb and outb) from user space
-  mycpu()->ts.iomb = (ushort) 0xFFFF;
-  ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  c = mycpu();
+  if(!c->tss){
+    c->gdt[SEG_TSS] = SEG16(STS_T32A, &c->ts, sizeof(c->ts)-1, 0);
+    c->gdt[SEG_TSS].s = 0;
+    c->ts.ss0 = SEG_KDATA << 3;
+    // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
+    // forbids I/O instructions (e.g., inb and outb) from user space
+    c->ts.iomb = (ushort) 0xFFFF;
+    ltr(SEG_TSS << 3);
+    c->tss = 1;
+  }
+  c->ts.esp0 = (uint)p->kstack + KSTACKSIZE;
+  old = 0;
+  if(c->pgdir != p->pgdir || p->ran != c){
+    lcr3(V2P(p->pgdir));  // switch to process's address space
+    if(c->pgdir != p->pgdir){
+      acquire(&pgdirlock);
+      old = loaded(c, p->pgdir);
+      release(&pgdirlock);
+    }
+    p->ran = c;
+  }
   popcli();
+  if(old)
+    freepgdir(old);
 }
 
 // Load the initcode into address 0 of pgdir.
@@ -217,21 +340,22 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 }
 
 // Allocate page tables and physical memory to grow process from oldsz to
-// newsz, which need not be page aligned.  Returns new size or 0 on error.
+// newsz, which need not be page aligned, swapping to make room
+// if need be.  Returns new size or 0 on error.
 int
 allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
   char *mem;
   uint a;
 
-  if(newsz >= KERNBASE)
+  if(newsz > UINFO)
     return 0;
   if(newsz < oldsz)
     return oldsz;
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = swapkalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,6 +372,39 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Grow process from oldsz to newsz like allocuvm(), but only
+// reserve the memory: the new pages are marked PTE_LAZY, and
+// pagein() allocates each one when it is first touched.
+// Returns new size or 0 on error.
+int
+lazyuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  pte_t *pte;
+  uint a;
+
+  if(newsz > UINFO)
+    return 0;
+  if(newsz < oldsz)
+    return oldsz;
+
+  a = PGROUNDUP(oldsz);
+  for(; a < newsz; a += PGSIZE){
+    if(kreserve(1) < 0){
+      deallocuvm(pgdir, newsz, oldsz);
+      return 0;
+    }
+    if((pte = walkpgdir(pgdir, (char*)a, 1)) == 0){
+      kunreserve(1);
+      deallocuvm(pgdir, newsz, oldsz);
+      return 0;
+    }
+    if(*pte & PTE_P)
+      panic("lazyuvm: remap");
+    *pte = PTE_LAZY;
+  }
+  return newsz;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -273,22 +430,65 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_LAZY){
+      if(PTE_SLOT(*pte))
+        swapput(PTE_SLOT(*pte));
+      else
+        kunreserve(1);
+      *pte = 0;
     }
   }
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part's page tables are
+// shared with kpgdir and stay.  If threads still share
+// the page table, just drop the caller's reference.  The
+// user pages, swap slots and reservations go at once, but
+// if a CPU still has the table loaded, its hardware may yet
+// walk it, so leave the directory and page-table pages for
+// switchuvm() or releaseuvm() to free.
 void
 freevm(pde_t *pgdir)
 {
-  uint i;
+  struct cpu *c;
+  int busy;
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
+  acquire(&pgdirlock);
+  if(krefcnt((char*)pgdir) > 1){
+    kfree((char*)pgdir);
+    release(&pgdirlock);
+    return;
+  }
+  release(&pgdirlock);
+  // The last reference is the caller's, so no one else
+  // can change the mappings meanwhile.
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  acquire(&pgdirlock);
+  busy = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c->pgdir == pgdir){
+      c->pgdirdead = 1;
+      busy = 1;
+    }
+  }
+  release(&pgdirlock);
+  if(!busy)
+    freepgdir(pgdir);
+}
+
+// Free pgdir, a page table no process or CPU uses, whose
+// user pages freevm() has freed: what is left are the page
+// tables and the directory.
+static void
+freepgdir(pde_t *pgdir)
+{
+  uint i;
+
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -310,40 +510,372 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Share with page table d the present page *pte of the
+// parent at va, making it copy-on-write if it is writable
+// and not shared memory.
+static int
+sharepage(pte_t *pte, pde_t *d, uint va)
+{
+  uint pa;
+
+  if((*pte & (PTE_W|PTE_SHARED)) == PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  pa = PTE_ADDR(*pte);
+  if(mappages(d, (void*)va, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+    return -1;
+  kincref(P2V(pa));
+  return 0;
+}
+
+// Give page table d a private copy of the present page *pte
+// at va.
+static int
+copypage(pte_t *pte, pde_t *d, uint va)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)P2V(PTE_ADDR(*pte)), PGSIZE);
+  if(mappages(d, (void*)va, PGSIZE, V2P(mem), PTE_FLAGS(*pte)) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Share pgdir, the page table of a process, with one more
+// thread.  A shared page table never has copy-on-write pages:
+// when one thread broke the sharing of a page, the others
+// could go on reading the old copy through their TLBs.  So
+// give the process its own copy of each such page first.
+// Returns 0 on success, -1 if memory ran out.
+int
+shareuvm(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = 0; a < sz; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void*)a, 0)) == 0)
+      continue;
+    if((*pte & PTE_COW) && cowfault(pgdir, a) < 0)
+      return -1;
+  }
+  kincref((char*)pgdir);
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  The child shares the parent's pages:
+// writable pages become read-only copy-on-write pages in
+// both page tables, and cowfault() copies a page when
+// either process first writes it.  A page table that
+// threads share is copied outright instead; see shareuvm().
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  pte_t *pte, *npte;
+  uint i;
+  int shared;
 
   if((d = setupkvm()) == 0)
     return 0;
+  shared = krefcnt((char*)pgdir) > 1;
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
       panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
+    if(!(*pte & PTE_P)){
+      if(!(*pte & PTE_LAZY))
+        panic("copyuvm: page not present");
+      // Swapped out: the child shares the slot.
+      if(PTE_SLOT(*pte)){
+        if((npte = walkpgdir(d, (void *) i, 1)) == 0)
+          goto bad;
+        swapdup(PTE_SLOT(*pte));
+        *npte = *pte;
+        continue;
+      }
+      // Not touched yet: the child gets its own promise.
+      if(kreserve(1) < 0)
+        goto bad;
+      if((npte = walkpgdir(d, (void *) i, 1)) == 0){
+        kunreserve(1);
+        goto bad;
+      }
+      *npte = PTE_LAZY;
+      continue;
     }
+    // Read-only pages, such as text, can be shared even
+    // when the page table is.
+    if(shared && (*pte & PTE_W)){
+      if(copypage(pte, d, i) < 0)
+        goto bad;
+    } else if(sharepage(pte, d, i) < 0)
+      goto bad;
   }
+  // The parent's TLB may still hold writable entries
+  // for the pages that were just made copy-on-write.
+  lcr3(rcr3());
   return d;
 
 bad:
+  lcr3(rcr3());
   freevm(d);
   return 0;
 }
 
+// Like copyuvm, but share into the child's page table d just
+// the pages of pgdir in [start, end) that are present; the
+// rest is left for the child to fault in.
+int
+copyuvmrange(pde_t *pgdir, pde_t *d, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkpgdir(pgdir, (void*)a, 0);
+    if(pte == 0 || !(*pte & PTE_P))
+      continue;
+    if(sharepage(pte, d, a) < 0){
+      lcr3(rcr3());
+      return -1;
+    }
+  }
+  lcr3(rcr3());
+  return 0;
+}
+
+// Map the page at kernel address mem at user address va,
+// handing pgdir the caller's reference to it.
+int
+uvmmap(pde_t *pgdir, uint va, char *mem, int perm)
+{
+  return mappages(pgdir, (void*)va, PGSIZE, V2P(mem), perm);
+}
+
+// Handle a write to the copy-on-write page at user
+// address va in pgdir: give the writer its own copy,
+// or, if no one else shares the page any more, just
+// make it writable again.  Return 0 on success, -1 if
+// va is not a copy-on-write page or memory ran out.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+
+  if(va >= KERNBASE)
+    return -1;
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefcnt(P2V(pa)) == 1){
+    *pte = pa | flags;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree((char*)P2V(pa));
+  }
+  invlpg((void*)PGROUNDDOWN(va));
+  return 0;
+}
+
+// Return the text segment of p that alone holds the page at
+// user address a, or 0 if there is none.
+static struct seg*
+textpage(struct proc *p, uint a)
+{
+  struct seg *s, *t;
+
+  t = 0;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(a >= PGROUNDUP(s->va + s->filesz) || a + PGSIZE <= s->va)
+      continue;
+    if(t || !s->text)
+      return 0;
+    t = s;
+  }
+  return t;
+}
+
+// Does [va, va+n) overlap one of p's read-only text segments?
+// Writes through the kernel mapping would fault on the shared
+// pages, so system calls refuse to write there.
+int
+textoverlaps(struct proc *p, uint va, uint n)
+{
+  struct seg *s;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++)
+    if(s->text && va < PGROUNDUP(s->va + s->filesz) &&
+       va + n > s->va)
+      return 1;
+  return 0;
+}
+
+// Bring in the lazy page at user address va of process p:
+// allocate a zeroed page and read into it whatever part of p's
+// exec()ed segments it holds, or, for a page of text, map the
+// page cache's copy read-only, or read back a page swapped
+// out.  Reading the file or swap sleeps, so pagein() refuses
+// pages that need it unless cansleep is set.
+// Return 0 on success, -1 if va is not a lazy page or it
+// could not be brought in.
+int
+pagein(struct proc *p, uint va, int cansleep)
+{
+  pte_t *pte;
+  struct seg *s;
+  uint a, start, end, old, perm;
+  char *mem;
+
+  a = PGROUNDDOWN(va);
+  if(a >= p->sz)
+    return -1;
+  if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0)
+    return -1;
+  old = *pte;
+  if((old & (PTE_P|PTE_LAZY)) != PTE_LAZY)
+    return -1;
+  if(PTE_SLOT(old))
+    return cansleep ? swapin(pte, old) : -1;
+  if(!cansleep){
+    for(s = p->seg; s < &p->seg[p->nseg]; s++)
+      if(a < s->va + s->filesz && a + PGSIZE > s->va)
+        return -1;
+  }
+
+  if((s = textpage(p, a)) != 0){
+    ilock(p->exe);
+    mem = pcget(p->exe, s->off + (a - s->va));
+    iunlock(p->exe);
+    if(mem == 0)
+      return -1;
+    perm = PTE_U | PTE_P;
+    goto map;
+  }
+
+  if((mem = cansleep ? swapkalloc() : kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  perm = PTE_W | PTE_U | PTE_P;
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    start = a > s->va ? a : s->va;
+    end = a + PGSIZE < s->va + s->filesz ? a + PGSIZE : s->va + s->filesz;
+    if(start >= end)
+      continue;
+    ilock(p->exe);
+    if(readi(p->exe, mem + (start - a), s->off + (start - s->va),
+             end - start) != end - start){
+      iunlock(p->exe);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(p->exe);
+  }
+map:
+  // Another thread sharing the page table may have
+  // brought the page in meanwhile.
+  if(cmpxchg(pte, old, V2P(mem) | perm) != old){
+    kfree(mem);
+    return 0;
+  }
+  kunreserve(1);
+  return 0;
+}
+
+// Did a fault at user address va, a write if write is set,
+// hit a page that pagein() or cowfault() would have brought
+// in, had there been memory?
+int
+wantpage(pde_t *pgdir, uint va, int write)
+{
+  pte_t *pte;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return 0;
+  if((*pte & (PTE_P|PTE_LAZY)) == PTE_LAZY)
+    return 1;
+  return write && (*pte & (PTE_P|PTE_U|PTE_COW)) == (PTE_P|PTE_U|PTE_COW);
+}
+
+// Sweep the clock hand, for swapvictim(), over pgdir's pages
+// from *va up to sz.  Clear the accessed bit of each private,
+// writable page, and take the first such page whose bit was
+// already clear: its PTE becomes a lazy one naming swap slot
+// s.  Returns the page, with *va just past it, or 0.  The
+// caller makes the TLB forget the changed PTEs.
+char*
+clockuvm(pde_t *pgdir, uint *va, uint sz, uint s)
+{
+  pte_t *pte;
+  char *mem;
+  uint a;
+
+  for(a = *va; a < sz; a += PGSIZE){
+    if(!(pgdir[PDX(a)] & PTE_P)){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if((*pte & (PTE_P|PTE_U|PTE_W|PTE_SHARED)) != (PTE_P|PTE_U|PTE_W))
+      continue;
+    mem = P2V(PTE_ADDR(*pte));
+    if(krefcnt(mem) != 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    *pte = PTE_LAZY | s << PTXSHIFT;
+    *va = a + PGSIZE;
+    return mem;
+  }
+  *va = a;
+  return 0;
+}
+
+// Bring in the lazy or mapped pages of the current process in
+// [va, va+n), which the caller has checked lie below its size or
+// in one of its mappings.  System calls
+// do this before touching user memory, since they may do so while
+// holding locks, where a fault could not sleep to read a page.
+int
+prefault(uint va, uint n)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a, last;
+
+  if(n == 0)
+    return 0;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + n - 1);
+  for(;;){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & (PTE_P|PTE_LAZY)) == PTE_LAZY){
+      if(pagein(p, a, 1) < 0)
+        return -1;
+    } else if((pte == 0 || !(*pte & PTE_P)) && a >= p->sz){
+      if(mmapfault(p, a, 1) < 0)
+        return -1;
+    }
+    if(a == last)
+      break;
+    a += PGSIZE;
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -352,6 +884,8 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
+  if(pte == 0)
+    return 0;
   if((*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
@@ -367,10 +901,16 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // Writes through the kernel mapping do not fault,
+    // so break copy-on-write sharing by hand.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowfault(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -0,0 +1,2 @@
+// waitpid() options.
+#define WNOHANG  1   // return 0 rather than wait for a child